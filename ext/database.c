@@ -1,10 +1,38 @@
+#include <stdlib.h>
+#include <string.h>
 #include "database.h"
+#include "list.h"
+#include "search_index.h"
+#include "reverse_index.h"
+#include "version.h"
+#include "file_index.h"
+#include "pool.h"
+#include "log.h"
+#include "posix_re.h"
 
 /***************************************
  * Variables
  ***************************************/
 
 VALUE rb_cAlpm_Database;
+static VALUE rb_cWeakMap;
+
+/* A package to sort, see #sorted_packages. */
+typedef struct {
+  alpm_pkg_t* p_pkg;
+  const char* name;
+  version_t version; /* Only parsed when sorting by version */
+} sort_entry_t;
+
+/* Parts of the local database entries #prefetch can load. */
+enum prefetch_field {
+  PREFETCH_DESC    = 1 << 0,
+  PREFETCH_DEPENDS = 1 << 1,
+  PREFETCH_FILES   = 1 << 2
+};
+
+/* Number of packages each #prefetch job loads. */
+#define PREFETCH_CHUNK 32
 
 /** Retrieves the associated Ruby Alpm instance from the given Package
  * instance, reads the C alpm_handle_t pointer from it and returns that
@@ -19,6 +47,140 @@ static alpm_handle_t* get_alpm_from_db(VALUE db)
 }
 
 
+/* Throws away everything cached about the packages of `db', i.e.
+ * its Package instances and its search, reverse dependency and
+ * file indices. Needed whenever libalpm may have freed the
+ * packages. Runs no Ruby code, so a pending interrupt can’t cut
+ * it short. */
+static void clear_caches(VALUE db)
+{
+  rb_iv_set(db, "packages", rb_obj_alloc(rb_cWeakMap));
+  rb_iv_set(db, "search_index", Qnil);
+  rb_iv_set(db, "reverse_index", Qnil);
+  rb_iv_set(db, "file_index", Qnil);
+}
+
+/* Orders packages like Package#<=> does: by name, then by version. */
+static int compare_by_name(const void* a, const void* b)
+{
+  const sort_entry_t* p_a = (const sort_entry_t*) a;
+  const sort_entry_t* p_b = (const sort_entry_t*) b;
+  int result = strcoll(p_a->name, p_b->name);
+
+  if (result == 0)
+    result = alpm_pkg_vercmp(alpm_pkg_get_version(p_a->p_pkg), alpm_pkg_get_version(p_b->p_pkg));
+
+  return result;
+}
+
+/* Orders packages by their parsed versions, then by name. */
+static int compare_by_version(const void* a, const void* b)
+{
+  const sort_entry_t* p_a = (const sort_entry_t*) a;
+  const sort_entry_t* p_b = (const sort_entry_t*) b;
+  int result = version_compare(&p_a->version, &p_b->version);
+
+  if (result == 0)
+    result = strcmp(p_a->name, p_b->name);
+
+  return result;
+}
+
+/* Returns the package cache of the Database instance `db', which
+ * libalpm loads on first use, once no other thread runs libalpm on
+ * its handle (see wait_for_handle()). The log messages it produced
+ * meanwhile are delivered, and an exception raised by the log
+ * callback is raised right here. */
+static alpm_list_t* get_pkgcache(VALUE db)
+{
+  alpm_db_t* p_db = NULL;
+  alpm_list_t* p_pkgs = NULL;
+
+  Data_Get_Struct(db, alpm_db_t, p_db);
+  wait_for_handle(rb_iv_get(db, "@alpm"));
+  p_pkgs = alpm_db_get_pkgcache(p_db);
+
+  flush_log(1);
+  return p_pkgs;
+}
+
+/** Returns the Database instance for `p_db', which belongs to the
+ * Alpm instance `rb_alpm'. Each Alpm instance keeps its Database
+ * instances around, so for the same `p_db' this always returns the
+ * same object. */
+VALUE wrap_database(VALUE rb_alpm, alpm_db_t* p_db)
+{
+  VALUE cache = rb_iv_get(rb_alpm, "databases");
+  VALUE key = ULONG2NUM((unsigned long) p_db);
+  VALUE obj;
+
+  if (!NIL_P(cache) && !NIL_P(obj = rb_hash_lookup(cache, key))) /* Single = intended */
+    return obj;
+
+  obj = Data_Wrap_Struct(rb_cAlpm_Database, NULL, NULL, p_db);
+  rb_iv_set(obj, "@alpm", rb_alpm);
+  clear_caches(obj);
+
+  if (!NIL_P(cache))
+    rb_hash_aset(cache, key, obj);
+
+  return obj;
+}
+
+/** Tells that libalpm changed the packages of `p_db', e.g. by
+ * committing a transaction to the local database, so that whatever
+ * is cached about them is rebuilt on demand and dependency graphs
+ * over them refuse to be used. */
+void database_changed(VALUE rb_alpm, alpm_db_t* p_db)
+{
+  clear_caches(wrap_database(rb_alpm, p_db));
+  handle_changed(rb_alpm);
+}
+
+/** Returns the reverse dependency index of the Database instance
+ * `db', building it if necessary. See reverse_index_collect(). */
+VALUE reverse_index_of_db(VALUE db)
+{
+  alpm_db_t* p_db = NULL;
+  VALUE index = rb_iv_get(db, "reverse_index");
+
+  if (NIL_P(index)) {
+    Data_Get_Struct(db, alpm_db_t, p_db);
+    get_pkgcache(db);
+    index = reverse_index_new(p_db);
+    rb_iv_set(db, "reverse_index", index);
+  }
+
+  return index;
+}
+
+/** Returns the file index of the Database instance `db', see
+ * file_index_owners(). If `path' is NULL, a cached index is returned
+ * or one is built in memory. Otherwise the index is (re)opened with
+ * persistence at `path', see file_index_open(). */
+VALUE file_index_of_db(VALUE db, const char* path)
+{
+  alpm_db_t* p_db = NULL;
+  VALUE index = rb_iv_get(db, "file_index");
+
+  if (NIL_P(index) || path) {
+    Data_Get_Struct(db, alpm_db_t, p_db);
+    get_pkgcache(db);
+    index = file_index_open(get_alpm_from_db(db), p_db, path);
+    rb_iv_set(db, "file_index", index);
+  }
+
+  return index;
+}
+
+/** Returns the weak map from alpm_pkg_t pointers (as Integers) to
+ * the Package instances currently alive for the packages of `p_db'.
+ * See wrap_package(). */
+VALUE package_cache_of_db(VALUE rb_alpm, alpm_db_t* p_db)
+{
+  return rb_iv_get(wrap_database(rb_alpm, p_db), "packages");
+}
+
 /***************************************
  * Methods
  ***************************************/
@@ -62,14 +224,358 @@ static VALUE get(VALUE self, VALUE name)
   alpm_pkg_t* p_pkg = NULL;
   Data_Get_Struct(self, alpm_db_t, p_db);
 
+  wait_for_handle(rb_iv_get(self, "@alpm"));
   p_pkg = alpm_db_get_pkg(p_db, StringValuePtr(name));
+  flush_log(1);
 
   if (p_pkg)
-    return Data_Wrap_Struct(rb_cAlpm_Package, NULL, NULL, p_pkg);
+    return wrap_package(rb_iv_get(self, "@alpm"), p_pkg);
   else
     return Qnil;
 }
 
+/* Size function for the enumerator returned by #each_package. */
+static VALUE each_package_size(VALUE self, VALUE args, VALUE eobj)
+{
+  return list_size(get_pkgcache(self));
+}
+
+/**
+ * call-seq:
+ *   each_package{|pkg| ...}
+ *   each_package() → an_enumerator
+ *
+ * Iterates over all packages in the database. Unlike
+ * <tt>search(".")</tt>, this directly walks libalpm’s package
+ * cache: no regular expressions are involved and no intermediate
+ * array is built, each Package is created only when it is yielded.
+ * If called without a block, a lazy enumerator is returned whose
+ * +size+ is the number of packages in the database.
+ *
+ * === Parameters
+ * [pkg (Block)]
+ *   The currently iterated Package.
+ *
+ * === Return value
+ * +self+ if a block is given, an Enumerator otherwise.
+ */
+static VALUE each_package(VALUE self)
+{
+  RETURN_SIZED_ENUMERATOR(self, 0, NULL, each_package_size);
+
+  list_each(get_pkgcache(self), list_conv_package, rb_iv_get(self, "@alpm"));
+  return self;
+}
+
+/**
+ * call-seq:
+ *   packages_to_a( [ fields: [] ] [, as: :tuple ] ) → an_array
+ *
+ * Extracts attributes of all packages in the database in a single
+ * pass, without creating any Package instances.
+ *
+ * === Parameters
+ * [fields ([])]
+ *   An array of Symbols naming the attributes to extract, see
+ *   Package#to_h for the possible values. If empty, all of them
+ *   are extracted.
+ * [as (:tuple)]
+ *   If :tuple, each package is represented by an array with the
+ *   values in the order of +fields+. If :hash, each package is
+ *   represented by a hash like the one returned by Package#to_h.
+ *
+ * === Return value
+ * An array with one tuple or hash per package.
+ */
+static VALUE packages_to_a(int argc, VALUE argv[], VALUE self)
+{
+  alpm_list_t* item = NULL;
+  enum package_field* p_fields = NULL;
+  VALUE opts;
+  VALUE kwvals[2] = {Qundef, Qundef};
+  ID kwnames[2];
+  VALUE rfields = Qnil;
+  VALUE tmp;
+  VALUE result;
+  int as_hash = 0;
+  int count;
+  int i;
+
+  rb_scan_args(argc, argv, "0:", &opts);
+
+  kwnames[0] = rb_intern("fields");
+  kwnames[1] = rb_intern("as");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, kwnames, 0, 2, kwvals);
+
+  if (kwvals[0] != Qundef)
+    rfields = rb_convert_type(kwvals[0], T_ARRAY, "Array", "to_ary");
+  if (kwvals[1] != Qundef) {
+    if (kwvals[1] == STR2SYM("hash"))
+      as_hash = 1;
+    else if (kwvals[1] != STR2SYM("tuple"))
+      rb_raise(rb_eArgError, "Expected :tuple or :hash for as:");
+  }
+
+  count = NIL_P(rfields) ? 0 : RARRAY_LEN(rfields);
+  p_fields = ALLOCV_N(enum package_field, tmp, count > PKG_FIELD_COUNT ? count : PKG_FIELD_COUNT);
+  count = package_fields_from_ruby(count, count ? RARRAY_CONST_PTR(rfields) : NULL, p_fields);
+
+  result = rb_ary_new();
+  for(item = get_pkgcache(self); item; item = alpm_list_next(item)) {
+    VALUE entry = as_hash ? rb_hash_new() : rb_ary_new2(count);
+
+    for(i=0; i < count; i++) {
+      VALUE value = package_field_value(item->data, p_fields[i]);
+
+      if (as_hash)
+        rb_hash_aset(entry, package_field_name(p_fields[i]), value);
+      else
+        rb_ary_push(entry, value);
+    }
+
+    rb_ary_push(result, entry);
+  }
+
+  ALLOCV_END(tmp);
+  return result;
+}
+
+/**
+ * call-seq:
+ *   to_columns( *fields [, packed: false ] ) → a_hash
+ *
+ * Exports attributes of all packages in the database column-wise,
+ * i.e. as one array per attribute, where the n-th element of each
+ * array belongs to the n-th package. The package cache is walked
+ * only once and no Package instances are created.
+ *
+ * === Parameters
+ * [*fields (splat)]
+ *   Symbols naming the attributes to export, see Package#to_h for
+ *   the possible values. If none are given, all are exported.
+ * [packed (false)]
+ *   If set, the integer columns (:size, :isize, :builddate, and
+ *   :installdate, the dates as seconds since the epoch) are returned
+ *   as binary strings of native-endian 64-bit signed integers
+ *   (<tt>String#unpack("q*")</tt>) instead of arrays, suitable for
+ *   handing directly to numerical libraries.
+ *
+ * === Return value
+ * A hash mapping each field name to its column.
+ */
+static VALUE to_columns(int argc, VALUE argv[], VALUE self)
+{
+  alpm_list_t* p_pkgs = NULL;
+  alpm_list_t* item = NULL;
+  enum package_field* p_fields = NULL;
+  VALUE* p_columns = NULL;
+  int64_t** p_packed = NULL;
+  VALUE rfields, opts;
+  VALUE kwval = Qundef;
+  ID kwname;
+  VALUE tmp1, tmp2, tmp3;
+  VALUE result;
+  size_t npkgs;
+  size_t row;
+  int packed = 0;
+  int count;
+  int i;
+
+  rb_scan_args(argc, argv, "*:", &rfields, &opts);
+
+  kwname = rb_intern("packed");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, &kwname, 0, 1, &kwval);
+  packed = (kwval != Qundef && RTEST(kwval)) ? 1 : 0;
+
+  count = RARRAY_LEN(rfields);
+  p_fields = ALLOCV_N(enum package_field, tmp1, count > PKG_FIELD_COUNT ? count : PKG_FIELD_COUNT);
+  count = package_fields_from_ruby(count, RARRAY_CONST_PTR(rfields), p_fields);
+  p_columns = ALLOCV_N(VALUE, tmp2, count);
+  p_packed = ALLOCV_N(int64_t*, tmp3, count);
+
+  p_pkgs = get_pkgcache(self);
+  npkgs = alpm_list_count(p_pkgs);
+
+  /* Pre-size all columns */
+  result = rb_hash_new();
+  for(i=0; i < count; i++) {
+    if (packed && package_field_is_int(p_fields[i])) {
+      p_columns[i] = rb_str_new(NULL, npkgs * sizeof(int64_t));
+      p_packed[i] = (int64_t*) RSTRING_PTR(p_columns[i]);
+    }
+    else {
+      p_columns[i] = rb_ary_new2(npkgs);
+      p_packed[i] = NULL;
+    }
+
+    rb_hash_aset(result, package_field_name(p_fields[i]), p_columns[i]);
+  }
+
+  /* Fill them in one pass */
+  for(item = p_pkgs, row = 0; item && row < npkgs; item = alpm_list_next(item), row++) {
+    for(i=0; i < count; i++) {
+      if (p_packed[i])
+        p_packed[i][row] = package_field_int(item->data, p_fields[i]);
+      else
+        rb_ary_push(p_columns[i], package_field_value(item->data, p_fields[i]));
+    }
+  }
+
+  ALLOCV_END(tmp1);
+  ALLOCV_END(tmp2);
+  ALLOCV_END(tmp3);
+  return result;
+}
+
+/**
+ * call-seq:
+ *   get_many( names [, as: :array ] ) → an_array or a_hash
+ *
+ * Find many packages by name at once. This is much faster than
+ * calling #get for each name, as the whole list is resolved in a
+ * single call against libalpm’s package hash.
+ *
+ * === Parameters
+ * [names]
+ *   An array of package names. Each must match exactly.
+ * [as (:array)]
+ *   If :array, returns an array aligned with +names+. If :hash,
+ *   returns a hash mapping each name to its result.
+ *
+ * === Return value
+ * The Package instances for +names+, with +nil+ for each name
+ * that isn’t in the database.
+ */
+static VALUE get_many(int argc, VALUE argv[], VALUE self)
+{
+  alpm_db_t* p_db = NULL;
+  VALUE rb_alpm = rb_iv_get(self, "@alpm");
+  VALUE names, opts;
+  VALUE kwval = Qundef;
+  ID kwname;
+  VALUE result;
+  long i;
+  int as_hash = 0;
+
+  Data_Get_Struct(self, alpm_db_t, p_db);
+  rb_scan_args(argc, argv, "1:", &names, &opts);
+
+  kwname = rb_intern("as");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, &kwname, 0, 1, &kwval);
+  if (kwval != Qundef) {
+    if (kwval == STR2SYM("hash"))
+      as_hash = 1;
+    else if (kwval != STR2SYM("array"))
+      rb_raise(rb_eArgError, "Expected :array or :hash for as:");
+  }
+
+  names = rb_convert_type(names, T_ARRAY, "Array", "to_ary");
+  result = as_hash ? rb_hash_new() : rb_ary_new2(RARRAY_LEN(names));
+
+  wait_for_handle(rb_alpm);
+  for(i=0; i < RARRAY_LEN(names); i++) {
+    VALUE name = rb_ary_entry(names, i);
+    alpm_pkg_t* p_pkg = alpm_db_get_pkg(p_db, StringValueCStr(name));
+    VALUE pkg = p_pkg ? wrap_package(rb_alpm, p_pkg) : Qnil;
+
+    if (as_hash)
+      rb_hash_aset(result, name, pkg);
+    else
+      rb_ary_push(result, pkg);
+  }
+
+  flush_log(1);
+  return result;
+}
+
+/**
+ * call-seq:
+ *   sorted_packages( [ by: :name ] ) → an_array
+ *
+ * All packages in the database, sorted in C. This is a lot faster
+ * than sorting #each_package in Ruby, which calls back into C for
+ * every single comparison.
+ *
+ * === Parameters
+ * [by (:name)]
+ *   The sort key.
+ *   [:name]
+ *     Sort by name, then by version, i.e. in the order of
+ *     Package#<=>.
+ *   [:version]
+ *     Sort by version from oldest to newest, then by name. Each
+ *     version is parsed only once, see Alpm::Version.
+ *
+ * === Return value
+ * An array of Package instances.
+ */
+static VALUE sorted_packages(int argc, VALUE argv[], VALUE self)
+{
+  alpm_db_t* p_db = NULL;
+  alpm_list_t* item = NULL;
+  VALUE rb_alpm = rb_iv_get(self, "@alpm");
+  VALUE opts;
+  VALUE kwval = Qundef;
+  ID kwname;
+  VALUE tmp_entries, tmp_tokens;
+  sort_entry_t* p_entries = NULL;
+  version_token_t* p_tokens = NULL;
+  size_t ntokens = 0;
+  size_t count;
+  size_t i;
+  int by_version = 0;
+  VALUE result;
+
+  Data_Get_Struct(self, alpm_db_t, p_db);
+  rb_scan_args(argc, argv, "0:", &opts);
+
+  kwname = rb_intern("by");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, &kwname, 0, 1, &kwval);
+  if (kwval != Qundef) {
+    if (kwval == STR2SYM("version"))
+      by_version = 1;
+    else if (kwval != STR2SYM("name"))
+      rb_raise(rb_eArgError, "Expected :name or :version for by:");
+  }
+
+  count = alpm_list_count(get_pkgcache(self));
+  p_entries = ALLOCV_N(sort_entry_t, tmp_entries, count);
+
+  for(item = alpm_db_get_pkgcache(p_db), i = 0; item && i < count; item = alpm_list_next(item), i++) {
+    p_entries[i].p_pkg = (alpm_pkg_t*) item->data;
+    p_entries[i].name = alpm_pkg_get_name(p_entries[i].p_pkg);
+    if (by_version)
+      ntokens += version_max_tokens(alpm_pkg_get_version(p_entries[i].p_pkg));
+  }
+
+  if (by_version) {
+    p_tokens = ALLOCV_N(version_token_t, tmp_tokens, ntokens);
+
+    ntokens = 0;
+    for(i=0; i < count; i++) {
+      const char* version = alpm_pkg_get_version(p_entries[i].p_pkg);
+
+      version_parse(version, &p_entries[i].version, p_tokens + ntokens);
+      ntokens += version_max_tokens(version);
+    }
+  }
+
+  qsort(p_entries, count, sizeof(sort_entry_t), by_version ? compare_by_version : compare_by_name);
+
+  result = rb_ary_new_capa(count);
+  for(i=0; i < count; i++)
+    rb_ary_push(result, wrap_package(rb_alpm, p_entries[i].p_pkg));
+
+  if (by_version)
+    ALLOCV_END(tmp_tokens);
+  ALLOCV_END(tmp_entries);
+  return result;
+}
+
 /**
  * call-seq:
  *   inspect() → a_string
@@ -150,19 +656,10 @@ static VALUE remove_server(VALUE self, VALUE url)
 static VALUE get_servers(VALUE self)
 {
   alpm_db_t* p_db = NULL;
-  alpm_list_t* p_servers = NULL;
-  alpm_list_t* p_item = NULL;
-  VALUE result = rb_ary_new();
+  VALUE result;
   Data_Get_Struct(self, alpm_db_t, p_db);
 
-  p_servers = alpm_db_get_servers(p_db);
-  if (!p_servers)
-    return result;
-
-  for(p_item = p_servers; p_item; p_item = alpm_list_next(p_item)) {
-    rb_ary_push(result, rb_str_new2((char*) p_item->data));
-  }
-
+  result = list_to_ary(alpm_db_get_servers(p_db), list_conv_mutable_string, Qnil);
   return rb_obj_freeze(result); /* Modifying this in Ruby land would be nonsense */
 }
 
@@ -200,9 +697,119 @@ static VALUE set_servers(VALUE self, VALUE ary)
   return ary;
 }
 
+/* Arguments for and state of search_body() and search_ensure(). */
+struct search_args {
+  VALUE db;
+  VALUE rb_alpm;
+  VALUE terms;
+  long limit;
+  posix_re_t** p_res;
+  long nres;
+};
+
+/* Whether `p_pkg' matches the search term `term', compiled to `p_re',
+ * by name, description, provision or group, like alpm_db_search()
+ * matches a package. */
+static int search_matches(alpm_pkg_t* p_pkg, const char* term, const posix_re_t* p_re)
+{
+  const char* name = alpm_pkg_get_name(p_pkg);
+  const char* desc = alpm_pkg_get_desc(p_pkg);
+  alpm_list_t* item = NULL;
+
+  if (name && (strcmp(name, term) == 0 || posix_re_match(p_re, name)))
+    return 1;
+  if (desc && posix_re_match(p_re, desc))
+    return 1;
+
+  for(item = alpm_pkg_get_provides(p_pkg); item; item = alpm_list_next(item)) {
+    if (posix_re_match(p_re, ((alpm_depend_t*) item->data)->name))
+      return 1;
+  }
+  for(item = alpm_pkg_get_groups(p_pkg); item; item = alpm_list_next(item)) {
+    if (posix_re_match(p_re, (const char*) item->data))
+      return 1;
+  }
+
+  return 0;
+}
+
+/* rb_ensure() body for search(). Walks the package cache itself
+ * instead of calling alpm_db_search(), so that the packages can be
+ * handed out as they are found and the walk stops at the limit. */
+static VALUE search_body(VALUE ptr)
+{
+  struct search_args* p_args = (struct search_args*) ptr;
+  alpm_list_t* item = NULL;
+  VALUE result = Qnil;
+  long count = 0;
+  long i;
+
+  /* Compile the terms */
+  p_args->p_res = ALLOC_N(posix_re_t*, RARRAY_LEN(p_args->terms) ? RARRAY_LEN(p_args->terms) : 1);
+  for(i=0; i < RARRAY_LEN(p_args->terms); i++) {
+    VALUE term = rb_check_string_type(rb_ary_entry(p_args->terms, i));
+    char buf[256] = "out of memory";
+
+    if (!RTEST(term)) {
+      rb_raise(rb_eTypeError, "Argument is not a string (#to_str)");
+      return Qnil;
+    }
+
+    /* Keep it alive and unchanged by later terms’ #to_str */
+    term = rb_str_new_frozen(term);
+    rb_ary_store(p_args->terms, i, term);
+
+    if (!(p_args->p_res[i] = posix_re_compile(StringValueCStr(term), buf, sizeof(buf)))) /* Single = intended */
+      rb_raise(rb_eArgError, "Invalid regular expression %s: %s", RSTRING_PTR(term), buf);
+    p_args->nres++;
+  }
+
+  if (!rb_block_given_p())
+    result = rb_ary_new();
+
+  /* Perform the query */
+  for(item = get_pkgcache(p_args->db); item; item = alpm_list_next(item)) {
+    VALUE pkg;
+
+    if (p_args->limit >= 0 && count >= p_args->limit)
+      break;
+
+    for(i=0; i < p_args->nres; i++) {
+      if (!search_matches(item->data, RSTRING_PTR(rb_ary_entry(p_args->terms, i)), p_args->p_res[i]))
+        break;
+    }
+    if (i < p_args->nres)
+      continue;
+
+    pkg = wrap_package(p_args->rb_alpm, item->data);
+    if (NIL_P(result))
+      rb_yield(pkg);
+    else
+      rb_ary_push(result, pkg);
+
+    count++;
+  }
+
+  return result;
+}
+
+/* rb_ensure() ensure for search(). Frees the compiled terms. */
+static VALUE search_ensure(VALUE ptr)
+{
+  struct search_args* p_args = (struct search_args*) ptr;
+  long i;
+
+  for(i=0; i < p_args->nres; i++)
+    posix_re_free(p_args->p_res[i]);
+  xfree(p_args->p_res);
+
+  return Qnil;
+}
+
 /**
  * call-seq:
- *   search(*queries, ...) → an_array
+ *   search(*queries [, limit: nil ] ) → an_array
+ *   search(*queries [, limit: nil ] ){|pkg| ...} → nil
  *
  * Search the database with POSIX regular expressions for packages.
  * === Parameters
@@ -214,43 +821,147 @@ static VALUE set_servers(VALUE self, VALUE ary)
  *   one needs to match for the package to be considered.
  *
  *   Note that the match is not performed by Ruby or even Oniguruma/Onigmo,
- *   but directly in libalpm via the +regexp+ library in C.
+ *   but with the same POSIX +regexp+ library in C that libalpm uses.
+ * [limit (nil)]
+ *   If given, return or yield at most this many packages. The search
+ *   stops as soon as that many have been found.
+ * [pkg (Block)]
+ *   If a block is given, each matching Package is yielded to it
+ *   instead of being collected into an array. This saves the
+ *   result array for broad queries.
  *
  * === Return value
- * An array of Package instances whose names matched _all_ regular expressions.
+ * Without a block, an array of Package instances whose names matched
+ * _all_ regular expressions. With a block, +nil+.
  */
 static VALUE search(int argc, VALUE argv[], VALUE self)
 {
-  alpm_db_t* p_db = NULL;
-  alpm_list_t* targets = NULL;
-  alpm_list_t* packages = NULL;
-  alpm_list_t* item = NULL;
-  VALUE result = rb_ary_new();
-  int i;
+  struct search_args args;
+  VALUE opts;
+  VALUE kwval = Qundef;
+  ID kwname;
 
-  Data_Get_Struct(self, alpm_db_t, p_db);
+  rb_scan_args(argc, argv, "*:", &args.terms, &opts);
 
-  /* Convert our Ruby array to an alpm_list with C strings */
-  for(i=0; i < argc; i++) {
-    VALUE term = rb_check_string_type(argv[i]);
-    if (!RTEST(term)) {
-      rb_raise(rb_eTypeError, "Argument is not a string (#to_str)");
-      return Qnil;
-    }
+  kwname = rb_intern("limit");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, &kwname, 0, 1, &kwval);
 
-    targets = alpm_list_add(targets, StringValuePtr(term));
+  args.limit = -1;
+  if (kwval != Qundef && !NIL_P(kwval)) {
+    args.limit = NUM2LONG(kwval);
+    if (args.limit < 0)
+      rb_raise(rb_eArgError, "Limit must not be negative, got %ld.", args.limit);
   }
 
-  /* Perform the query */
-  packages = alpm_db_search(p_db, targets);
-  if (!packages)
-    return result;
+  args.db = self;
+  args.rb_alpm = rb_iv_get(self, "@alpm");
+  args.p_res = NULL;
+  args.nres = 0;
+
+  return rb_ensure(RUBY_METHOD_FUNC(search_body), (VALUE) &args, RUBY_METHOD_FUNC(search_ensure), (VALUE) &args);
+}
 
-  for(item=packages; item; item = alpm_list_next(item))
-    rb_ary_push(result, Data_Wrap_Struct(rb_cAlpm_Package, NULL, NULL, item->data));
+/* Returns the search index of `self', building it if necessary. */
+static VALUE get_search_index(VALUE self)
+{
+  alpm_db_t* p_db = NULL;
+  VALUE index = rb_iv_get(self, "search_index");
 
-  alpm_list_free(targets);
-  return result;
+  if (NIL_P(index)) {
+    Data_Get_Struct(self, alpm_db_t, p_db);
+    get_pkgcache(self);
+    index = search_index_new(p_db);
+    rb_iv_set(self, "search_index", index);
+  }
+
+  return index;
+}
+
+/**
+ * call-seq:
+ *   build_search_index() → self
+ *
+ * Builds the in-memory index used by #indexed_search right away,
+ * rather than on the first query. The index is thrown away when
+ * the database is updated and rebuilt on demand.
+ */
+static VALUE build_search_index(VALUE self)
+{
+  get_search_index(self);
+  return self;
+}
+
+/**
+ * call-seq:
+ *   reverse_dependency_index() → self
+ *
+ * Builds the index answering Package#required_by and
+ * Package#optional_for right away, rather than on their first call.
+ * It maps each name that is depended on to the packages of this
+ * database depending on it, so these methods only look at the
+ * dependencies on the package’s name and provisions instead of
+ * scanning every package like libalpm does. The index is thrown away
+ * when the database changes and rebuilt on demand.
+ */
+static VALUE reverse_dependency_index(VALUE self)
+{
+  reverse_index_of_db(self);
+  return self;
+}
+
+/**
+ * call-seq:
+ *   indexed_search( *terms [, mode: :literal ] ) → an_array
+ *
+ * Like #search, but answered from an in-memory trigram index of
+ * the package names and descriptions, which is built on the first
+ * call (or by #build_search_index). Only the packages containing
+ * all trigrams of the query are checked, which makes this suitable
+ * for e.g. search-as-you-type. Matching is case-insensitive and,
+ * unlike #search, doesn’t consider the packages’ +provides+.
+ *
+ * === Parameters
+ * [*terms (splat)]
+ *   The search terms. A package must match _all_ of them.
+ * [mode (:literal)]
+ *   How to interpret the terms.
+ *   [:literal]
+ *     Substrings of the package name or description.
+ *   [:prefix]
+ *     Prefixes of the package name.
+ *   [:regex]
+ *     POSIX extended regular expressions matched against the
+ *     package name and description, like #search does. The
+ *     literal parts of the expressions are used to narrow down
+ *     the packages to check.
+ *
+ * === Return value
+ * An array of the matching Package instances, in database order.
+ */
+static VALUE indexed_search(int argc, VALUE argv[], VALUE self)
+{
+  VALUE terms, opts;
+  VALUE kwval = Qundef;
+  ID kwname;
+  enum search_mode mode = SEARCH_LITERAL;
+
+  rb_scan_args(argc, argv, "*:", &terms, &opts);
+
+  kwname = rb_intern("mode");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, &kwname, 0, 1, &kwval);
+  if (kwval != Qundef) {
+    if (kwval == STR2SYM("prefix"))
+      mode = SEARCH_PREFIX;
+    else if (kwval == STR2SYM("regex"))
+      mode = SEARCH_REGEX;
+    else if (kwval != STR2SYM("literal"))
+      rb_raise(rb_eArgError, "Expected :literal, :prefix, or :regex for mode:");
+  }
+
+  return search_index_query(get_search_index(self), rb_iv_get(self, "@alpm"),
+                            RARRAY_LEN(terms), (VALUE*) RARRAY_CONST_PTR(terms), mode);
 }
 
 /**
@@ -258,49 +969,234 @@ static VALUE search(int argc, VALUE argv[], VALUE self)
  *   unregister()
  *
  * Unregister this database from libalpm. This method invalidates
- * +self+, so please don’t use it anymore after you called this
- * method.
+ * +self+ and the Package instances obtained from it, so please don’t
+ * use them anymore after you called this method.
  */
 static VALUE unregister(VALUE self)
 {
   alpm_db_t* p_db = NULL;
+  VALUE cache;
   Data_Get_Struct(self, alpm_db_t, p_db);
 
+  wait_for_handle(rb_iv_get(self, "@alpm"));
   if (alpm_db_unregister(p_db) < 0) {
     raise_last_alpm_error(get_alpm_from_db(self));
     return Qnil;
   }
 
+  /* Forget about this database and its packages */
+  cache = rb_iv_get(rb_iv_get(self, "@alpm"), "databases");
+  if (!NIL_P(cache))
+    rb_hash_delete(cache, ULONG2NUM((unsigned long) p_db));
+  rb_iv_set(self, "packages", Qnil);
+  rb_iv_set(self, "search_index", Qnil);
+  handle_changed(rb_iv_get(self, "@alpm"));
+
   DATA_PTR(self) = NULL; /* This object is now invalid */
   return Qnil;
 }
 
+/* Arguments for and result of update_without_gvl(). */
+struct update_args {
+  alpm_db_t* p_db;
+  int force;
+  int result;
+};
+
+static void* update_without_gvl(void* ptr)
+{
+  struct update_args* p_args = (struct update_args*) ptr;
+
+  p_args->result = alpm_db_update(p_args->force, p_args->p_db);
+  return NULL;
+}
+
 /**
  * call-seq:
- *   update( [ force ] )
+ *   update( [ force ] ) → true or false
  *
- * Synchronise the database with the remote server(s).
+ * Synchronise the database with the remote server(s). The download
+ * and decompression happen without holding Ruby’s global VM lock,
+ * so other threads continue to run meanwhile. libalpm can’t cut
+ * a running transfer short, so Thread#raise and Timeout take
+ * effect as soon as it returns; hanging mirrors are dropped by
+ * libalpm’s own stall timeout.
  *
  * === Parameters
  * [force (false)]
- *   (undocumented by libalpm)
+ *   Download the database even if it is up to date.
+ *
+ * === Return value
+ * +true+ if the database was updated, +false+ if it was already
+ * up to date.
  */
 static VALUE update(int argc, VALUE argv[], VALUE self)
 {
-  alpm_db_t* p_db = NULL;
+  struct update_args args;
   VALUE force;
 
-  Data_Get_Struct(self, alpm_db_t, p_db);
+  Data_Get_Struct(self, alpm_db_t, args.p_db);
   rb_scan_args(argc, argv, "01", &force);
 
-  if (alpm_db_update(RTEST(force), p_db) < 0) {
+  args.force = RTEST(force) ? 1 : 0;
+  args.result = -1;
+
+  /* call_without_gvl() doesn’t raise, so no rb_ensure() needed */
+  lock_handle(rb_iv_get(self, "@alpm"));
+  call_without_gvl(update_without_gvl, &args, NULL, NULL);
+  unlock_handle(rb_iv_get(self, "@alpm"));
+
+  /* libalpm threw away the old packages */
+  if (args.result == 0)
+    database_changed(rb_iv_get(self, "@alpm"), args.p_db);
+
+  raise_pending_errors();
+  if (args.result < 0)
     raise_last_alpm_error(get_alpm_from_db(self));
-    return Qnil;
+
+  return args.result == 0 ? Qtrue : Qfalse;
+}
+
+/* Arguments for prefetch_job() and prefetch_body(). */
+struct prefetch_args {
+  VALUE db;
+  alpm_pkg_t** p_pkgs;
+  size_t npkgs;
+  int fields;
+  unsigned int nthreads;
+};
+
+/* Worker job for #prefetch: forces libalpm to read the requested
+ * entries of the packages in chunk `index' from disk. */
+static void prefetch_job(void* ptr, size_t index)
+{
+  struct prefetch_args* p_args = (struct prefetch_args*) ptr;
+  size_t i = index * PREFETCH_CHUNK;
+  size_t end = i + PREFETCH_CHUNK < p_args->npkgs ? i + PREFETCH_CHUNK : p_args->npkgs;
+
+  for(; i < end; i++) {
+    if (p_args->fields & PREFETCH_DESC)
+      alpm_pkg_get_desc(p_args->p_pkgs[i]);
+    if (p_args->fields & PREFETCH_DEPENDS)
+      alpm_pkg_get_depends(p_args->p_pkgs[i]);
+    if (p_args->fields & PREFETCH_FILES)
+      alpm_pkg_get_files(p_args->p_pkgs[i]);
+  }
+}
+
+/* Converts the +fields+ option of #prefetch to prefetch_field bits. */
+static int prefetch_fields_from_ruby(VALUE fields)
+{
+  int result = 0;
+  long i;
+
+  if (fields == Qundef)
+    return PREFETCH_DESC | PREFETCH_DEPENDS | PREFETCH_FILES;
+
+  fields = rb_convert_type(fields, T_ARRAY, "Array", "to_ary");
+  for(i=0; i < RARRAY_LEN(fields); i++) {
+    VALUE field = rb_ary_entry(fields, i);
+
+    if (field == ID2SYM(rb_intern("desc")))
+      result |= PREFETCH_DESC;
+    else if (field == ID2SYM(rb_intern("depends")))
+      result |= PREFETCH_DEPENDS;
+    else if (field == ID2SYM(rb_intern("files")))
+      result |= PREFETCH_FILES;
+    else {
+      VALUE str = rb_inspect(field);
+      rb_raise(rb_eArgError, "Unknown prefetch field: %s", StringValueCStr(str));
+    }
   }
 
+  return result;
+}
+
+/* rb_ensure() body for #prefetch, run with the handle locked. */
+static VALUE prefetch_body(VALUE ptr)
+{
+  struct prefetch_args* p_args = (struct prefetch_args*) ptr;
+  alpm_list_t* item = NULL;
+  VALUE tmp;
+  size_t i;
+
+  /* Load the package cache itself before going concurrent */
+  item = get_pkgcache(p_args->db);
+  p_args->npkgs = alpm_list_count(item);
+  if (p_args->npkgs == 0 || p_args->fields == 0)
+    return Qnil;
+
+  p_args->p_pkgs = ALLOCV_N(alpm_pkg_t*, tmp, p_args->npkgs);
+  for(i=0; item && i < p_args->npkgs; item = alpm_list_next(item), i++)
+    p_args->p_pkgs[i] = (alpm_pkg_t*) item->data;
+
+  /* Each package is only ever touched by the one job of its chunk */
+  pool_run(p_args->nthreads, (p_args->npkgs + PREFETCH_CHUNK - 1) / PREFETCH_CHUNK, prefetch_job, p_args);
+
+  ALLOCV_END(tmp);
   return Qnil;
 }
 
+/**
+ * call-seq:
+ *   prefetch( [ fields: [:desc, :depends, :files] ] [, threads: nil ] ) → self
+ *
+ * libalpm reads the entries of the local database lazily, one
+ * small file per package the first time one of its attributes is
+ * accessed. This method reads them for all packages at once, on a
+ * pool of native threads without holding Ruby’s global VM lock, so
+ * that later calls to the Package accessors only read memory. For
+ * sync databases, whose entries are read in full when the database
+ * is loaded, this does nothing beyond loading the package cache.
+ *
+ * libalpm isn’t thread-safe, so while the workers run, other Ruby
+ * threads using the same Alpm instance wait: the Package accessors
+ * and the methods reading packages block until this returns, and
+ * so does this while another thread runs #update, Alpm#search_all,
+ * Alpm#update_sync_dbs or a transaction. The threads wait when
+ * they call these methods; one already iterating over packages
+ * in a block doesn’t stop at each package. The log callback is
+ * still called meanwhile, on this thread, and must not use the
+ * packages of this database.
+ *
+ * === Parameters
+ * [fields ([:desc, :depends, :files])]
+ *   Which entries to read. :desc covers the description, version,
+ *   sizes, dates and the like, :depends the dependency lists, and
+ *   :files the file lists and backup entries.
+ * [threads (nil)]
+ *   Number of threads to use. Defaults to the number of CPUs.
+ *
+ * === Return value
+ * +self+.
+ */
+static VALUE prefetch(int argc, VALUE argv[], VALUE self)
+{
+  struct prefetch_args args;
+  VALUE rb_alpm = rb_iv_get(self, "@alpm");
+  VALUE opts;
+  VALUE kwvals[2] = {Qundef, Qundef};
+  ID kwnames[2];
+
+  rb_scan_args(argc, argv, "0:", &opts);
+
+  kwnames[0] = rb_intern("fields");
+  kwnames[1] = rb_intern("threads");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, kwnames, 0, 2, kwvals);
+
+  args.fields = prefetch_fields_from_ruby(kwvals[0]);
+  args.nthreads = pool_threads_from_ruby(kwvals[1]);
+  args.db = self;
+  args.p_pkgs = NULL;
+  args.npkgs = 0;
+
+  lock_handle(rb_alpm);
+  rb_ensure(prefetch_body, (VALUE) &args, unlock_handle, rb_alpm);
+
+  return self;
+}
+
 /***************************************
  * Binding
  ***************************************/
@@ -318,9 +1214,12 @@ static VALUE update(int argc, VALUE argv[], VALUE self)
 void Init_database()
 {
   rb_cAlpm_Database = rb_define_class_under(rb_cAlpm, "Database", rb_cObject);
+  rb_cWeakMap = rb_const_get(rb_const_get(rb_cObject, rb_intern("ObjectSpace")), rb_intern("WeakMap"));
 
   rb_define_method(rb_cAlpm_Database, "initialize", RUBY_METHOD_FUNC(initialize), 0);
   rb_define_method(rb_cAlpm_Database, "get", RUBY_METHOD_FUNC(get), 1);
+  rb_define_method(rb_cAlpm_Database, "get_many", RUBY_METHOD_FUNC(get_many), -1);
+  rb_define_method(rb_cAlpm_Database, "sorted_packages", RUBY_METHOD_FUNC(sorted_packages), -1);
   rb_define_method(rb_cAlpm_Database, "name", RUBY_METHOD_FUNC(name), 0);
   rb_define_method(rb_cAlpm_Database, "inspect", RUBY_METHOD_FUNC(inspect), 0);
   rb_define_method(rb_cAlpm_Database, "valid?", RUBY_METHOD_FUNC(valid), 0);
@@ -329,6 +1228,13 @@ void Init_database()
   rb_define_method(rb_cAlpm_Database, "servers", RUBY_METHOD_FUNC(get_servers), 0);
   rb_define_method(rb_cAlpm_Database, "servers=", RUBY_METHOD_FUNC(set_servers), 1);
   rb_define_method(rb_cAlpm_Database, "search", RUBY_METHOD_FUNC(search), -1);
+  rb_define_method(rb_cAlpm_Database, "indexed_search", RUBY_METHOD_FUNC(indexed_search), -1);
+  rb_define_method(rb_cAlpm_Database, "build_search_index", RUBY_METHOD_FUNC(build_search_index), 0);
+  rb_define_method(rb_cAlpm_Database, "reverse_dependency_index", RUBY_METHOD_FUNC(reverse_dependency_index), 0);
+  rb_define_method(rb_cAlpm_Database, "each_package", RUBY_METHOD_FUNC(each_package), 0);
+  rb_define_method(rb_cAlpm_Database, "packages_to_a", RUBY_METHOD_FUNC(packages_to_a), -1);
+  rb_define_method(rb_cAlpm_Database, "to_columns", RUBY_METHOD_FUNC(to_columns), -1);
   rb_define_method(rb_cAlpm_Database, "unregister", RUBY_METHOD_FUNC(unregister), 0);
   rb_define_method(rb_cAlpm_Database, "update", RUBY_METHOD_FUNC(update), -1);
+  rb_define_method(rb_cAlpm_Database, "prefetch", RUBY_METHOD_FUNC(prefetch), -1);
 }
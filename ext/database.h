@@ -5,6 +5,11 @@
 
 extern VALUE rb_cAlpm_Database;
 
+VALUE wrap_database(VALUE rb_alpm, alpm_db_t* p_db);
+VALUE package_cache_of_db(VALUE rb_alpm, alpm_db_t* p_db);
+VALUE reverse_index_of_db(VALUE db);
+VALUE file_index_of_db(VALUE db, const char* path);
+void database_changed(VALUE rb_alpm, alpm_db_t* p_db);
 void Init_database();
 
 #endif
@@ -0,0 +1,884 @@
+#include <string.h>
+#include "depgraph.h"
+#include "database.h"
+#include "package.h"
+
+/***************************************
+ * Variables, etc
+ ***************************************/
+
+VALUE rb_cAlpm_DependencyGraph;
+
+/* The relations between packages the graph knows about. */
+enum dep_kind {
+  DEP_KIND_DEPENDS = 0,
+  DEP_KIND_OPTDEPENDS,
+  DEP_KIND_PROVIDES,
+  DEP_KIND_CONFLICTS,
+  DEP_KIND_COUNT
+};
+
+static VALUE kind_syms[DEP_KIND_COUNT];
+
+/***************************************
+ * Data structures
+ ***************************************/
+
+/* Adjacency in compressed sparse row form: the neighbours of node i
+ * are p_targets[p_offsets[i]] ... p_targets[p_offsets[i + 1] - 1]. */
+typedef struct {
+  uint32_t* p_offsets;
+  uint32_t* p_targets;
+} csr_t;
+
+/* The packages of some databases with all relations between them
+ * resolved to node indices. The alpm_pkg_t pointers and the names
+ * are libalpm’s, so they are only valid as long as the handle’s
+ * generation (see handle_generation()) stays the same. */
+typedef struct {
+  VALUE rb_alpm;
+  unsigned long generation;
+  alpm_pkg_t** p_pkgs;
+  uint32_t npkgs;
+  st_table* p_names;                /* package name → first node */
+  csr_t forward[DEP_KIND_COUNT];
+  csr_t reverse[DEP_KIND_COUNT];
+} depgraph_t;
+
+/* Something that satisfies dependencies on `name': a package by its
+ * name or by one of its provisions. Chained per name via `next'. */
+typedef struct {
+  uint32_t node;
+  int is_name;
+  const char* version; /* NULL for unversioned provisions */
+  long next;
+} provider_t;
+
+/* Temporary state while building a graph. */
+typedef struct {
+  provider_t* p_providers;
+  size_t nproviders;
+  size_t capa;
+  st_table* p_by_name; /* name → index of the first provider_t */
+  uint32_t* p_seen;    /* last source node + 1 that got an edge to a node */
+} builder_t;
+
+static void depgraph_mark(void* ptr)
+{
+  depgraph_t* p_graph = (depgraph_t*) ptr;
+  rb_gc_mark(p_graph->rb_alpm);
+}
+
+static void depgraph_free(void* ptr)
+{
+  depgraph_t* p_graph = (depgraph_t*) ptr;
+  int kind;
+
+  for(kind=0; kind < DEP_KIND_COUNT; kind++) {
+    xfree(p_graph->forward[kind].p_offsets);
+    xfree(p_graph->forward[kind].p_targets);
+    xfree(p_graph->reverse[kind].p_offsets);
+    xfree(p_graph->reverse[kind].p_targets);
+  }
+  if (p_graph->p_names)
+    st_free_table(p_graph->p_names);
+  xfree(p_graph->p_pkgs);
+  xfree(p_graph);
+}
+
+/* Returns the graph wrapped by `self'. Raises if libalpm threw
+ * away packages since it was built, as it points into them. */
+static depgraph_t* get_graph(VALUE self)
+{
+  depgraph_t* p_graph = NULL;
+  Data_Get_Struct(self, depgraph_t, p_graph);
+
+  if (p_graph->generation != handle_generation(p_graph->rb_alpm))
+    rb_raise(rb_eAlpm_Error, "Dependency graph is outdated, a database changed since it was built.");
+
+  return p_graph;
+}
+
+/***************************************
+ * Building
+ ***************************************/
+
+static void add_provider(builder_t* p_builder, const char* name, uint32_t node, int is_name, const char* version)
+{
+  provider_t* p_provider;
+  st_data_t head;
+
+  if (p_builder->nproviders == p_builder->capa) {
+    p_builder->capa = p_builder->capa ? p_builder->capa * 2 : 1024;
+    REALLOC_N(p_builder->p_providers, provider_t, p_builder->capa);
+  }
+
+  p_provider = &p_builder->p_providers[p_builder->nproviders];
+  p_provider->node = node;
+  p_provider->is_name = is_name;
+  p_provider->version = version;
+  p_provider->next = -1;
+  if (st_lookup(p_builder->p_by_name, (st_data_t) name, &head))
+    p_provider->next = (long) head;
+
+  st_insert(p_builder->p_by_name, (st_data_t) name, (st_data_t) p_builder->nproviders);
+  p_builder->nproviders++;
+}
+
+/** Whether a package or provision of version `version' satisfies
+ * `p_dep'. As in libalpm, unversioned provisions (`version' NULL)
+ * only satisfy unversioned dependencies. */
+int depend_satisfied_by(const alpm_depend_t* p_dep, const char* version)
+{
+  int cmp;
+
+  if (p_dep->mod == ALPM_DEP_MOD_ANY || !p_dep->version)
+    return 1;
+  if (!version)
+    return 0;
+
+  cmp = alpm_pkg_vercmp(version, p_dep->version);
+  switch(p_dep->mod) {
+  case ALPM_DEP_MOD_EQ:
+    return cmp == 0;
+  case ALPM_DEP_MOD_GE:
+    return cmp >= 0;
+  case ALPM_DEP_MOD_LE:
+    return cmp <= 0;
+  case ALPM_DEP_MOD_GT:
+    return cmp > 0;
+  case ALPM_DEP_MOD_LT:
+    return cmp < 0;
+  default:
+    return 1;
+  }
+}
+
+static alpm_list_t* deps_of_kind(alpm_pkg_t* p_pkg, int kind)
+{
+  switch(kind) {
+  case DEP_KIND_DEPENDS:
+    return alpm_pkg_get_depends(p_pkg);
+  case DEP_KIND_OPTDEPENDS:
+    return alpm_pkg_get_optdepends(p_pkg);
+  case DEP_KIND_PROVIDES:
+    return alpm_pkg_get_provides(p_pkg);
+  default:
+    return alpm_pkg_get_conflicts(p_pkg);
+  }
+}
+
+/* Resolves all relations of one kind into forward adjacency. Edges
+ * point from a package to the packages satisfying its dependency or
+ * conflict; provisions point to the packages of that name. */
+static void build_forward(depgraph_t* p_graph, builder_t* p_builder, int kind)
+{
+  csr_t* p_csr = &p_graph->forward[kind];
+  size_t capa = p_graph->npkgs;
+  size_t count = 0;
+  alpm_list_t* item = NULL;
+  st_data_t head;
+  uint32_t i;
+  long j;
+
+  p_csr->p_offsets = ALLOC_N(uint32_t, p_graph->npkgs + 1);
+  p_csr->p_targets = ALLOC_N(uint32_t, capa ? capa : 1);
+  memset(p_builder->p_seen, 0, p_graph->npkgs * sizeof(uint32_t));
+
+  for(i=0; i < p_graph->npkgs; i++) {
+    p_csr->p_offsets[i] = (uint32_t) count;
+
+    for(item = deps_of_kind(p_graph->p_pkgs[i], kind); item; item = alpm_list_next(item)) {
+      alpm_depend_t* p_dep = (alpm_depend_t*) item->data;
+
+      if (!st_lookup(p_builder->p_by_name, (st_data_t) p_dep->name, &head))
+        continue;
+
+      for(j = (long) head; j >= 0; j = p_builder->p_providers[j].next) {
+        provider_t* p_provider = &p_builder->p_providers[j];
+
+        if (p_provider->node == i || p_builder->p_seen[p_provider->node] == i + 1)
+          continue;
+        if (kind == DEP_KIND_PROVIDES ? !p_provider->is_name : !depend_satisfied_by(p_dep, p_provider->version))
+          continue;
+
+        if (count == capa) {
+          capa *= 2;
+          REALLOC_N(p_csr->p_targets, uint32_t, capa);
+        }
+        p_csr->p_targets[count++] = p_provider->node;
+        p_builder->p_seen[p_provider->node] = i + 1;
+      }
+    }
+  }
+
+  p_csr->p_offsets[p_graph->npkgs] = (uint32_t) count;
+}
+
+/* Transposes forward adjacency with a counting sort, which keeps
+ * the sources of each node in ascending order. */
+static void build_reverse(depgraph_t* p_graph, int kind)
+{
+  csr_t* p_fwd = &p_graph->forward[kind];
+  csr_t* p_rev = &p_graph->reverse[kind];
+  uint32_t nedges = p_fwd->p_offsets[p_graph->npkgs];
+  uint32_t* p_fill;
+  uint32_t i, e;
+
+  p_rev->p_offsets = ZALLOC_N(uint32_t, p_graph->npkgs + 1);
+  p_rev->p_targets = ALLOC_N(uint32_t, nedges ? nedges : 1);
+
+  for(e=0; e < nedges; e++)
+    p_rev->p_offsets[p_fwd->p_targets[e] + 1]++;
+  for(i=0; i < p_graph->npkgs; i++)
+    p_rev->p_offsets[i + 1] += p_rev->p_offsets[i];
+
+  p_fill = ALLOC_N(uint32_t, p_graph->npkgs ? p_graph->npkgs : 1);
+  memcpy(p_fill, p_rev->p_offsets, p_graph->npkgs * sizeof(uint32_t));
+  for(i=0; i < p_graph->npkgs; i++) {
+    for(e = p_fwd->p_offsets[i]; e < p_fwd->p_offsets[i + 1]; e++)
+      p_rev->p_targets[p_fill[p_fwd->p_targets[e]]++] = i;
+  }
+  xfree(p_fill);
+}
+
+/* Arguments for build_graph() and free_builder(). */
+struct build_args {
+  depgraph_t* p_graph;
+  builder_t builder;
+  VALUE dbs;
+};
+
+static VALUE build_graph(VALUE ptr)
+{
+  struct build_args* p_args = (struct build_args*) ptr;
+  depgraph_t* p_graph = p_args->p_graph;
+  builder_t* p_builder = &p_args->builder;
+  alpm_list_t* item = NULL;
+  alpm_db_t* p_db = NULL;
+  size_t total = 0;
+  long i;
+  uint32_t n = 0;
+  int kind;
+
+  for(i=0; i < RARRAY_LEN(p_args->dbs); i++) {
+    VALUE db = rb_ary_entry(p_args->dbs, i);
+
+    if (!RTEST(rb_obj_is_kind_of(db, rb_cAlpm_Database)))
+      rb_raise(rb_eTypeError, "Not a database: %s", RSTRING_PTR(rb_inspect(db)));
+
+    Data_Get_Struct(db, alpm_db_t, p_db);
+    total += alpm_list_count(alpm_db_get_pkgcache(p_db));
+  }
+
+  if (total >= UINT32_MAX)
+    rb_raise(rb_eAlpm_Error, "Too many packages for a dependency graph.");
+
+  p_graph->p_pkgs = ALLOC_N(alpm_pkg_t*, total ? total : 1);
+  p_graph->p_names = st_init_strtable();
+  p_builder->p_by_name = st_init_strtable();
+  p_builder->p_seen = ALLOC_N(uint32_t, total ? total : 1);
+
+  for(i=0; i < RARRAY_LEN(p_args->dbs); i++) {
+    Data_Get_Struct(rb_ary_entry(p_args->dbs, i), alpm_db_t, p_db);
+
+    for(item = alpm_db_get_pkgcache(p_db); item && n < total; item = alpm_list_next(item)) {
+      alpm_pkg_t* p_pkg = (alpm_pkg_t*) item->data;
+      alpm_list_t* prov = NULL;
+      const char* name = alpm_pkg_get_name(p_pkg);
+
+      p_graph->p_pkgs[n] = p_pkg;
+      if (!st_is_member(p_graph->p_names, (st_data_t) name))
+        st_insert(p_graph->p_names, (st_data_t) name, (st_data_t) n);
+
+      add_provider(p_builder, name, n, 1, alpm_pkg_get_version(p_pkg));
+      for(prov = alpm_pkg_get_provides(p_pkg); prov; prov = alpm_list_next(prov)) {
+        alpm_depend_t* p_prov = (alpm_depend_t*) prov->data;
+        add_provider(p_builder, p_prov->name, n, 0, p_prov->version);
+      }
+
+      n++;
+    }
+  }
+  p_graph->npkgs = n;
+
+  for(kind=0; kind < DEP_KIND_COUNT; kind++) {
+    build_forward(p_graph, p_builder, kind);
+    build_reverse(p_graph, kind);
+  }
+
+  return Qnil;
+}
+
+static VALUE free_builder(VALUE ptr)
+{
+  struct build_args* p_args = (struct build_args*) ptr;
+
+  if (p_args->builder.p_by_name)
+    st_free_table(p_args->builder.p_by_name);
+  xfree(p_args->builder.p_providers);
+  xfree(p_args->builder.p_seen);
+
+  return Qnil;
+}
+
+/** Builds the dependency graph over all packages of the Database
+ * instances in the array `dbs'. */
+VALUE depgraph_new(VALUE rb_alpm, VALUE dbs)
+{
+  struct build_args args;
+  depgraph_t* p_graph = ZALLOC(depgraph_t);
+  VALUE obj;
+
+  p_graph->rb_alpm = rb_alpm;
+  p_graph->generation = handle_generation(rb_alpm);
+  obj = Data_Wrap_Struct(rb_cAlpm_DependencyGraph, depgraph_mark, depgraph_free, p_graph);
+
+  memset(&args, 0, sizeof(struct build_args));
+  args.p_graph = p_graph;
+  args.dbs = dbs;
+  rb_ensure(build_graph, (VALUE) &args, free_builder, (VALUE) &args);
+
+  return obj;
+}
+
+/***************************************
+ * Helpers
+ ***************************************/
+
+/* Converts a +kind+ option (a symbol or an array of them) into a
+ * bit mask of dep_kind values. Defaults to :depends. */
+static int kinds_from_ruby(VALUE kinds)
+{
+  VALUE ary;
+  int mask = 0;
+  int kind;
+  long i;
+
+  if (kinds == Qundef || NIL_P(kinds))
+    return 1 << DEP_KIND_DEPENDS;
+
+  ary = rb_Array(kinds);
+  for(i=0; i < RARRAY_LEN(ary); i++) {
+    VALUE sym = rb_ary_entry(ary, i);
+
+    for(kind=0; kind < DEP_KIND_COUNT; kind++) {
+      if (sym == kind_syms[kind])
+        break;
+    }
+    if (kind == DEP_KIND_COUNT)
+      rb_raise(rb_eArgError, "Unknown kind of relation: %s", RSTRING_PTR(rb_inspect(sym)));
+
+    mask |= 1 << kind;
+  }
+
+  return mask;
+}
+
+/* Reads the +kind+ keyword from the trailing options hash. */
+static int kinds_from_opts(VALUE opts)
+{
+  ID kwname = rb_intern("kind");
+  VALUE kwval = Qundef;
+
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, &kwname, 0, 1, &kwval);
+
+  return kinds_from_ruby(kwval);
+}
+
+/* Converts a node given as an index, a package name or a Package
+ * into its index. */
+static uint32_t node_from_ruby(depgraph_t* p_graph, VALUE node)
+{
+  st_data_t index;
+  long i;
+
+  if (RB_INTEGER_TYPE_P(node)) {
+    i = NUM2LONG(node);
+    if (i < 0 || i >= (long) p_graph->npkgs)
+      rb_raise(rb_eIndexError, "Index %ld out of range.", i);
+    return (uint32_t) i;
+  }
+
+  if (RTEST(rb_obj_is_kind_of(node, rb_cAlpm_Package)))
+    node = rb_funcall(node, rb_intern("name"), 0);
+
+  if (!st_lookup(p_graph->p_names, (st_data_t) StringValueCStr(node), &index))
+    rb_raise(rb_eKeyError, "No such package in the graph: %s", RSTRING_PTR(node));
+
+  return (uint32_t) index;
+}
+
+/* Walks breadth-first from `roots' along forward or reverse edges of
+ * the kinds in `mask' and returns the indices reached, except for the
+ * roots themselves, in the order they were reached. */
+static VALUE walk(depgraph_t* p_graph, VALUE roots, int mask, int reverse)
+{
+  csr_t* p_csrs = reverse ? p_graph->reverse : p_graph->forward;
+  uint8_t* p_state;
+  uint32_t* p_queue;
+  size_t head = 0;
+  size_t tail = 0;
+  VALUE tmp1, tmp2;
+  VALUE result;
+  long i;
+  int kind;
+
+  p_state = ALLOCV_N(uint8_t, tmp1, p_graph->npkgs ? p_graph->npkgs : 1);
+  p_queue = ALLOCV_N(uint32_t, tmp2, p_graph->npkgs ? p_graph->npkgs : 1);
+  memset(p_state, 0, p_graph->npkgs);
+
+  for(i=0; i < RARRAY_LEN(roots); i++) {
+    uint32_t root = node_from_ruby(p_graph, rb_ary_entry(roots, i));
+
+    if (!p_state[root]) {
+      p_state[root] = 2; /* Root, not reported */
+      p_queue[tail++] = root;
+    }
+  }
+
+  result = rb_ary_new();
+  while (head < tail) {
+    uint32_t node = p_queue[head++];
+
+    if (p_state[node] == 1)
+      rb_ary_push(result, UINT2NUM(node));
+
+    for(kind=0; kind < DEP_KIND_COUNT; kind++) {
+      uint32_t e;
+
+      if (!(mask & (1 << kind)))
+        continue;
+
+      for(e = p_csrs[kind].p_offsets[node]; e < p_csrs[kind].p_offsets[node + 1]; e++) {
+        uint32_t next = p_csrs[kind].p_targets[e];
+
+        if (!p_state[next]) {
+          p_state[next] = 1;
+          p_queue[tail++] = next;
+        }
+      }
+    }
+  }
+
+  ALLOCV_END(tmp1);
+  ALLOCV_END(tmp2);
+  return result;
+}
+
+/* Number of edges of the kinds in `mask' leaving `node'. */
+static uint32_t out_degree(depgraph_t* p_graph, int mask, uint32_t node)
+{
+  uint32_t degree = 0;
+  int kind;
+
+  for(kind=0; kind < DEP_KIND_COUNT; kind++) {
+    if (mask & (1 << kind))
+      degree += p_graph->forward[kind].p_offsets[node + 1] - p_graph->forward[kind].p_offsets[node];
+  }
+
+  return degree;
+}
+
+/***************************************
+ * Methods
+ ***************************************/
+
+/**
+ * call-seq:
+ *   size() → an_integer
+ *
+ * Number of packages (nodes) in the graph. Nodes are numbered from
+ * 0 in the order of the databases passed to Alpm#dependency_graph.
+ */
+static VALUE size(VALUE self)
+{
+  return UINT2NUM(get_graph(self)->npkgs);
+}
+
+/**
+ * call-seq:
+ *   edge_count( [ kind: :depends ] ) → an_integer
+ *
+ * Number of edges of the given kind(s) in the graph.
+ */
+static VALUE edge_count(int argc, VALUE argv[], VALUE self)
+{
+  depgraph_t* p_graph = get_graph(self);
+  VALUE opts;
+  uint32_t count = 0;
+  int mask;
+  int kind;
+
+  rb_scan_args(argc, argv, "0:", &opts);
+  mask = kinds_from_opts(opts);
+
+  for(kind=0; kind < DEP_KIND_COUNT; kind++) {
+    if (mask & (1 << kind))
+      count += p_graph->forward[kind].p_offsets[p_graph->npkgs];
+  }
+
+  return UINT2NUM(count);
+}
+
+/**
+ * call-seq:
+ *   index( name ) → an_integer or nil
+ *
+ * Index of the (first) package called +name+, or +nil+.
+ */
+static VALUE index_of(VALUE self, VALUE name)
+{
+  st_data_t index;
+
+  if (!st_lookup(get_graph(self)->p_names, (st_data_t) StringValueCStr(name), &index))
+    return Qnil;
+
+  return UINT2NUM((uint32_t) index);
+}
+
+/**
+ * call-seq:
+ *   package( node ) → a_package
+ *
+ * The Package at index +node+.
+ */
+static VALUE package(VALUE self, VALUE node)
+{
+  depgraph_t* p_graph = get_graph(self);
+  return wrap_package(p_graph->rb_alpm, p_graph->p_pkgs[node_from_ruby(p_graph, node)]);
+}
+
+/**
+ * call-seq:
+ *   packages( nodes ) → an_array
+ *
+ * The Package instances at the indices in +nodes+, e.g. as returned
+ * by #closure.
+ */
+static VALUE packages(VALUE self, VALUE nodes)
+{
+  depgraph_t* p_graph = get_graph(self);
+  VALUE ary = rb_convert_type(nodes, T_ARRAY, "Array", "to_ary");
+  VALUE result = rb_ary_new_capa(RARRAY_LEN(ary));
+  long i;
+
+  for(i=0; i < RARRAY_LEN(ary); i++)
+    rb_ary_push(result, wrap_package(p_graph->rb_alpm, p_graph->p_pkgs[node_from_ruby(p_graph, rb_ary_entry(ary, i))]));
+
+  return result;
+}
+
+/* Neighbours of a single node along forward or reverse edges. */
+static VALUE neighbours(int argc, VALUE argv[], VALUE self, int reverse)
+{
+  depgraph_t* p_graph = get_graph(self);
+  csr_t* p_csrs = reverse ? p_graph->reverse : p_graph->forward;
+  VALUE node;
+  VALUE opts;
+  VALUE result = rb_ary_new();
+  uint32_t index;
+  uint32_t e;
+  int mask;
+  int kind;
+
+  rb_scan_args(argc, argv, "1:", &node, &opts);
+  mask = kinds_from_opts(opts);
+  index = node_from_ruby(p_graph, node);
+
+  for(kind=0; kind < DEP_KIND_COUNT; kind++) {
+    if (!(mask & (1 << kind)))
+      continue;
+    for(e = p_csrs[kind].p_offsets[index]; e < p_csrs[kind].p_offsets[index + 1]; e++)
+      rb_ary_push(result, UINT2NUM(p_csrs[kind].p_targets[e]));
+  }
+
+  return result;
+}
+
+/**
+ * call-seq:
+ *   edges( node [, kind: :depends ] ) → an_array
+ *
+ * Indices of the packages +node+ has an edge to: those satisfying
+ * its dependencies (+:depends+, +:optdepends+), those named like
+ * its provisions (+:provides+), or those it conflicts with
+ * (+:conflicts+). +kind+ may also be an array of these.
+ */
+static VALUE edges(int argc, VALUE argv[], VALUE self)
+{
+  return neighbours(argc, argv, self, 0);
+}
+
+/**
+ * call-seq:
+ *   reverse_edges( node [, kind: :depends ] ) → an_array
+ *
+ * Indices of the packages that have an edge to +node+, e.g. those
+ * depending on it.
+ */
+static VALUE reverse_edges(int argc, VALUE argv[], VALUE self)
+{
+  return neighbours(argc, argv, self, 1);
+}
+
+/**
+ * call-seq:
+ *   closure( *nodes [, kind: :depends ] ) → an_array
+ *
+ * Indices of all packages reachable from +nodes+ (indices, names or
+ * Package instances), e.g. everything they need directly or
+ * indirectly. The +nodes+ themselves are not included.
+ */
+static VALUE closure(int argc, VALUE argv[], VALUE self)
+{
+  VALUE roots;
+  VALUE opts;
+
+  rb_scan_args(argc, argv, "*:", &roots, &opts);
+  return walk(get_graph(self), roots, kinds_from_opts(opts), 0);
+}
+
+/**
+ * call-seq:
+ *   reverse_closure( *nodes [, kind: :depends ] ) → an_array
+ *
+ * Indices of all packages from which +nodes+ are reachable, e.g.
+ * everything that breaks if they go away. The +nodes+ themselves are
+ * not included.
+ */
+static VALUE reverse_closure(int argc, VALUE argv[], VALUE self)
+{
+  VALUE roots;
+  VALUE opts;
+
+  rb_scan_args(argc, argv, "*:", &roots, &opts);
+  return walk(get_graph(self), roots, kinds_from_opts(opts), 1);
+}
+
+/**
+ * call-seq:
+ *   topological_order( [ kind: :depends ] ) → an_array
+ *
+ * Indices of the packages ordered such that each package comes after
+ * everything it has an edge to, i.e. dependencies before dependents.
+ * Packages in a cycle, or depending on one, can’t be ordered and are
+ * left out; see #cycles.
+ */
+static VALUE topological_order(int argc, VALUE argv[], VALUE self)
+{
+  depgraph_t* p_graph = get_graph(self);
+  VALUE opts;
+  VALUE tmp1, tmp2;
+  VALUE result;
+  uint32_t* p_pending;
+  uint32_t* p_queue;
+  size_t head = 0;
+  size_t tail = 0;
+  uint32_t i;
+  int mask;
+  int kind;
+
+  rb_scan_args(argc, argv, "0:", &opts);
+  mask = kinds_from_opts(opts);
+
+  p_pending = ALLOCV_N(uint32_t, tmp1, p_graph->npkgs ? p_graph->npkgs : 1);
+  p_queue = ALLOCV_N(uint32_t, tmp2, p_graph->npkgs ? p_graph->npkgs : 1);
+
+  /* Kahn’s algorithm on the edges reversed */
+  for(i=0; i < p_graph->npkgs; i++) {
+    p_pending[i] = out_degree(p_graph, mask, i);
+    if (p_pending[i] == 0)
+      p_queue[tail++] = i;
+  }
+
+  while (head < tail) {
+    uint32_t node = p_queue[head++];
+
+    for(kind=0; kind < DEP_KIND_COUNT; kind++) {
+      csr_t* p_rev = &p_graph->reverse[kind];
+      uint32_t e;
+
+      if (!(mask & (1 << kind)))
+        continue;
+
+      for(e = p_rev->p_offsets[node]; e < p_rev->p_offsets[node + 1]; e++) {
+        if (--p_pending[p_rev->p_targets[e]] == 0)
+          p_queue[tail++] = p_rev->p_targets[e];
+      }
+    }
+  }
+
+  result = rb_ary_new_capa((long) tail);
+  for(head=0; head < tail; head++)
+    rb_ary_push(result, UINT2NUM(p_queue[head]));
+
+  ALLOCV_END(tmp1);
+  ALLOCV_END(tmp2);
+  return result;
+}
+
+/* A frame of the explicit stack in cycles(). */
+typedef struct {
+  uint32_t node;
+  int kind;
+  uint32_t edge;
+} frame_t;
+
+/**
+ * call-seq:
+ *   cycles( [ kind: :depends ] ) → an_array
+ *
+ * The cycles in the graph, as arrays of indices of packages that
+ * all reach each other (strongly connected components with more
+ * than one package).
+ */
+static VALUE cycles(int argc, VALUE argv[], VALUE self)
+{
+  depgraph_t* p_graph = get_graph(self);
+  VALUE opts;
+  VALUE tmp1, tmp2, tmp3, tmp4, tmp5;
+  VALUE result = rb_ary_new();
+  uint32_t* p_index;   /* Tarjan’s index + 1, 0 = unvisited */
+  uint32_t* p_low;
+  uint32_t* p_stack;   /* Nodes of the current components */
+  uint8_t* p_onstack;
+  frame_t* p_frames;
+  size_t nstack = 0;
+  size_t nframes = 0;
+  uint32_t counter = 0;
+  uint32_t root;
+  int mask;
+
+  rb_scan_args(argc, argv, "0:", &opts);
+  mask = kinds_from_opts(opts);
+
+  p_index = ALLOCV_N(uint32_t, tmp1, p_graph->npkgs ? p_graph->npkgs : 1);
+  p_low = ALLOCV_N(uint32_t, tmp2, p_graph->npkgs ? p_graph->npkgs : 1);
+  p_stack = ALLOCV_N(uint32_t, tmp3, p_graph->npkgs ? p_graph->npkgs : 1);
+  p_frames = ALLOCV_N(frame_t, tmp4, p_graph->npkgs ? p_graph->npkgs : 1);
+  p_onstack = ALLOCV_N(uint8_t, tmp5, p_graph->npkgs ? p_graph->npkgs : 1);
+  memset(p_index, 0, p_graph->npkgs * sizeof(uint32_t));
+  memset(p_onstack, 0, p_graph->npkgs);
+
+  for(root=0; root < p_graph->npkgs; root++) {
+    if (p_index[root])
+      continue;
+
+    p_index[root] = p_low[root] = ++counter;
+    p_stack[nstack++] = root;
+    p_onstack[root] = 1;
+    p_frames[nframes].node = root;
+    p_frames[nframes].kind = 0;
+    p_frames[nframes].edge = p_graph->forward[0].p_offsets[root];
+    nframes++;
+
+    while (nframes > 0) {
+      frame_t* p_frame = &p_frames[nframes - 1];
+      uint32_t node = p_frame->node;
+      int descended = 0;
+
+      /* Continue with the next edge of this node */
+      while (p_frame->kind < DEP_KIND_COUNT) {
+        csr_t* p_csr = &p_graph->forward[p_frame->kind];
+        uint32_t next;
+
+        if (!(mask & (1 << p_frame->kind)) || p_frame->edge >= p_csr->p_offsets[node + 1]) {
+          p_frame->kind++;
+          if (p_frame->kind < DEP_KIND_COUNT)
+            p_frame->edge = p_graph->forward[p_frame->kind].p_offsets[node];
+          continue;
+        }
+
+        next = p_csr->p_targets[p_frame->edge++];
+        if (!p_index[next]) {
+          p_index[next] = p_low[next] = ++counter;
+          p_stack[nstack++] = next;
+          p_onstack[next] = 1;
+          p_frames[nframes].node = next;
+          p_frames[nframes].kind = 0;
+          p_frames[nframes].edge = p_graph->forward[0].p_offsets[next];
+          nframes++;
+          descended = 1;
+          break;
+        }
+        else if (p_onstack[next] && p_index[next] < p_low[node])
+          p_low[node] = p_index[next];
+      }
+
+      if (descended)
+        continue;
+
+      /* All edges done: pop a component if this is its root */
+      if (p_low[node] == p_index[node]) {
+        VALUE component = rb_ary_new();
+        uint32_t member;
+
+        do {
+          member = p_stack[--nstack];
+          p_onstack[member] = 0;
+          rb_ary_push(component, UINT2NUM(member));
+        } while (member != node);
+
+        if (RARRAY_LEN(component) > 1)
+          rb_ary_push(result, rb_ary_reverse(component));
+      }
+
+      nframes--;
+      if (nframes > 0 && p_low[node] < p_low[p_frames[nframes - 1].node])
+        p_low[p_frames[nframes - 1].node] = p_low[node];
+    }
+  }
+
+  ALLOCV_END(tmp1);
+  ALLOCV_END(tmp2);
+  ALLOCV_END(tmp3);
+  ALLOCV_END(tmp4);
+  ALLOCV_END(tmp5);
+  return result;
+}
+
+/***************************************
+ * Binding
+ ***************************************/
+
+/**
+ * Document-class: Alpm::DependencyGraph
+ *
+ * The packages of some databases and the relations between them,
+ * resolved once in C, see Alpm#dependency_graph. Packages are nodes
+ * identified by their index; the relations (+:depends+,
+ * +:optdepends+, +:provides+, +:conflicts+) are edges stored as
+ * compact integer adjacency arrays, which makes traversals like
+ * #closure or #reverse_closure cheap even on large databases.
+ *
+ * Methods taking nodes accept indices, package names or Package
+ * instances, and most return indices; use #packages to turn these
+ * into Package instances. Once libalpm threw away packages of the
+ * Alpm instance, by Database#update, Alpm#update_sync_dbs,
+ * Database#unregister or a transaction commit, all methods raise
+ * an Alpm::AlpmError; build a new graph then.
+ */
+void Init_depgraph()
+{
+  rb_cAlpm_DependencyGraph = rb_define_class_under(rb_cAlpm, "DependencyGraph", rb_cObject);
+  rb_undef_alloc_func(rb_cAlpm_DependencyGraph);
+
+  rb_define_method(rb_cAlpm_DependencyGraph, "size", RUBY_METHOD_FUNC(size), 0);
+  rb_define_method(rb_cAlpm_DependencyGraph, "edge_count", RUBY_METHOD_FUNC(edge_count), -1);
+  rb_define_method(rb_cAlpm_DependencyGraph, "index", RUBY_METHOD_FUNC(index_of), 1);
+  rb_define_method(rb_cAlpm_DependencyGraph, "package", RUBY_METHOD_FUNC(package), 1);
+  rb_define_method(rb_cAlpm_DependencyGraph, "packages", RUBY_METHOD_FUNC(packages), 1);
+  rb_define_method(rb_cAlpm_DependencyGraph, "edges", RUBY_METHOD_FUNC(edges), -1);
+  rb_define_method(rb_cAlpm_DependencyGraph, "reverse_edges", RUBY_METHOD_FUNC(reverse_edges), -1);
+  rb_define_method(rb_cAlpm_DependencyGraph, "closure", RUBY_METHOD_FUNC(closure), -1);
+  rb_define_method(rb_cAlpm_DependencyGraph, "reverse_closure", RUBY_METHOD_FUNC(reverse_closure), -1);
+  rb_define_method(rb_cAlpm_DependencyGraph, "topological_order", RUBY_METHOD_FUNC(topological_order), -1);
+  rb_define_method(rb_cAlpm_DependencyGraph, "cycles", RUBY_METHOD_FUNC(cycles), -1);
+
+  kind_syms[DEP_KIND_DEPENDS] = STR2SYM("depends");
+  kind_syms[DEP_KIND_OPTDEPENDS] = STR2SYM("optdepends");
+  kind_syms[DEP_KIND_PROVIDES] = STR2SYM("provides");
+  kind_syms[DEP_KIND_CONFLICTS] = STR2SYM("conflicts");
+}
@@ -0,0 +1,11 @@
+#ifndef RUBY_ALPM_DEPGRAPH_H
+#define RUBY_ALPM_DEPGRAPH_H
+#include "main.h"
+
+extern VALUE rb_cAlpm_DependencyGraph;
+
+int depend_satisfied_by(const alpm_depend_t* p_dep, const char* version);
+VALUE depgraph_new(VALUE rb_alpm, VALUE dbs);
+void Init_depgraph();
+
+#endif
@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "download.h"
+
+/***************************************
+ * Variables, etc
+ ***************************************/
+
+/* Number of files whose progress is tracked at the same time. One
+ * is enough for libalpm’s serial downloads, the rest covers several
+ * handles downloading in different threads. */
+#define DOWNLOAD_SLOTS 8
+
+/* Aggregated progress of a single file. */
+struct download_slot {
+  char* filename;
+  off_t last_xfered;   /* Bytes reported to Ruby last time */
+  double last_time;    /* When that was */
+  double started;      /* When we first heard of the file */
+};
+
+/* A sample to hand to Ruby, see deliver(). */
+struct download_sample {
+  const char* filename;
+  off_t xfered;
+  off_t total;
+  double rate;
+};
+
+/* Like the log callback, libalpm’s download callback has no context
+ * pointer, so this is process-global. The slots are guarded by
+ * `download_lock' as several Ruby threads may download without the
+ * GVL at the same time; the receiver is only touched with the GVL. */
+static pthread_mutex_t download_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct download_slot download_slots[DOWNLOAD_SLOTS];
+static volatile double download_interval = 0.0;
+
+static VALUE download_receiver = Qnil;
+
+/***************************************
+ * Helpers
+ ***************************************/
+
+static void clear_slot(struct download_slot* p_slot)
+{
+  free(p_slot->filename);
+  memset(p_slot, 0, sizeof(struct download_slot));
+}
+
+/* Finds the slot for `filename', or makes one by evicting the
+ * least recently reported file. Sets *p_new if the slot is new. Must
+ * be called with `download_lock' held. Returns NULL if out of memory. */
+static struct download_slot* slot_for(const char* filename, int* p_new)
+{
+  struct download_slot* p_oldest = &download_slots[0];
+  int i;
+
+  *p_new = 0;
+  for(i=0; i < DOWNLOAD_SLOTS; i++) {
+    if (download_slots[i].filename && strcmp(download_slots[i].filename, filename) == 0)
+      return &download_slots[i];
+    if (!download_slots[i].filename)
+      p_oldest = &download_slots[i];
+    else if (p_oldest->filename && download_slots[i].last_time < p_oldest->last_time)
+      p_oldest = &download_slots[i];
+  }
+
+  clear_slot(p_oldest);
+  if (!(p_oldest->filename = strdup(filename))) /* Single = intended */
+    return NULL;
+
+  *p_new = 1;
+  return p_oldest;
+}
+
+/* Decides under the lock whether the current progress of `filename'
+ * is to be reported to Ruby, and fills in `p_sample' if so. The
+ * first and the last report of a file always get through, the
+ * others only if the interval has passed since the previous one. */
+static int sample(const char* filename, off_t xfered, off_t total, struct download_sample* p_sample)
+{
+  struct download_slot* p_slot = NULL;
+  double time = now();
+  int is_new = 0;
+  int done = total > 0 && xfered >= total;
+  int report = 0;
+
+  pthread_mutex_lock(&download_lock);
+  if (!(p_slot = slot_for(filename, &is_new))) { /* Single = intended */
+    pthread_mutex_unlock(&download_lock);
+    return 0;
+  }
+
+  if (is_new) {
+    p_slot->started = time;
+    report = 1;
+  }
+  else if (done || time - p_slot->last_time >= download_interval) {
+    report = 1;
+  }
+
+  if (report) {
+    p_sample->filename = filename;
+    p_sample->xfered = xfered;
+    p_sample->total = total;
+
+    /* Throughput since the previous report, so that stalls show */
+    if (is_new || time <= p_slot->last_time || xfered < p_slot->last_xfered)
+      p_sample->rate = 0.0;
+    else
+      p_sample->rate = (xfered - p_slot->last_xfered) / (time - p_slot->last_time);
+
+    p_slot->last_xfered = xfered;
+    p_slot->last_time = time;
+  }
+
+  if (done)
+    clear_slot(p_slot);
+
+  pthread_mutex_unlock(&download_lock);
+  return report;
+}
+
+static VALUE deliver(VALUE ptr)
+{
+  struct download_sample* p_sample = (struct download_sample*) ptr;
+  VALUE receiver = download_receiver;
+
+  if (NIL_P(receiver))
+    return Qnil;
+
+  return rb_funcall(receiver, rb_intern("call"), 4,
+                    rb_str_new2(p_sample->filename),
+                    OFFT2NUM(p_sample->xfered),
+                    p_sample->total > 0 ? OFFT2NUM(p_sample->total) : Qnil,
+                    rb_float_new(p_sample->rate));
+}
+
+static void* deliver_with_gvl(void* ptr)
+{
+  protect_callback(deliver, (VALUE) ptr);
+  return NULL;
+}
+
+/***************************************
+ * Interface
+ ***************************************/
+
+/** The download callback handed to libalpm. libalpm calls it for
+ * every chunk received; only samples picked by sample() cost a Ruby
+ * call, for which a thread that gave up the GVL reacquires it. */
+void download_callback(const char* filename, off_t xfered, off_t total)
+{
+  struct download_sample sample_data;
+
+  if (!filename || !sample(filename, xfered, total, &sample_data))
+    return;
+
+  call_with_gvl(deliver_with_gvl, &sample_data);
+}
+
+/** Replaces the receiver of download progress, a callable taking
+ * filename, bytes transferred, total bytes and rate; nil turns it
+ * off. `per_second' is the maximum number of reports per file and
+ * second. */
+void download_configure(VALUE receiver, double per_second)
+{
+  int i;
+
+  pthread_mutex_lock(&download_lock);
+  for(i=0; i < DOWNLOAD_SLOTS; i++)
+    clear_slot(&download_slots[i]);
+  download_interval = 1.0 / per_second;
+  pthread_mutex_unlock(&download_lock);
+
+  download_receiver = receiver;
+}
+
+/***************************************
+ * Binding
+ ***************************************/
+
+void Init_download()
+{
+  rb_gc_register_address(&download_receiver);
+}
@@ -0,0 +1,10 @@
+#ifndef RUBY_ALPM_DOWNLOAD_H
+#define RUBY_ALPM_DOWNLOAD_H
+#include <sys/types.h>
+#include "main.h"
+
+void download_callback(const char* filename, off_t xfered, off_t total);
+void download_configure(VALUE receiver, double per_second);
+void Init_download();
+
+#endif
@@ -12,4 +12,14 @@ unless find_library("alpm", "alpm_initialize", "/usr/lib")
   abort "Could not find alpm_initialize() in libalpm"
 end
 
+unless have_library("pthread", "pthread_create")
+  abort "Could not find pthread_create() in libpthread"
+end
+
+unless have_header("ruby/thread.h") && have_func("rb_thread_call_without_gvl2", "ruby/thread.h")
+  abort "Your Ruby lacks rb_thread_call_without_gvl2()"
+end
+
+have_func("rb_enc_interned_str", "ruby/encoding.h")
+
 create_makefile "alpm"
@@ -0,0 +1,444 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "file_index.h"
+#include "package.h"
+
+/***************************************
+ * Data structures
+ ***************************************/
+
+#define FILE_INDEX_MAGIC "RALPMFI"
+#define FILE_INDEX_VERSION 1
+
+/* Header of a persisted index. It is followed by the package index
+ * and the string offset of each entry (uint32_t each), the string
+ * offset of each package name (uint32_t) and the NUL-terminated
+ * strings, all in native byte order. */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t npkgs;
+  uint32_t nentries;
+  uint32_t reserved;
+  int64_t mtime_sec;   /* Of the local database directory */
+  int64_t mtime_nsec;
+  uint64_t strings_size;
+} file_index_header_t;
+
+/* A path owned by the package at index `pkg'. */
+typedef struct {
+  const char* path;
+  uint32_t pkg;
+} file_entry_t;
+
+/* All paths of the local packages, sorted, so that exact lookups go
+ * through a hash table and directory prefixes are a binary search
+ * plus a scan over the matching range. Paths are relative to the
+ * root like in libalpm, directories end with a slash. */
+typedef struct {
+  alpm_pkg_t** p_pkgs;
+  uint32_t npkgs;
+  file_entry_t* p_entries;
+  uint32_t nentries;
+  st_table* p_by_path;  /* path → index of its first entry */
+  char* p_buf;          /* Strings of a loaded index */
+  uint32_t* p_seen;     /* Per package, for deduplicating owners */
+  uint32_t stamp;
+} file_index_t;
+
+/***************************************
+ * Helpers
+ ***************************************/
+
+static void free_file_index(void* ptr)
+{
+  file_index_t* p_index = (file_index_t*) ptr;
+
+  if (p_index->p_by_path)
+    st_free_table(p_index->p_by_path);
+  xfree(p_index->p_pkgs);
+  xfree(p_index->p_entries);
+  xfree(p_index->p_buf);
+  xfree(p_index->p_seen);
+  xfree(p_index);
+}
+
+static VALUE new_file_index(file_index_t** pp_index)
+{
+  *pp_index = ZALLOC(file_index_t);
+  return Data_Wrap_Struct(0, NULL, free_file_index, *pp_index);
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+  const file_entry_t* p_a = (const file_entry_t*) a;
+  const file_entry_t* p_b = (const file_entry_t*) b;
+  int result = strcmp(p_a->path, p_b->path);
+
+  if (result == 0)
+    return p_a->pkg < p_b->pkg ? -1 : (p_a->pkg > p_b->pkg);
+
+  return result;
+}
+
+/* Hashes the first entry of each path, checking that the entries
+ * are sorted. Returns 0 if they aren’t. */
+static int hash_entries(file_index_t* p_index)
+{
+  uint32_t i;
+
+  p_index->p_by_path = st_init_strtable_with_size(p_index->nentries);
+  p_index->p_seen = ZALLOC_N(uint32_t, p_index->npkgs ? p_index->npkgs : 1);
+
+  for(i=0; i < p_index->nentries; i++) {
+    int cmp = i ? strcmp(p_index->p_entries[i - 1].path, p_index->p_entries[i].path) : -1;
+
+    if (cmp > 0)
+      return 0;
+    if (cmp < 0)
+      st_insert(p_index->p_by_path, (st_data_t) p_index->p_entries[i].path, (st_data_t) i);
+  }
+
+  return 1;
+}
+
+/* Modification time of the directory libalpm keeps the local
+ * database in, which changes whenever a package is installed,
+ * upgraded or removed. Returns -1 if it can’t be determined. */
+static int local_db_mtime(alpm_handle_t* p_alpm, int64_t* p_sec, int64_t* p_nsec)
+{
+  const char* dbpath = alpm_option_get_dbpath(p_alpm);
+  size_t len = strlen(dbpath);
+  VALUE tmp;
+  char* path = ALLOCV(tmp, len + sizeof("/local"));
+  struct stat st;
+  int result;
+
+  memcpy(path, dbpath, len);
+  strcpy(path + len, (len && dbpath[len - 1] == '/') ? "local" : "/local");
+  result = stat(path, &st);
+  ALLOCV_END(tmp);
+
+  if (result < 0)
+    return -1;
+
+  *p_sec = (int64_t) st.st_mtim.tv_sec;
+  *p_nsec = (int64_t) st.st_mtim.tv_nsec;
+  return 0;
+}
+
+/* Reads the index persisted at `path' if it was written for the
+ * current state of the local database `p_db'. Returns Qnil if the
+ * file is missing, corrupt or stale. */
+static VALUE load(const char* path, alpm_db_t* p_db, int64_t sec, int64_t nsec)
+{
+  file_index_t* p_index = NULL;
+  file_index_header_t header;
+  struct stat st;
+  VALUE obj;
+  FILE* p_file = fopen(path, "rb");
+  uint32_t* p_offsets = NULL;
+  size_t size;
+  uint32_t i;
+  int ok = 0;
+
+  if (!p_file)
+    return Qnil;
+
+  obj = new_file_index(&p_index);
+
+  if (fread(&header, sizeof(header), 1, p_file) != 1
+      || memcmp(header.magic, FILE_INDEX_MAGIC, sizeof(FILE_INDEX_MAGIC)) != 0
+      || header.version != FILE_INDEX_VERSION
+      || header.mtime_sec != sec || header.mtime_nsec != nsec
+      || header.npkgs != alpm_list_count(alpm_db_get_pkgcache(p_db))
+      || header.strings_size == 0 || header.strings_size > UINT32_MAX)
+    goto done;
+
+  /* Everything after the header, in one go */
+  size = (2 * (size_t) header.nentries + header.npkgs) * sizeof(uint32_t) + header.strings_size;
+  if (fstat(fileno(p_file), &st) < 0 || (uint64_t) st.st_size != sizeof(header) + size)
+    goto done;
+
+  p_index->p_buf = ALLOC_N(char, size);
+  if (fread(p_index->p_buf, 1, size, p_file) != size || p_index->p_buf[size - 1] != '\0')
+    goto done;
+
+  p_offsets = (uint32_t*) p_index->p_buf;
+  p_index->npkgs = header.npkgs;
+  p_index->nentries = header.nentries;
+  p_index->p_pkgs = ALLOC_N(alpm_pkg_t*, header.npkgs ? header.npkgs : 1);
+  p_index->p_entries = ALLOC_N(file_entry_t, header.nentries ? header.nentries : 1);
+
+  {
+    uint32_t* p_pkg_indices = p_offsets;
+    uint32_t* p_path_offsets = p_offsets + header.nentries;
+    uint32_t* p_name_offsets = p_offsets + 2 * (size_t) header.nentries;
+    const char* strings = (const char*) (p_name_offsets + header.npkgs);
+
+    for(i=0; i < header.npkgs; i++) {
+      if (p_name_offsets[i] >= header.strings_size)
+        goto done;
+      /* Single = intended */
+      if (!(p_index->p_pkgs[i] = alpm_db_get_pkg(p_db, strings + p_name_offsets[i])))
+        goto done;
+    }
+
+    for(i=0; i < header.nentries; i++) {
+      if (p_path_offsets[i] >= header.strings_size || p_pkg_indices[i] >= header.npkgs)
+        goto done;
+      p_index->p_entries[i].path = strings + p_path_offsets[i];
+      p_index->p_entries[i].pkg = p_pkg_indices[i];
+    }
+  }
+
+  ok = hash_entries(p_index);
+
+done:
+  fclose(p_file);
+  return ok ? obj : Qnil;
+}
+
+/* Builds the index from the file lists of the packages in `p_db'. */
+static VALUE build(alpm_db_t* p_db)
+{
+  file_index_t* p_index = NULL;
+  VALUE obj = new_file_index(&p_index);
+  alpm_list_t* item = NULL;
+  size_t nentries = 0;
+  size_t n = 0;
+  uint32_t i = 0;
+
+  p_index->npkgs = (uint32_t) alpm_list_count(alpm_db_get_pkgcache(p_db));
+  p_index->p_pkgs = ALLOC_N(alpm_pkg_t*, p_index->npkgs ? p_index->npkgs : 1);
+
+  for(item = alpm_db_get_pkgcache(p_db); item && i < p_index->npkgs; item = alpm_list_next(item), i++) {
+    p_index->p_pkgs[i] = (alpm_pkg_t*) item->data;
+    nentries += alpm_pkg_get_files(p_index->p_pkgs[i])->count;
+  }
+
+  if (nentries >= UINT32_MAX)
+    rb_raise(rb_eAlpm_Error, "Too many files for a file index.");
+
+  p_index->p_entries = ALLOC_N(file_entry_t, nentries ? nentries : 1);
+  for(i=0; i < p_index->npkgs; i++) {
+    alpm_filelist_t* p_files = alpm_pkg_get_files(p_index->p_pkgs[i]);
+    size_t j;
+
+    for(j=0; j < p_files->count && n < nentries; j++, n++) {
+      p_index->p_entries[n].path = p_files->files[j].name;
+      p_index->p_entries[n].pkg = i;
+    }
+  }
+  p_index->nentries = (uint32_t) n;
+
+  qsort(p_index->p_entries, p_index->nentries, sizeof(file_entry_t), compare_entries);
+  hash_entries(p_index);
+
+  return obj;
+}
+
+/* Writes `p_index' to `path', via a temporary file that replaces
+ * it atomically. Raises a SystemCallError on failure. */
+static void save(file_index_t* p_index, const char* path, int64_t sec, int64_t nsec)
+{
+  file_index_header_t header;
+  VALUE tmppath = rb_sprintf("%s.%d.tmp", path, (int) getpid());
+  VALUE tmp;
+  uint32_t* p_offsets = ALLOCV_N(uint32_t, tmp, 2 * (size_t) p_index->nentries + p_index->npkgs);
+  uint32_t* p_path_offsets = p_offsets + p_index->nentries;
+  uint32_t* p_name_offsets = p_offsets + 2 * (size_t) p_index->nentries;
+  FILE* p_file = NULL;
+  uint64_t size = 0;
+  uint32_t i;
+  int ok;
+  int err;
+
+  /* Lay out the strings, sharing the entries of the same path */
+  for(i=0; i < p_index->npkgs; i++) {
+    p_name_offsets[i] = (uint32_t) size;
+    size += strlen(alpm_pkg_get_name(p_index->p_pkgs[i])) + 1;
+  }
+  for(i=0; i < p_index->nentries; i++) {
+    p_offsets[i] = p_index->p_entries[i].pkg;
+    if (i && strcmp(p_index->p_entries[i].path, p_index->p_entries[i - 1].path) == 0)
+      p_path_offsets[i] = p_path_offsets[i - 1];
+    else {
+      p_path_offsets[i] = (uint32_t) size;
+      size += strlen(p_index->p_entries[i].path) + 1;
+    }
+  }
+
+  if (size == 0 || size > UINT32_MAX) {
+    ALLOCV_END(tmp);
+    return;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FILE_INDEX_MAGIC, sizeof(FILE_INDEX_MAGIC));
+  header.version = FILE_INDEX_VERSION;
+  header.npkgs = p_index->npkgs;
+  header.nentries = p_index->nentries;
+  header.mtime_sec = sec;
+  header.mtime_nsec = nsec;
+  header.strings_size = size;
+
+  p_file = fopen(StringValueCStr(tmppath), "wb");
+  if (!p_file) {
+    err = errno;
+    ALLOCV_END(tmp);
+    errno = err;
+    rb_sys_fail(RSTRING_PTR(tmppath));
+  }
+
+  ok = fwrite(&header, sizeof(header), 1, p_file) == 1
+    && fwrite(p_offsets, sizeof(uint32_t), 2 * (size_t) p_index->nentries + p_index->npkgs, p_file) == 2 * (size_t) p_index->nentries + p_index->npkgs;
+
+  for(i=0; ok && i < p_index->npkgs; i++) {
+    const char* name = alpm_pkg_get_name(p_index->p_pkgs[i]);
+    ok = fwrite(name, 1, strlen(name) + 1, p_file) == strlen(name) + 1;
+  }
+  for(i=0; ok && i < p_index->nentries; i++) {
+    const char* file = p_index->p_entries[i].path;
+
+    if (i && p_path_offsets[i] == p_path_offsets[i - 1])
+      continue;
+    ok = fwrite(file, 1, strlen(file) + 1, p_file) == strlen(file) + 1;
+  }
+
+  err = ok ? 0 : errno;
+  if (fclose(p_file) != 0 && ok) {
+    ok = 0;
+    err = errno;
+  }
+  ALLOCV_END(tmp);
+
+  if (ok && rename(RSTRING_PTR(tmppath), path) < 0) {
+    ok = 0;
+    err = errno;
+  }
+  if (!ok) {
+    unlink(RSTRING_PTR(tmppath));
+    errno = err;
+    rb_sys_fail(path);
+  }
+}
+
+/* Index of the first entry whose path isn’t less than `path'. */
+static uint32_t lower_bound(file_index_t* p_index, const char* path)
+{
+  uint32_t low = 0;
+  uint32_t high = p_index->nentries;
+
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+
+    if (strcmp(p_index->p_entries[mid].path, path) < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
+
+static void add_owner(file_index_t* p_index, VALUE rb_alpm, uint32_t pkg, VALUE result)
+{
+  if (p_index->p_seen[pkg] == p_index->stamp)
+    return;
+
+  p_index->p_seen[pkg] = p_index->stamp;
+  rb_ary_push(result, wrap_package(rb_alpm, p_index->p_pkgs[pkg]));
+}
+
+/***************************************
+ * Interface
+ ***************************************/
+
+/** Returns the file index of the local database `p_db', as a hidden
+ * Ruby object. If `path' isn’t NULL, the index is read from there
+ * if it was written for the current state of the database, and
+ * written there after building it otherwise. */
+VALUE file_index_open(alpm_handle_t* p_alpm, alpm_db_t* p_db, const char* path)
+{
+  file_index_t* p_index = NULL;
+  int64_t sec, nsec;
+  int persist = path && local_db_mtime(p_alpm, &sec, &nsec) == 0;
+  VALUE obj;
+
+  if (persist) {
+    obj = load(path, p_db, sec, nsec);
+    if (!NIL_P(obj))
+      return obj;
+  }
+
+  obj = build(p_db);
+  if (persist) {
+    Data_Get_Struct(obj, file_index_t, p_index);
+    save(p_index, path, sec, nsec);
+  }
+
+  return obj;
+}
+
+/** The Package instances owning `query', an absolute path below
+ * `root' or one relative to it. With `prefix' set, those owning
+ * anything below `query' as a directory instead. */
+VALUE file_index_owners(VALUE index, VALUE rb_alpm, const char* root, const char* query, int prefix)
+{
+  file_index_t* p_index = NULL;
+  size_t rootlen = strlen(root);
+  const char* rel = query;
+  VALUE result = rb_ary_new();
+  VALUE tmp = 0;
+  char* dir = NULL;
+  st_data_t first;
+  size_t len;
+  uint32_t i;
+
+  Data_Get_Struct(index, file_index_t, p_index);
+  if (++p_index->stamp == 0) {
+    memset(p_index->p_seen, 0, p_index->npkgs * sizeof(uint32_t));
+    p_index->stamp = 1;
+  }
+
+  if (rootlen && strncmp(rel, root, rootlen) == 0)
+    rel += rootlen;
+  while (*rel == '/')
+    rel++;
+
+  /* Directories are stored with a trailing slash */
+  len = strlen(rel);
+  if (len && rel[len - 1] != '/') {
+    dir = ALLOCV(tmp, len + 2);
+    memcpy(dir, rel, len);
+    strcpy(dir + len, "/");
+  }
+
+  if (prefix) {
+    const char* start = dir ? dir : rel;
+    size_t startlen = strlen(start);
+
+    for(i = lower_bound(p_index, start); i < p_index->nentries; i++) {
+      if (strncmp(p_index->p_entries[i].path, start, startlen) != 0)
+        break;
+      add_owner(p_index, rb_alpm, p_index->p_entries[i].pkg, result);
+    }
+  }
+  else if (st_lookup(p_index->p_by_path, (st_data_t) rel, &first)
+           || (dir && st_lookup(p_index->p_by_path, (st_data_t) dir, &first))) {
+    const char* path = p_index->p_entries[first].path;
+
+    for(i = (uint32_t) first; i < p_index->nentries && strcmp(p_index->p_entries[i].path, path) == 0; i++)
+      add_owner(p_index, rb_alpm, p_index->p_entries[i].pkg, result);
+  }
+
+  if (dir)
+    ALLOCV_END(tmp);
+
+  return result;
+}
@@ -0,0 +1,8 @@
+#ifndef RUBY_ALPM_FILE_INDEX_H
+#define RUBY_ALPM_FILE_INDEX_H
+#include "main.h"
+
+VALUE file_index_open(alpm_handle_t* p_alpm, alpm_db_t* p_db, const char* path);
+VALUE file_index_owners(VALUE index, VALUE rb_alpm, const char* root, const char* query, int prefix);
+
+#endif
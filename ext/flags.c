@@ -0,0 +1,156 @@
+#include "flags.h"
+
+/***************************************
+ * Tables
+ ***************************************/
+
+static const flag_def_t siglevel_defs[] = {
+  {"package",              ALPM_SIG_PACKAGE},
+  {"package_optional",     ALPM_SIG_PACKAGE_OPTIONAL},
+  {"package_marginal_ok",  ALPM_SIG_PACKAGE_MARGINAL_OK},
+  {"package_unknown_ok",   ALPM_SIG_PACKAGE_UNKNOWN_OK},
+  {"database",             ALPM_SIG_DATABASE},
+  {"database_optional",    ALPM_SIG_DATABASE_OPTIONAL},
+  {"database_marginal_ok", ALPM_SIG_DATABASE_MARGINAL_OK},
+  {"database_unknown_ok",  ALPM_SIG_DATABASE_UNKNOWN_OK},
+  {"package_set",          ALPM_SIG_PACKAGE_SET},
+  {"package_trust_set",    ALPM_SIG_PACKAGE_TRUST_SET},
+  {"use_default",          ALPM_SIG_USE_DEFAULT}
+};
+
+static const flag_def_t transaction_defs[] = {
+  {"nodeps",       ALPM_TRANS_FLAG_NODEPS},
+  {"force",        ALPM_TRANS_FLAG_FORCE},
+  {"nosave",       ALPM_TRANS_FLAG_NOSAVE},
+  {"nodepversion", ALPM_TRANS_FLAG_NODEPVERSION},
+  {"cascade",      ALPM_TRANS_FLAG_CASCADE},
+  {"recurse",      ALPM_TRANS_FLAG_RECURSE},
+  {"dbonly",       ALPM_TRANS_FLAG_DBONLY},
+  {"alldeps",      ALPM_TRANS_FLAG_ALLDEPS},
+  {"downloadonly", ALPM_TRANS_FLAG_DOWNLOADONLY},
+  {"noscriptlet",  ALPM_TRANS_FLAG_NOSCRIPTLET},
+  {"noconflicts",  ALPM_TRANS_FLAG_NOCONFLICTS},
+  {"needed",       ALPM_TRANS_FLAG_NEEDED},
+  {"allexplicit",  ALPM_TRANS_FLAG_ALLEXPLICIT},
+  {"unneeded",     ALPM_TRANS_FLAG_UNNEEDED},
+  {"recurseall",   ALPM_TRANS_FLAG_RECURSEALL},
+  {"nolock",       ALPM_TRANS_FLAG_NOLOCK}
+};
+
+#define DEF_COUNT(defs) (sizeof(defs) / sizeof(flag_def_t))
+
+static VALUE siglevel_syms[DEF_COUNT(siglevel_defs)];
+static VALUE transaction_syms[DEF_COUNT(transaction_defs)];
+
+flag_table_t siglevel_flags = {"signature level", siglevel_defs, DEF_COUNT(siglevel_defs), NULL, siglevel_syms};
+flag_table_t transaction_flags = {"transaction flag", transaction_defs, DEF_COUNT(transaction_defs), NULL, transaction_syms};
+
+/***************************************
+ * Helpers
+ ***************************************/
+
+static unsigned int lookup(flag_table_t* p_table, VALUE sym)
+{
+  st_data_t bit;
+
+  if (!SYMBOL_P(sym) || !st_lookup(p_table->p_by_sym, (st_data_t) sym, &bit)) {
+    VALUE str = rb_inspect(sym);
+    rb_raise(rb_eArgError, "Unknown %s: %s", p_table->what, StringValueCStr(str));
+  }
+
+  return (unsigned int) bit;
+}
+
+/* Arguments for hash_flag(). */
+struct hash_args {
+  flag_table_t* p_table;
+  unsigned int bits;
+};
+
+static int hash_flag(VALUE key, VALUE value, VALUE ptr)
+{
+  struct hash_args* p_args = (struct hash_args*) ptr;
+  unsigned int bit = lookup(p_args->p_table, key);
+
+  if (RTEST(value))
+    p_args->bits |= bit;
+
+  return ST_CONTINUE;
+}
+
+/***************************************
+ * Interface
+ ***************************************/
+
+/** Converts an array of Symbols into the bits they name in
+ * `p_table' in a single pass. Raises a TypeError if `ary' isn’t an
+ * array and an ArgumentError for unknown entries. */
+unsigned int flags_from_ary(flag_table_t* p_table, VALUE ary)
+{
+  unsigned int bits = 0;
+  VALUE orig = ary;
+  long i;
+
+  if (!(RTEST(ary = rb_check_array_type(ary)))) { /*  Single = intended */
+    VALUE str = rb_inspect(orig);
+    rb_raise(rb_eTypeError, "Not an array (#to_ary): %s", StringValueCStr(str));
+  }
+
+  for(i=0; i < RARRAY_LEN(ary); i++)
+    bits |= lookup(p_table, RARRAY_AREF(ary, i));
+
+  return bits;
+}
+
+/** Converts a hash mapping Symbols to truth values into the bits
+ * set to true in `p_table' in a single pass. Raises a TypeError if
+ * `hash' isn’t a hash and an ArgumentError for unknown keys. */
+unsigned int flags_from_hash(flag_table_t* p_table, VALUE hash)
+{
+  struct hash_args args;
+
+  if (!RB_TYPE_P(hash, T_HASH))
+    rb_raise(rb_eTypeError, "Argument is not a hash.");
+
+  args.p_table = p_table;
+  args.bits = 0;
+  rb_hash_foreach(hash, hash_flag, (VALUE) &args);
+
+  return args.bits;
+}
+
+/** Converts `bits' back into an array of the Symbols of `p_table',
+ * in table order. Unnamed bits are left out. */
+VALUE flags_to_ary(flag_table_t* p_table, unsigned int bits)
+{
+  VALUE result = rb_ary_new();
+  size_t i;
+
+  for(i=0; i < p_table->count; i++) {
+    if (bits & p_table->p_defs[i].bit)
+      rb_ary_push(result, p_table->p_syms[i]);
+  }
+
+  return result;
+}
+
+/***************************************
+ * Binding
+ ***************************************/
+
+static void init_table(flag_table_t* p_table)
+{
+  size_t i;
+
+  p_table->p_by_sym = st_init_numtable_with_size(p_table->count);
+  for(i=0; i < p_table->count; i++) {
+    p_table->p_syms[i] = STR2SYM(p_table->p_defs[i].name);
+    st_insert(p_table->p_by_sym, (st_data_t) p_table->p_syms[i], (st_data_t) p_table->p_defs[i].bit);
+  }
+}
+
+void Init_flags()
+{
+  init_table(&siglevel_flags);
+  init_table(&transaction_flags);
+}
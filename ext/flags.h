@@ -0,0 +1,27 @@
+#ifndef RUBY_ALPM_FLAGS_H
+#define RUBY_ALPM_FLAGS_H
+#include "main.h"
+
+/* A set of bit flags libalpm knows by name, see flags.c. */
+typedef struct {
+  const char* name;
+  unsigned int bit;
+} flag_def_t;
+
+typedef struct {
+  const char* what;        /* For error messages */
+  const flag_def_t* p_defs;
+  size_t count;
+  st_table* p_by_sym;      /* Symbol → bit */
+  VALUE* p_syms;           /* Indexed like `p_defs' */
+} flag_table_t;
+
+extern flag_table_t siglevel_flags;
+extern flag_table_t transaction_flags;
+
+unsigned int flags_from_ary(flag_table_t* p_table, VALUE ary);
+unsigned int flags_from_hash(flag_table_t* p_table, VALUE hash);
+VALUE flags_to_ary(flag_table_t* p_table, unsigned int bits);
+void Init_flags();
+
+#endif
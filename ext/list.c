@@ -0,0 +1,81 @@
+#include "list.h"
+#include "package.h"
+#include "database.h"
+
+/***************************************
+ * Iteration
+ ***************************************/
+
+/** Walks `p_list' once and returns a new Ruby array with the
+ * result of `conv' for each of its items. */
+VALUE list_to_ary(alpm_list_t* p_list, list_conv_t conv, VALUE ctx)
+{
+  alpm_list_t* item = NULL;
+  VALUE result = rb_ary_new();
+
+  for(item = p_list; item; item = alpm_list_next(item))
+    rb_ary_push(result, conv(item->data, ctx));
+
+  return result;
+}
+
+/** Walks `p_list' once and yields the result of `conv' for each
+ * of its items, without building an intermediate array. */
+void list_each(alpm_list_t* p_list, list_conv_t conv, VALUE ctx)
+{
+  alpm_list_t* item = NULL;
+
+  for(item = p_list; item; item = alpm_list_next(item))
+    rb_yield(conv(item->data, ctx));
+}
+
+/** Number of items in `p_list' as a Ruby Integer, suitable for
+ * use in an enumerator’s size function, which Ruby only calls
+ * when the size is asked for. */
+VALUE list_size(alpm_list_t* p_list)
+{
+  return ULONG2NUM(alpm_list_count(p_list));
+}
+
+/***************************************
+ * Converters
+ ***************************************/
+
+/** Converter for lists of C strings. Returns frozen strings,
+ * see frozen_utf8_str(). */
+VALUE list_conv_string(void* data, VALUE ctx)
+{
+  return frozen_utf8_str((const char*) data);
+}
+
+/** Converter for lists of C strings returning new, mutable
+ * strings, for the methods that always returned those. */
+VALUE list_conv_mutable_string(void* data, VALUE ctx)
+{
+  return rb_str_new2((const char*) data);
+}
+
+/** Converter for lists of alpm_depend_t. Returns the dependency
+ * as a string like <tt>glibc>=2.17</tt>. */
+VALUE list_conv_depend(void* data, VALUE ctx)
+{
+  char* str = alpm_dep_compute_string((alpm_depend_t*) data);
+  VALUE result = frozen_utf8_str(str);
+
+  free(str);
+  return result;
+}
+
+/** Converter for lists of alpm_pkg_t. `ctx' is the Alpm instance
+ * the packages were obtained from. */
+VALUE list_conv_package(void* data, VALUE ctx)
+{
+  return wrap_package(ctx, data);
+}
+
+/** Converter for lists of alpm_db_t. `ctx' is the Alpm instance
+ * the databases belong to. */
+VALUE list_conv_database(void* data, VALUE ctx)
+{
+  return wrap_database(ctx, data);
+}
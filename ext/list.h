@@ -0,0 +1,19 @@
+#ifndef RUBY_ALPM_LIST_H
+#define RUBY_ALPM_LIST_H
+#include "main.h"
+
+/* Converts the data of a single alpm_list_t item into a Ruby
+ * object. `ctx' is passed through from the list function. */
+typedef VALUE (*list_conv_t)(void* data, VALUE ctx);
+
+VALUE list_to_ary(alpm_list_t* p_list, list_conv_t conv, VALUE ctx);
+void list_each(alpm_list_t* p_list, list_conv_t conv, VALUE ctx);
+VALUE list_size(alpm_list_t* p_list);
+
+VALUE list_conv_string(void* data, VALUE ctx);
+VALUE list_conv_mutable_string(void* data, VALUE ctx);
+VALUE list_conv_depend(void* data, VALUE ctx);
+VALUE list_conv_package(void* data, VALUE ctx);
+VALUE list_conv_database(void* data, VALUE ctx);
+
+#endif
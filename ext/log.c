@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "log.h"
+
+/***************************************
+ * Variables, etc
+ ***************************************/
+
+/* Number of pending messages after which they are delivered even
+ * though the libalpm call producing them hasn’t returned yet. */
+#define LOG_BATCH_SIZE 64
+
+/* Room for message text the buffer starts out with and always keeps
+ * free before formatting, so most messages are formatted in one go. */
+#define LOG_INLINE_SIZE 256
+
+/* A formatted message waiting for delivery to Ruby. */
+struct log_entry {
+  alpm_loglevel_t level;
+  size_t offset; /* Of the message text in the buffer’s `p_text' */
+};
+
+/* Messages with their text formatted back to back into one growing
+ * buffer. Two of them take turns, so that the memory is reused: one
+ * collects new messages while the other one’s are delivered. */
+struct log_buffer {
+  struct log_entry* p_entries;
+  size_t count;
+  size_t capacity;
+  char* p_text;
+  size_t used;
+  size_t size;
+};
+
+/* libalpm’s log callback has no context pointer, so everything
+ * below is process-global. `pending' is shared with native worker
+ * threads and guarded by `log_lock'; `delivering' and the rest are
+ * only touched while holding the GVL. `log_mask' is read without the
+ * lock, a stale value only lets a single message more or less
+ * through. */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct log_buffer pending;
+static struct log_buffer delivering;
+static volatile int log_mask = 0;
+
+static VALUE log_receiver = Qnil;
+static int log_batch = 0;
+static int log_flushing = 0;
+
+static ID s_id_error;
+static ID s_id_warning;
+static ID s_id_debug;
+static ID s_id_function;
+static ID s_id_call;
+static ID s_id_push;
+
+/***************************************
+ * Helpers
+ ***************************************/
+
+static VALUE level_to_sym(alpm_loglevel_t level)
+{
+  switch(level) {
+  case ALPM_LOG_ERROR:
+    return ID2SYM(s_id_error);
+  case ALPM_LOG_WARNING:
+    return ID2SYM(s_id_warning);
+  case ALPM_LOG_DEBUG:
+    return ID2SYM(s_id_debug);
+  case ALPM_LOG_FUNCTION:
+    return ID2SYM(s_id_function);
+  default:
+    return Qnil;
+  }
+}
+
+/* Makes room for `len' more bytes of text in `p_buf'. */
+static int reserve_text(struct log_buffer* p_buf, size_t len)
+{
+  size_t size = p_buf->size ? p_buf->size : LOG_INLINE_SIZE;
+  char* p_grown;
+
+  if (p_buf->used + len <= p_buf->size)
+    return 1;
+
+  while (size < p_buf->used + len)
+    size *= 2;
+  if (!(p_grown = realloc(p_buf->p_text, size))) /* Single = intended */
+    return 0;
+
+  p_buf->p_text = p_grown;
+  p_buf->size = size;
+  return 1;
+}
+
+/* Formats `fmt' with `args' into the pending buffer, without the
+ * trailing newline libalpm puts on most messages, and returns how
+ * many messages are pending now. Drops the message if out of
+ * memory. Safe to call without the GVL. */
+static size_t __attribute__((format(printf, 2, 0))) append_entry(alpm_loglevel_t level, const char* fmt, va_list args)
+{
+  struct log_entry* p_grown;
+  char* msg;
+  va_list copy;
+  size_t count;
+  int len;
+
+  pthread_mutex_lock(&log_lock);
+
+  if (pending.count == pending.capacity) {
+    size_t capacity = pending.capacity ? pending.capacity * 2 : LOG_BATCH_SIZE;
+
+    if (!(p_grown = realloc(pending.p_entries, capacity * sizeof(struct log_entry)))) /* Single = intended */
+      goto done;
+    pending.p_entries = p_grown;
+    pending.capacity = capacity;
+  }
+
+  if (!reserve_text(&pending, LOG_INLINE_SIZE))
+    goto done;
+
+  va_copy(copy, args);
+  len = vsnprintf(pending.p_text + pending.used, pending.size - pending.used, fmt, copy);
+  va_end(copy);
+  if (len < 0)
+    goto done;
+
+  /* Too long for the free room, make enough and format again */
+  if ((size_t) len >= pending.size - pending.used) {
+    if (!reserve_text(&pending, len + 1))
+      goto done;
+    vsnprintf(pending.p_text + pending.used, len + 1, fmt, args);
+  }
+
+  msg = pending.p_text + pending.used;
+  if (len > 0 && msg[len - 1] == '\n')
+    msg[len - 1] = '\0';
+
+  pending.p_entries[pending.count].level = level;
+  pending.p_entries[pending.count].offset = pending.used;
+  pending.count++;
+  pending.used += len + 1;
+
+ done:
+  count = pending.count;
+  pthread_mutex_unlock(&log_lock);
+
+  return count;
+}
+
+/* Moves the pending messages to `delivering' and hands its emptied
+ * memory to `pending' in exchange. */
+static void take_entries(void)
+{
+  struct log_buffer tmp;
+
+  pthread_mutex_lock(&log_lock);
+  tmp = pending;
+  pending = delivering;
+  delivering = tmp;
+  pthread_mutex_unlock(&log_lock);
+}
+
+/* Hands the entries in `delivering' to the receiver, either one by
+ * one or as a single array of [level, message] pairs. */
+static VALUE deliver(VALUE ptr)
+{
+  VALUE receiver = log_receiver;
+  VALUE batch = Qnil;
+  VALUE level;
+  VALUE msg;
+  size_t i;
+
+  if (NIL_P(receiver))
+    return Qnil;
+
+  if (log_batch)
+    batch = rb_ary_new_capa((long) delivering.count);
+
+  for(i=0; i < delivering.count; i++) {
+    level = level_to_sym(delivering.p_entries[i].level);
+    msg = rb_utf8_str_new_cstr(delivering.p_text + delivering.p_entries[i].offset);
+
+    if (log_batch)
+      rb_ary_push(batch, rb_assoc_new(level, msg));
+    else
+      rb_funcall(receiver, s_id_call, 2, level, msg);
+  }
+
+  if (!log_batch)
+    return Qnil;
+
+  if (rb_obj_is_proc(receiver))
+    rb_funcall(receiver, s_id_call, 1, batch);
+  else
+    rb_funcall(receiver, s_id_push, 1, batch);
+
+  return Qnil;
+}
+
+static void* flush_without_raising(void* ptr)
+{
+  flush_log(0);
+  return NULL;
+}
+
+/***************************************
+ * Interface
+ ***************************************/
+
+/** The log callback handed to libalpm. Drops messages the receiver
+ * isn’t interested in before formatting them and queues the others.
+ * They are delivered by the flush_log() at the end of the method
+ * that called libalpm, or earlier once a batch is full; native
+ * worker threads never deliver themselves. */
+void log_callback(alpm_loglevel_t level, const char* fmt, va_list args)
+{
+  size_t count;
+
+  if (!(level & log_mask))
+    return;
+
+  count = append_entry(level, fmt, args);
+
+  switch(gvl_state()) {
+  case GVL_HELD:
+    if (count >= LOG_BATCH_SIZE)
+      flush_log(0);
+    break;
+  case GVL_RELEASED:
+    if (count >= LOG_BATCH_SIZE)
+      call_with_gvl(flush_without_raising, NULL);
+    break;
+  default:
+    break;
+  }
+}
+
+/** Converts a log level symbol to the mask of that level and all
+ * more severe ones. Raises ArgumentError for unknown levels. */
+int log_mask_from_ruby(VALUE level)
+{
+  ID id;
+
+  Check_Type(level, T_SYMBOL);
+  id = SYM2ID(level);
+
+  if (id == s_id_error)
+    return ALPM_LOG_ERROR;
+  else if (id == s_id_warning)
+    return ALPM_LOG_ERROR | ALPM_LOG_WARNING;
+  else if (id == s_id_debug)
+    return ALPM_LOG_ERROR | ALPM_LOG_WARNING | ALPM_LOG_DEBUG;
+  else if (id == s_id_function)
+    return ALPM_LOG_ERROR | ALPM_LOG_WARNING | ALPM_LOG_DEBUG | ALPM_LOG_FUNCTION;
+
+  rb_raise(rb_eArgError, "Unknown log level %"PRIsVALUE".", level);
+  return 0; /* Not reached */
+}
+
+/** Replaces the receiver of log messages. `receiver' is something
+ * responding to #call, or to #push if `batch' is set and it is not
+ * a Proc; nil turns logging off. Messages pending for the previous
+ * receiver are delivered to it first. */
+void log_configure(VALUE receiver, int mask, int batch)
+{
+  flush_log(1);
+
+  log_receiver = receiver;
+  log_batch = batch;
+  log_mask = NIL_P(receiver) ? 0 : mask;
+}
+
+/** Delivers the pending log messages. Must be called with the GVL.
+ * Exceptions raised by the receiver are re-raised only if
+ * `can_raise' is set; otherwise (inside a libalpm callback, where
+ * unwinding would skip libalpm’s cleanup) they are kept until the
+ * next raise_callback_error(). */
+void flush_log(int can_raise)
+{
+  if (!log_flushing) {
+    take_entries();
+
+    if (delivering.count > 0) {
+      log_flushing = 1;
+      protect_callback(deliver, Qnil);
+      log_flushing = 0;
+    }
+    delivering.count = 0;
+    delivering.used = 0;
+  }
+
+  if (can_raise)
+    raise_callback_error();
+}
+
+/***************************************
+ * Binding
+ ***************************************/
+
+void Init_log()
+{
+  s_id_error = rb_intern("error");
+  s_id_warning = rb_intern("warning");
+  s_id_debug = rb_intern("debug");
+  s_id_function = rb_intern("function");
+  s_id_call = rb_intern("call");
+  s_id_push = rb_intern("push");
+
+  rb_gc_register_address(&log_receiver);
+}
@@ -0,0 +1,12 @@
+#ifndef RUBY_ALPM_LOG_H
+#define RUBY_ALPM_LOG_H
+#include <stdarg.h>
+#include "main.h"
+
+void log_callback(alpm_loglevel_t level, const char* fmt, va_list args) __attribute__((format(printf, 2, 0)));
+int log_mask_from_ruby(VALUE level);
+void log_configure(VALUE receiver, int mask, int batch);
+void flush_log(int can_raise);
+void Init_log();
+
+#endif
@@ -1,7 +1,20 @@
+#include <time.h>
+#include <ruby/util.h>
 #include "main.h"
+#include "pool.h"
+#include "list.h"
 #include "package.h"
 #include "transaction.h"
 #include "database.h"
+#include "log.h"
+#include "download.h"
+#include "depgraph.h"
+#include "version.h"
+#include "outdated.h"
+#include "flags.h"
+#include "file_index.h"
+#include "snapshot.h"
+#include "posix_re.h"
 
 /***************************************
  * Variables, etc
@@ -10,6 +23,26 @@
 VALUE rb_cAlpm;
 VALUE rb_eAlpm_Error;
 
+/* Whether the current thread holds the GVL. libalpm calls our
+ * callbacks from whatever thread it runs in, so they need to know
+ * whether they may touch Ruby objects directly. */
+static __thread enum gvl_state current_gvl_state = GVL_HELD;
+
+/* Ruby thread-local holding an exception raised by a Ruby callback
+ * until it can be re-raised, see protect_callback(). */
+static ID s_id_callback_error;
+
+/* Hidden instance variable of an Alpm instance holding the Mutex
+ * taken by lock_handle(), and the number of handles locked right
+ * now, so that wait_for_handle() costs nothing most of the time. */
+static ID s_id_handle_lock;
+static ID s_id_owned_p;
+static int s_locked_handles = 0;
+
+/* Hidden instance variable of an Alpm instance counting how often
+ * libalpm threw away packages, see handle_generation(). */
+static ID s_id_generation;
+
 /** Raises the last libalpm error as a Ruby exception of
  * class Alpm::AlpmError. */
 VALUE raise_last_alpm_error(alpm_handle_t* p_handle)
@@ -19,77 +52,284 @@ VALUE raise_last_alpm_error(alpm_handle_t* p_handle)
   return Qnil;
 }
 
+/** Converts a C string from libalpm into a frozen, UTF-8 encoded
+ * Ruby string. Equal strings are deduplicated by Ruby, so this is
+ * cheap for strings that occur often, like package names. Returns
+ * +nil+ if `str' is NULL. */
+VALUE frozen_utf8_str(const char* str)
+{
+  if (!str)
+    return Qnil;
+
+#ifdef HAVE_RB_ENC_INTERNED_STR
+  return rb_enc_interned_str(str, strlen(str), rb_utf8_encoding());
+#else
+  return rb_obj_freeze(rb_enc_str_new(str, strlen(str), rb_utf8_encoding()));
+#endif
+}
+
 /** Takes a Ruby array of Ruby Symbols and computes the C
  * alpm_siglevel_t from it. Raises an exception if `ary'
- * doesn’t respond to #to_ary. */
+ * doesn’t respond to #to_ary or contains an unknown Symbol. */
 alpm_siglevel_t siglevel_from_ruby(VALUE ary)
 {
-  alpm_siglevel_t level = 0;
+  return (alpm_siglevel_t) flags_from_ary(&siglevel_flags, ary);
+}
 
-  if (!(RTEST(ary = rb_check_array_type(ary)))) { /*  Single = intended */
-    VALUE str = rb_inspect(level);
-    rb_raise(rb_eTypeError, "Not an array (#to_ary): %s", StringValuePtr(str));
-    return Qnil;
-  }
+/** Returns the time in seconds on a monotonic clock, as used for the
+ * timestamps of transaction events and download progress. */
+double now(void)
+{
+  struct timespec ts;
 
-  if (rb_ary_includes(ary, STR2SYM("package")))
-    level |= ALPM_SIG_PACKAGE;
-  if (rb_ary_includes(ary, STR2SYM("package_optional")))
-    level |= ALPM_SIG_PACKAGE_OPTIONAL;
-  if (rb_ary_includes(ary, STR2SYM("package_marginal_ok")))
-    level |= ALPM_SIG_PACKAGE_MARGINAL_OK;
-  if (rb_ary_includes(ary, STR2SYM("package_unknown_ok")))
-    level |= ALPM_SIG_PACKAGE_UNKNOWN_OK;
-  if (rb_ary_includes(ary, STR2SYM("database")))
-    level |= ALPM_SIG_DATABASE;
-  if (rb_ary_includes(ary, STR2SYM("database_optional")))
-    level |= ALPM_SIG_DATABASE_OPTIONAL;
-  if (rb_ary_includes(ary, STR2SYM("database_marginal_ok")))
-    level |= ALPM_SIG_DATABASE_MARGINAL_OK;
-  if (rb_ary_includes(ary, STR2SYM("database_unknown_ok")))
-    level |= ALPM_SIG_DATABASE_UNKNOWN_OK;
-  if (rb_ary_includes(ary, STR2SYM("package_set")))
-    level |= ALPM_SIG_PACKAGE_SET;
-  if (rb_ary_includes(ary, STR2SYM("package_trust_set")))
-    level |= ALPM_SIG_PACKAGE_TRUST_SET;
-  if (rb_ary_includes(ary, STR2SYM("use_default")))
-    level |= ALPM_SIG_USE_DEFAULT;
-
-  return level;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-/** Frees an alpm package loaded via alpm_pkg_load().
- * This is the only case where we have to keep track
- * of package memory. */
-static void free_loaded_pkg(void* ptr)
+/* Trampoline for call_without_gvl() that marks the current thread
+ * as not holding the GVL while `func' runs. */
+static void* released_gvl(void* ptr)
 {
-  alpm_pkg_t* p_pkg = (alpm_pkg_t*) ptr;
-  alpm_pkg_free(p_pkg);
+  void** args = (void**) ptr;
+  void* (*func)(void*) = (void* (*)(void*)) args[0];
+  void* result;
+
+  current_gvl_state = GVL_RELEASED;
+  result = func(args[1]);
+  current_gvl_state = GVL_HELD;
+
+  return result;
 }
 
-void log_callback(alpm_loglevel_t level, const char* msg, ...)
+/** Runs `func' with `data' while not holding the GVL, so that other
+ * Ruby threads can continue while libalpm does its work. `ubf' is
+ * called with `ubf_data' if Ruby wants to interrupt the thread
+ * (e.g. Thread#raise); it may be NULL. Returns what `func' returns,
+ * or NULL if an interrupt was already pending and `func' didn’t run
+ * at all. Log messages collected meanwhile are delivered afterwards.
+ * Interrupts are not processed here, so the caller must call
+ * raise_pending_errors() once it has tidied up. */
+void* call_without_gvl(void* (*func)(void*), void* data, rb_unblock_function_t* ubf, void* ubf_data)
 {
-  VALUE levelsym;
+  void* args[2];
+  void* result;
+
+  args[0] = (void*) func;
+  args[1] = data;
+  result = rb_thread_call_without_gvl2(released_gvl, args, ubf, ubf_data);
 
-  switch(level){
-  case ALPM_LOG_ERROR:
-    levelsym = ID2SYM(rb_intern("error"));
-    break;
-  case ALPM_LOG_WARNING:
-    levelsym = ID2SYM(rb_intern("warning"));
-    break;
-  case ALPM_LOG_DEBUG:
-    levelsym = ID2SYM(rb_intern("debug"));
-    break;
-  case ALPM_LOG_FUNCTION:
-    levelsym = ID2SYM(rb_intern("function"));
-    break;
+  flush_log(0);
+  return result;
+}
+
+/* Trampoline for call_with_gvl() that resets our marker while Ruby
+ * code is running. */
+static void* reacquired_gvl(void* ptr)
+{
+  void** args = (void**) ptr;
+  void* (*func)(void*) = (void* (*)(void*)) args[0];
+  void* result;
+
+  current_gvl_state = GVL_HELD;
+  result = func(args[1]);
+  current_gvl_state = GVL_RELEASED;
+
+  return result;
+}
+
+/** Runs `func' with `data' while holding the GVL. Callbacks invoked
+ * by libalpm use this to call into Ruby: if the current thread gave
+ * up the GVL with call_without_gvl(), it is reacquired for the
+ * duration of `func', otherwise `func' is called directly. Native
+ * worker threads can’t enter Ruby at all; there, `func' is not
+ * called and NULL is returned. */
+void* call_with_gvl(void* (*func)(void*), void* data)
+{
+  void* args[2];
+
+  switch(current_gvl_state) {
+  case GVL_HELD:
+    return func(data);
+  case GVL_RELEASED:
+    args[0] = (void*) func;
+    args[1] = data;
+    return rb_thread_call_with_gvl(reacquired_gvl, args);
   default:
-    rb_warn("[ruby-alpm] Ignoring unknown logging level '%d' (message: %s)", level, msg);
+    return NULL;
+  }
+}
+
+/** What the current thread may do with Ruby objects. */
+enum gvl_state gvl_state(void)
+{
+  return current_gvl_state;
+}
+
+/** Marks the current thread as a native thread that is not known
+ * to Ruby. Called by the worker threads in pool.c. */
+void mark_native_thread(void)
+{
+  current_gvl_state = GVL_NEVER;
+}
+
+/* The jump tags of rb_protect() this needs to tell apart, from
+ * Ruby’s vm_core.h. */
+#define TAG_RAISE 0x6
+#define TAG_FATAL 0x8
+
+/** Calls `func' with `arg' on behalf of a libalpm callback; the
+ * GVL must be held. An exception or other non-local exit (throw,
+ * break, Thread#kill) must not unwind through libalpm, so it is
+ * caught and kept for the current Ruby thread together with its
+ * jump tag until the next raise_callback_error(). Only the first
+ * one is kept. Once a non-local exit other than an exception is
+ * pending, no more callbacks run on the thread: Ruby still needs
+ * its errinfo to resume it. */
+VALUE protect_callback(VALUE (*func)(VALUE), VALUE arg)
+{
+  VALUE thread = rb_thread_current();
+  VALUE pending = rb_thread_local_aref(thread, s_id_callback_error);
+  VALUE result;
+  int state = 0;
+
+  if (!NIL_P(pending) && FIX2INT(RARRAY_AREF(pending, 0)) != TAG_RAISE)
+    return Qnil;
+
+  result = rb_protect(func, arg, &state);
+  if (!state)
+    return result;
+
+  if (NIL_P(pending))
+    rb_thread_local_aset(thread, s_id_callback_error, rb_assoc_new(INT2FIX(state), rb_errinfo()));
+  if (state == TAG_RAISE)
+    rb_set_errinfo(Qnil);
+
+  return Qnil;
+}
+
+/* Resumes the non-local exit `pending' kept by protect_callback(),
+ * an array of its jump tag and errinfo: re-raises an exception,
+ * otherwise jumps with the tag. If other code changed errinfo
+ * meanwhile, a Thread#kill is issued anew and anything else is
+ * reported as a LocalJumpError rather than jumping blindly. */
+static void resume_callback_error(VALUE pending)
+{
+  int state = FIX2INT(RARRAY_AREF(pending, 0));
+  VALUE error = RARRAY_AREF(pending, 1);
+
+  if (state == TAG_RAISE)
+    rb_exc_raise(error);
+  if (rb_errinfo() == error)
+    rb_jump_tag(state);
+  if (state == TAG_FATAL)
+    rb_thread_kill(rb_thread_current());
+
+  rb_raise(rb_eLocalJumpError, "Non-local exit out of a libalpm callback got lost.");
+}
+
+/** Resumes the exception or other non-local exit kept by
+ * protect_callback(), if any. Call once libalpm has returned. */
+void raise_callback_error(void)
+{
+  VALUE thread = rb_thread_current();
+  VALUE pending = rb_thread_local_aref(thread, s_id_callback_error);
+
+  if (NIL_P(pending))
     return;
+
+  rb_thread_local_aset(thread, s_id_callback_error, Qnil);
+  resume_callback_error(pending);
+}
+
+/** Raises what came up while call_without_gvl() ran: first an
+ * interrupt of the Ruby thread (Thread#raise, Timeout, Thread#kill,
+ * a signal), then what protect_callback() kept. If both are
+ * pending, the interrupt wins. Call once the caller has tidied up
+ * after libalpm. */
+void raise_pending_errors(void)
+{
+  VALUE thread = rb_thread_current();
+  VALUE pending = rb_thread_local_aref(thread, s_id_callback_error);
+
+  rb_thread_local_aset(thread, s_id_callback_error, Qnil);
+  rb_thread_check_ints();
+
+  if (!NIL_P(pending))
+    resume_callback_error(pending);
+}
+
+/** Takes the lock of the Alpm instance `rb_alpm' before libalpm is
+ * run on its handle without the GVL, waiting for another thread
+ * holding it. libalpm isn’t thread-safe, and while the lock is held,
+ * wait_for_handle() keeps other Ruby threads from calling into it
+ * with the same handle. Must be paired with unlock_handle(). */
+void lock_handle(VALUE rb_alpm)
+{
+  VALUE lock = rb_attr_get(rb_alpm, s_id_handle_lock);
+
+  if (NIL_P(lock)) {
+    lock = rb_mutex_new();
+    rb_ivar_set(rb_alpm, s_id_handle_lock, lock);
   }
 
-  // TODO
+  rb_mutex_lock(lock);
+  s_locked_handles++;
+}
+
+/** Releases the lock taken by lock_handle(). Returns Qnil, so it can
+ * be an rb_ensure() ensure function. */
+VALUE unlock_handle(VALUE rb_alpm)
+{
+  s_locked_handles--;
+  rb_mutex_unlock(rb_attr_get(rb_alpm, s_id_handle_lock));
+  return Qnil;
+}
+
+/** Waits until no other Ruby thread holds the lock of the Alpm
+ * instance `rb_alpm' (may be nil), see lock_handle(). Call before
+ * using libalpm with the GVL held where another thread may be
+ * running it without. The thread holding the lock passes: it only
+ * gets here from Ruby callbacks, which libalpm waits for, save for
+ * the log callback during Database#prefetch. */
+void wait_for_handle(VALUE rb_alpm)
+{
+  VALUE lock;
+
+  if (s_locked_handles == 0 || NIL_P(rb_alpm))
+    return;
+
+  lock = rb_attr_get(rb_alpm, s_id_handle_lock);
+  if (NIL_P(lock) || !RTEST(rb_mutex_locked_p(lock)) || RTEST(rb_funcall(lock, s_id_owned_p, 0)))
+    return;
+
+  rb_mutex_lock(lock);
+  rb_mutex_unlock(lock);
+}
+
+/** Returns how often libalpm threw away packages of a database of
+ * the Alpm instance `rb_alpm' so far, see handle_changed(). Objects
+ * keeping alpm_pkg_t pointers remember it to tell whether these
+ * are still valid. */
+unsigned long handle_generation(VALUE rb_alpm)
+{
+  VALUE generation = rb_attr_get(rb_alpm, s_id_generation);
+  return NIL_P(generation) ? 0 : NUM2ULONG(generation);
+}
+
+/** Tells that libalpm threw away packages of a database of the Alpm
+ * instance `rb_alpm'. Runs no Ruby code. */
+void handle_changed(VALUE rb_alpm)
+{
+  rb_ivar_set(rb_alpm, s_id_generation, ULONG2NUM(handle_generation(rb_alpm) + 1));
+}
+
+/** Frees an alpm package loaded via alpm_pkg_load().
+ * This is the only case where we have to keep track
+ * of package memory. */
+static void free_loaded_pkg(void* ptr)
+{
+  alpm_pkg_t* p_pkg = (alpm_pkg_t*) ptr;
+  alpm_pkg_free(p_pkg);
 }
 
 /***************************************
@@ -135,6 +375,10 @@ static VALUE initialize(VALUE self, VALUE root, VALUE dbpath)
     rb_raise(rb_eRuntimeError, "Initializing alpm library failed: %s", alpm_strerror(err));
 
   DATA_PTR(self) = p_alpm;
+
+  /* Cache of Database instances, see wrap_database() */
+  rb_iv_set(self, "databases", rb_hash_new());
+
   return self;
 }
 
@@ -191,23 +435,147 @@ static VALUE dbpath(VALUE self)
 
 /**
  * call-seq:
- *   log(){|level, message|...}
+ *   log( [ level: :warning ] [, batch: false ] ){|level, message|...}
+ *   log( [ level: :warning ] , batch: true ){|messages|...}
+ *   log( [ level: :warning ] , queue: a_queue )
+ *   log()
  *
  * Defines a callback to use when something needs to be logged.
+ * Messages below the given level are discarded right away, before
+ * any Ruby object is created for them. The others are collected and
+ * handed to Ruby in batches of up to 64, at the latest when the
+ * method of Alpm, Database or Transaction that produced them
+ * returns; an exception raised by the callback is raised from that
+ * method. Messages from libalpm reading package details lazily
+ * within a Package accessor wait for the next such method. Call
+ * #flush_log to deliver the pending messages right away.
+ *
+ * libalpm’s log callback doesn’t know which Alpm instance it belongs
+ * to, so the last callback defined receives the messages of all
+ * instances. Calling this method without a block or queue turns
+ * logging off.
  *
  * == Parameters
- * [level]
- *   Log level. One of :function, :debug, :warning, :error.
- * [message]
- *   The message to log.
+ * [level (:warning)]
+ *   The lowest log level to receive. One of :function, :debug,
+ *   :warning, :error, in ascending order of severity.
+ * [batch (false)]
+ *   If set, the block is called once per batch with an array of
+ *   <tt>[level, message]</tt> pairs instead of once per message.
+ * [queue]
+ *   Instead of calling a block, push each batch (an array of
+ *   <tt>[level, message]</tt> pairs) onto this Thread::Queue, so
+ *   that another thread can process them.
+ * [level (Block)]
+ *   Log level of the message, see above.
+ * [message (Block)]
+ *   The message to log, without a trailing newline.
  */
-static VALUE set_logcb(VALUE self)
+static VALUE set_logcb(int argc, VALUE argv[], VALUE self)
 {
   alpm_handle_t* p_alpm = NULL;
+  VALUE opts;
+  VALUE kwvals[3] = {Qundef, Qundef, Qundef};
+  ID kwnames[3];
+  VALUE receiver = Qnil;
+  int batch = 0;
+  int mask;
+
   Data_Get_Struct(self, alpm_handle_t, p_alpm);
+  rb_scan_args(argc, argv, "0:", &opts);
+
+  kwnames[0] = rb_intern("level");
+  kwnames[1] = rb_intern("batch");
+  kwnames[2] = rb_intern("queue");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, kwnames, 0, 3, kwvals);
+
+  mask = log_mask_from_ruby(kwvals[0] == Qundef ? STR2SYM("warning") : kwvals[0]);
+
+  if (kwvals[2] != Qundef && !NIL_P(kwvals[2])) {
+    receiver = kwvals[2];
+    batch = 1;
+  }
+  else if (rb_block_given_p()) {
+    receiver = rb_block_proc();
+    batch = kwvals[1] != Qundef && RTEST(kwvals[1]);
+  }
 
-  rb_iv_set(self, "logcb", rb_block_proc());
-  alpm_option_set_logcb(p_alpm, log_callback);
+  log_configure(receiver, mask, batch);
+  alpm_option_set_logcb(p_alpm, NIL_P(receiver) ? NULL : log_callback);
+
+  return Qnil;
+}
+
+/**
+ * call-seq:
+ *   flush_log()
+ *
+ * Delivers all log messages collected so far to the callback
+ * defined with #log.
+ */
+static VALUE rbflush_log(VALUE self)
+{
+  flush_log(1);
+  return Qnil;
+}
+
+/**
+ * call-seq:
+ *   download_progress( [ per_second: 4 ] ){|filename, transferred, total, rate|...}
+ *   download_progress()
+ *
+ * Defines a callback that reports the progress of downloads, i.e.
+ * of Database#update, #update_sync_dbs and transactions fetching
+ * packages. libalpm reports every chunk received; these reports are
+ * aggregated per file, and the block is only called for the first
+ * and the last one of each file and otherwise at most +per_second+
+ * times a second per file.
+ *
+ * As with #log, the last callback defined receives the downloads of
+ * all Alpm instances. Calling this method without a block turns
+ * the reports off.
+ *
+ * === Parameters
+ * [per_second (4)]
+ *   Maximum number of reports per file and second.
+ * [filename (Block)]
+ *   Name of the file being downloaded.
+ * [transferred (Block)]
+ *   Number of bytes received so far.
+ * [total (Block)]
+ *   Size of the file in bytes, or +nil+ if not known yet.
+ * [rate (Block)]
+ *   Bytes per second received since the previous report of this
+ *   file, 0.0 on the first report.
+ */
+static VALUE set_dlcb(int argc, VALUE argv[], VALUE self)
+{
+  alpm_handle_t* p_alpm = NULL;
+  VALUE opts;
+  VALUE kwval = Qundef;
+  ID kwname;
+  VALUE receiver = Qnil;
+  double per_second = 4.0;
+
+  Data_Get_Struct(self, alpm_handle_t, p_alpm);
+  rb_scan_args(argc, argv, "0:", &opts);
+
+  kwname = rb_intern("per_second");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, &kwname, 0, 1, &kwval);
+
+  if (kwval != Qundef) {
+    per_second = NUM2DBL(kwval);
+    if (!(per_second > 0.0))
+      rb_raise(rb_eArgError, "per_second must be positive.");
+  }
+
+  if (rb_block_given_p())
+    receiver = rb_block_proc();
+
+  download_configure(receiver, per_second);
+  alpm_option_set_dlcb(p_alpm, NIL_P(receiver) ? NULL : download_callback);
 
   return Qnil;
 }
@@ -241,6 +609,22 @@ static VALUE set_gpgdir(VALUE self, VALUE gpgdir)
   return gpgdir;
 }
 
+/**
+ * call-seq:
+ *   siglevel() → an_array
+ *
+ * Returns the default signature level, used where the +siglevel+
+ * given to e.g. #register_syncdb contains +:use_default+, as an
+ * array of the same Symbols accepted there.
+ */
+static VALUE get_siglevel(VALUE self)
+{
+  alpm_handle_t* p_alpm = NULL;
+  Data_Get_Struct(self, alpm_handle_t, p_alpm);
+
+  return flags_to_ary(&siglevel_flags, alpm_option_get_default_siglevel(p_alpm));
+}
+
 /**
  * call-seq:
  *   arch() → a_symbol
@@ -276,6 +660,24 @@ static VALUE set_arch(VALUE self, VALUE arch)
   return arch;
 }
 
+/* Arguments for and result of release_transaction(). */
+struct release_args {
+  VALUE rb_alpm;
+  alpm_handle_t* p_alpm;
+  int result;
+};
+
+/* Ends the transaction started by transaction(). */
+static VALUE release_transaction(VALUE ptr)
+{
+  struct release_args* p_args = (struct release_args*) ptr;
+
+  transaction_events_reset(p_args->rb_alpm);
+  p_args->result = alpm_trans_release(p_args->p_alpm);
+
+  return Qnil;
+}
+
 /**
  * call-seq:
  *   transaction( [ flags ] ){|transaction|...} → an_object
@@ -324,6 +726,7 @@ static VALUE set_arch(VALUE self, VALUE arch)
  *     Remove also explicitely installed unneeded deps (use with :recurse).
  *   [:nolock]
  *     Do not lock the database during the operation.
+ *   Other keys raise an ArgumentError. See also Transaction#flags.
  *
  * === Return value
  * The result of the block’s last expression.
@@ -335,6 +738,7 @@ static VALUE set_arch(VALUE self, VALUE arch)
  */
 static VALUE transaction(int argc, VALUE argv[], VALUE self)
 {
+  struct release_args release_args;
   VALUE transaction;
   VALUE result;
   alpm_handle_t* p_alpm = NULL;
@@ -342,47 +746,12 @@ static VALUE transaction(int argc, VALUE argv[], VALUE self)
 
   Data_Get_Struct(self, alpm_handle_t, p_alpm);
 
-  if (argc == 1) {
-    if (TYPE(argv[0]) != T_HASH)
-      rb_raise(rb_eTypeError, "Argument is not a hash.");
-
-    if (rb_hash_aref(flags, STR2SYM("nodeps")))
-      flags |= ALPM_TRANS_FLAG_NODEPS;
-    if (rb_hash_aref(flags, STR2SYM("force")))
-      flags |= ALPM_TRANS_FLAG_FORCE;
-    if (rb_hash_aref(flags, STR2SYM("nosave")))
-      flags |= ALPM_TRANS_FLAG_NOSAVE;
-    if (rb_hash_aref(flags, STR2SYM("nodepversion")))
-      flags |= ALPM_TRANS_FLAG_NODEPVERSION;
-    if (rb_hash_aref(flags, STR2SYM("cascade")))
-      flags |= ALPM_TRANS_FLAG_CASCADE;
-    if (rb_hash_aref(flags, STR2SYM("recurse")))
-      flags |= ALPM_TRANS_FLAG_RECURSE;
-    if (rb_hash_aref(flags, STR2SYM("dbonly")))
-      flags |= ALPM_TRANS_FLAG_DBONLY;
-    if (rb_hash_aref(flags, STR2SYM("alldeps")))
-      flags |= ALPM_TRANS_FLAG_ALLDEPS;
-    if (rb_hash_aref(flags, STR2SYM("downloadonly")))
-      flags |= ALPM_TRANS_FLAG_DOWNLOADONLY;
-    if (rb_hash_aref(flags, STR2SYM("noscriptlet")))
-      flags |= ALPM_TRANS_FLAG_NOSCRIPTLET;
-    if (rb_hash_aref(flags, STR2SYM("noconflicts")))
-      flags |= ALPM_TRANS_FLAG_NOCONFLICTS;
-    if (rb_hash_aref(flags, STR2SYM("needed")))
-      flags |= ALPM_TRANS_FLAG_NEEDED;
-    if (rb_hash_aref(flags, STR2SYM("allexplicit")))
-      flags |= ALPM_TRANS_FLAG_ALLEXPLICIT;
-    if (rb_hash_aref(flags, STR2SYM("unneeded")))
-      flags |= ALPM_TRANS_FLAG_UNNEEDED;
-    if (rb_hash_aref(flags, STR2SYM("recurseall")))
-      flags |= ALPM_TRANS_FLAG_RECURSEALL;
-    if (rb_hash_aref(flags, STR2SYM("nolock")))
-      flags |= ALPM_TRANS_FLAG_NOLOCK;
-  }
-  else {
+  if (argc > 1) {
     rb_raise(rb_eArgError, "Wrong number of arguments, expected 0..1, got %d.", argc);
     return Qnil;
   }
+  else if (argc == 1)
+    flags = flags_from_hash(&transaction_flags, argv[0]);
 
   /* Create the transaction */
   if (alpm_trans_init(p_alpm, flags) < 0)
@@ -395,13 +764,19 @@ static VALUE transaction(int argc, VALUE argv[], VALUE self)
    * transaction. */
   transaction = rb_obj_alloc(rb_cAlpm_Transaction);
   rb_iv_set(transaction, "@alpm", self);
-  result = rb_yield(transaction);
 
-  /* When we get here we assume the user is done with
-   * his stuff. Clean up. */
-  if (alpm_trans_release(p_alpm) < 0)
+  /* When the block ends, even by an exception, we assume the
+   * user is done with his stuff. Clean up. */
+  release_args.rb_alpm = self;
+  release_args.p_alpm = p_alpm;
+  release_args.result = 0;
+  result = rb_ensure(rb_yield, transaction, release_transaction, (VALUE) &release_args);
+
+  if (release_args.result < 0)
     return raise_last_alpm_error(p_alpm);
 
+  flush_log(1);
+
   /* Return the last value from the block */
   return result;
 }
@@ -417,7 +792,6 @@ static VALUE local_db(VALUE self)
 {
   alpm_handle_t* p_alpm = NULL;
   alpm_db_t* p_db = NULL;
-  VALUE obj;
   Data_Get_Struct(self, alpm_handle_t, p_alpm);
 
   p_db = alpm_get_localdb(p_alpm);
@@ -426,9 +800,7 @@ static VALUE local_db(VALUE self)
     return Qnil;
   }
 
-  obj = Data_Wrap_Struct(rb_cAlpm_Database, NULL, NULL, p_db);
-  rb_iv_set(obj, "@alpm", self);
-  return obj;
+  return wrap_database(self, p_db);
 }
 
 /**
@@ -443,11 +815,8 @@ static VALUE sync_dbs(VALUE self)
 {
   alpm_handle_t* p_alpm = NULL;
   alpm_list_t* p_dbs = NULL;
-  VALUE result;
-  unsigned int i;
   Data_Get_Struct(self, alpm_handle_t, p_alpm);
 
-
   /* Get the list of all DBs */
   p_dbs = alpm_get_syncdbs(p_alpm);
   if (!p_dbs) {
@@ -456,17 +825,311 @@ static VALUE sync_dbs(VALUE self)
   }
 
   /* Transform them into a Ruby array of Database instances */
+  return list_to_ary(p_dbs, list_conv_database, self);
+}
+
+/* Arguments for and results of update_sync_dbs_without_gvl(). */
+struct update_sync_dbs_args {
+  alpm_handle_t* p_alpm;
+  alpm_list_t* p_dbs;
+  int force;
+  int* p_results;
+  alpm_errno_t* p_errors;
+  size_t done; /* Number of databases refreshed or failed */
+  volatile int interrupted;
+};
+
+static void* update_sync_dbs_without_gvl(void* ptr)
+{
+  struct update_sync_dbs_args* p_args = (struct update_sync_dbs_args*) ptr;
+  alpm_list_t* item = NULL;
+  int i = 0;
+
+  for(item = p_args->p_dbs; item && !p_args->interrupted; item = alpm_list_next(item), i++) {
+    p_args->p_results[i] = alpm_db_update(p_args->force, item->data);
+    if (p_args->p_results[i] < 0)
+      p_args->p_errors[i] = alpm_errno(p_args->p_alpm);
+    p_args->done++;
+  }
+
+  return NULL;
+}
+
+/* Unblocking function for update_sync_dbs_without_gvl(). Makes
+ * it stop before the next database. */
+static void update_sync_dbs_ubf(void* ptr)
+{
+  struct update_sync_dbs_args* p_args = (struct update_sync_dbs_args*) ptr;
+  p_args->interrupted = 1;
+}
+
+/**
+ * call-seq:
+ *   update_sync_dbs( [ force ] ) → a_hash
+ *
+ * Synchronises all databases registered with #register_syncdb
+ * with their remote servers. All of them are refreshed in a single
+ * run without holding Ruby’s global VM lock, and an error on one
+ * database doesn’t prevent the others from being refreshed.
+ *
+ * Note that libalpm serialises database refreshes on a handle (they
+ * share the download handle and the database lock), hence the
+ * databases are refreshed one after another.
+ *
+ * === Parameters
+ * [force (false)]
+ *   Download the databases even if they are up to date.
+ *
+ * === Return value
+ * A hash mapping the name of each sync database to +:updated+,
+ * +:up_to_date+, or the Alpm::AlpmError that occurred when refreshing
+ * it. Databases not refreshed because the run was interrupted (e.g.
+ * by a signal handled with Signal.trap) are mapped to +:skipped+.
+ */
+static VALUE update_sync_dbs(int argc, VALUE argv[], VALUE self)
+{
+  struct update_sync_dbs_args args;
+  alpm_list_t* item = NULL;
+  VALUE force;
+  VALUE result;
+  VALUE tmp1, tmp2;
+  size_t count;
+  size_t i;
+
+  Data_Get_Struct(self, alpm_handle_t, args.p_alpm);
+  rb_scan_args(argc, argv, "01", &force);
+
+  args.p_dbs = alpm_get_syncdbs(args.p_alpm);
+  args.force = RTEST(force) ? 1 : 0;
+  args.interrupted = 0;
+  args.done = 0;
+
+  count = alpm_list_count(args.p_dbs);
+  args.p_results = ALLOCV_N(int, tmp1, count);
+  args.p_errors = ALLOCV_N(alpm_errno_t, tmp2, count);
+  MEMZERO(args.p_results, int, count);
+  MEMZERO(args.p_errors, alpm_errno_t, count);
+
+  /* call_without_gvl() doesn’t raise, so no rb_ensure() needed */
+  lock_handle(self);
+  call_without_gvl(update_sync_dbs_without_gvl, &args, update_sync_dbs_ubf, &args);
+  unlock_handle(self);
+
+  /* libalpm threw away the old packages of the updated databases */
+  for(item = args.p_dbs, i = 0; item && i < args.done; item = alpm_list_next(item), i++) {
+    if (args.p_results[i] == 0)
+      database_changed(self, item->data);
+  }
+
+  result = rb_hash_new();
+  for(item = args.p_dbs, i = 0; item; item = alpm_list_next(item), i++) {
+    VALUE status;
+
+    if (i >= args.done)
+      status = STR2SYM("skipped");
+    else if (args.p_results[i] == 0)
+      status = STR2SYM("updated");
+    else if (args.p_results[i] > 0)
+      status = STR2SYM("up_to_date");
+    else
+      status = rb_exc_new2(rb_eAlpm_Error, alpm_strerror(args.p_errors[i]));
+
+    rb_hash_aset(result, rb_str_new2(alpm_db_get_name(item->data)), status);
+  }
+
+  ALLOCV_END(tmp1);
+  ALLOCV_END(tmp2);
+  raise_pending_errors();
+  return result;
+}
+
+/* State shared by search_all() and its worker jobs. */
+struct search_all_args {
+  VALUE self;
+  VALUE dbs;
+  VALUE terms;
+  int unique;
+  int locked;
+  size_t ndbs;
+  alpm_db_t** p_dbs;
+  alpm_list_t** p_results;
+  alpm_list_t* targets;
+};
+
+/* Worker job for search_all(): searches the database at `index'. */
+static void search_all_job(void* ptr, size_t index)
+{
+  struct search_all_args* p_args = (struct search_all_args*) ptr;
+  p_args->p_results[index] = alpm_db_search(p_args->p_dbs[index], p_args->targets);
+}
+
+/* rb_ensure() body for search_all(). */
+static VALUE search_all_body(VALUE ptr)
+{
+  struct search_all_args* p_args = (struct search_all_args*) ptr;
+  alpm_list_t* item = NULL;
+  VALUE result;
+  VALUE seen = Qnil;
+  size_t ndbs = 0;
+  size_t i, k;
+
+  lock_handle(p_args->self);
+  p_args->locked = 1;
+
+  p_args->p_dbs = ALLOC_N(alpm_db_t*, p_args->ndbs);
+  p_args->p_results = ALLOC_N(alpm_list_t*, p_args->ndbs);
+  MEMZERO(p_args->p_results, alpm_list_t*, p_args->ndbs);
+
+  for(i=0; i < p_args->ndbs; i++) {
+    VALUE db = rb_ary_entry(p_args->dbs, i);
+    alpm_db_t* p_db = NULL;
+
+    if (!RTEST(rb_obj_is_kind_of(db, rb_cAlpm_Database)))
+      rb_raise(rb_eTypeError, "Not a database: %s", RSTRING_PTR(rb_inspect(db)));
+    /* Its packages would be wrapped and cached for the wrong handle */
+    if (rb_iv_get(db, "@alpm") != p_args->self)
+      rb_raise(rb_eArgError, "Database of another Alpm instance: %s", RSTRING_PTR(rb_inspect(db)));
+
+    Data_Get_Struct(db, alpm_db_t, p_db);
+    if (!p_db)
+      rb_raise(rb_eAlpm_Error, "Database was unregistered: %s", RSTRING_PTR(rb_inspect(db)));
+
+    /* Two jobs searching the same database would race on it */
+    for(k=0; k < ndbs && p_args->p_dbs[k] != p_db; k++)
+      ;
+    if (k < ndbs)
+      continue;
+
+    /* Load the package cache now rather than concurrently */
+    alpm_db_get_pkgcache(p_db);
+    rb_ary_store(p_args->dbs, ndbs, db);
+    p_args->p_dbs[ndbs++] = p_db;
+  }
+  rb_ary_resize(p_args->dbs, ndbs);
+  p_args->ndbs = ndbs;
+  flush_log(1);
+
+  /* Compile the expressions once up front, so that an invalid one
+   * is reported here instead of the jobs racing on alpm_errno() */
+  for(i=0; i < (size_t) RARRAY_LEN(p_args->terms); i++) {
+    VALUE term = rb_ary_entry(p_args->terms, i);
+    char buf[256] = "out of memory";
+    char* str = ruby_strdup(StringValueCStr(term));
+    posix_re_t* p_re = NULL;
+
+    p_args->targets = alpm_list_add(p_args->targets, str);
+    if (!(p_re = posix_re_compile(str, buf, sizeof(buf)))) /* Single = intended */
+      rb_raise(rb_eArgError, "Invalid regular expression %s: %s", str, buf);
+    posix_re_free(p_re);
+  }
+
+  pool_run(pool_default_threads(), p_args->ndbs, search_all_job, p_args);
+
+  /* Merge in database order */
   result = rb_ary_new();
-  for(i=0; i < alpm_list_count(p_dbs); i++) {
-    VALUE db = Data_Wrap_Struct(rb_cAlpm_Database, NULL, NULL, alpm_list_nth(p_dbs, i));
-    rb_iv_set(db, "@alpm", self);
-    rb_ary_push(result, db);
+  if (p_args->unique)
+    seen = rb_hash_new();
+
+  for(i=0; i < p_args->ndbs; i++) {
+    VALUE db = rb_ary_entry(p_args->dbs, i);
+
+    for(item = p_args->p_results[i]; item; item = alpm_list_next(item)) {
+      if (p_args->unique) {
+        VALUE name = frozen_utf8_str(alpm_pkg_get_name(item->data));
+
+        if (RTEST(rb_hash_lookup(seen, name)))
+          continue;
+        rb_hash_aset(seen, name, Qtrue);
+      }
+
+      rb_ary_push(result, rb_assoc_new(db, wrap_package(p_args->self, item->data)));
+    }
   }
 
-  /* Return that array */
   return result;
 }
 
+/* rb_ensure() ensure for search_all(). */
+static VALUE search_all_ensure(VALUE ptr)
+{
+  struct search_all_args* p_args = (struct search_all_args*) ptr;
+  size_t i;
+
+  if (p_args->p_results) {
+    for(i=0; i < p_args->ndbs; i++)
+      alpm_list_free(p_args->p_results[i]);
+  }
+
+  alpm_list_free_inner(p_args->targets, ruby_xfree);
+  alpm_list_free(p_args->targets);
+  xfree(p_args->p_results);
+  xfree(p_args->p_dbs);
+
+  if (p_args->locked)
+    unlock_handle(p_args->self);
+
+  return Qnil;
+}
+
+/**
+ * call-seq:
+ *   search_all( *queries [, dbs: nil ] [, unique: false ] ) → an_array
+ *
+ * Like Database#search, but searches many databases at once. The
+ * searches run concurrently on native threads without holding
+ * Ruby’s global VM lock.
+ *
+ * === Parameters
+ * [*queries (splat)]
+ *   POSIX regular expressions, see Database#search.
+ * [dbs (nil)]
+ *   An array of the Database instances to search, in order of
+ *   priority. Defaults to #sync_dbs. They must belong to +self+,
+ *   otherwise an ArgumentError is raised. So is one for an invalid
+ *   regular expression. A database given more than once is searched
+ *   once, at its first position.
+ * [unique (false)]
+ *   If set, only the first package of each name is returned, i.e.
+ *   the one from the database with the highest priority.
+ *
+ * === Return value
+ * An array of <tt>[database, package]</tt> pairs, ordered by the
+ * databases’ priority and then by the order of the packages in
+ * their database.
+ */
+static VALUE search_all(int argc, VALUE argv[], VALUE self)
+{
+  struct search_all_args args;
+  VALUE opts;
+  VALUE kwvals[2] = {Qundef, Qundef};
+  ID kwnames[2];
+
+  rb_scan_args(argc, argv, "*:", &args.terms, &opts);
+
+  kwnames[0] = rb_intern("dbs");
+  kwnames[1] = rb_intern("unique");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, kwnames, 0, 2, kwvals);
+
+  if (kwvals[0] == Qundef || NIL_P(kwvals[0])) {
+    alpm_handle_t* p_alpm = NULL;
+    Data_Get_Struct(self, alpm_handle_t, p_alpm);
+    args.dbs = list_to_ary(alpm_get_syncdbs(p_alpm), list_conv_database, self);
+  }
+  else
+    args.dbs = rb_ary_dup(rb_convert_type(kwvals[0], T_ARRAY, "Array", "to_ary"));
+
+  args.self = self;
+  args.unique = (kwvals[1] != Qundef && RTEST(kwvals[1])) ? 1 : 0;
+  args.locked = 0;
+  args.ndbs = RARRAY_LEN(args.dbs);
+  args.p_dbs = NULL;
+  args.p_results = NULL;
+  args.targets = NULL;
+
+  return rb_ensure(RUBY_METHOD_FUNC(search_all_body), (VALUE) &args, RUBY_METHOD_FUNC(search_all_ensure), (VALUE) &args);
+}
+
 /**
  * call-seq:
  *   register_syncdb( reponame , siglevel ) → a_database
@@ -491,6 +1154,7 @@ static VALUE sync_dbs(VALUE self)
  *   * :package_set
  *   * :package_trust_set
  *   * :use_default
+ *   Other values raise an ArgumentError.
  *
  * === Return value
  * The newly created Database instance.
@@ -500,20 +1164,18 @@ static VALUE register_syncdb(VALUE self, VALUE reponame, VALUE ary)
   alpm_handle_t* p_alpm = NULL;
   alpm_siglevel_t level;
   alpm_db_t* p_db = NULL;
-  VALUE obj;
 
   Data_Get_Struct(self, alpm_handle_t, p_alpm);
   level = siglevel_from_ruby(ary);
 
   p_db = alpm_register_syncdb(p_alpm, StringValuePtr(reponame), level);
+  flush_log(1);
   if (!p_db) {
     rb_raise(rb_eAlpm_Error, "Failed to register sync db with libalpm");
     return Qnil;
   }
 
-  obj = Data_Wrap_Struct(rb_cAlpm_Database, NULL, NULL, p_db);
-  rb_iv_set(obj, "@alpm", self);
-  return obj;
+  return wrap_database(self, p_db);
 }
 
 /**
@@ -541,17 +1203,217 @@ static VALUE load_package(int argc, VALUE argv[], VALUE self)
   int full = 0;
   alpm_handle_t* p_alpm = NULL;
   alpm_pkg_t* p_pkg = NULL;
+  VALUE result;
 
   Data_Get_Struct(self, alpm_handle_t, p_alpm);
   rb_scan_args(argc, argv, "21", &rpath, &rlevel, &rfull);
   full = RTEST(rfull) ? 1 : 0;
 
   if (alpm_pkg_load(p_alpm, StringValuePtr(rpath), full, siglevel_from_ruby(rlevel), &p_pkg) < 0) {
-    raise_last_alpm_error(p_alpm);
+    alpm_errno_t err = alpm_errno(p_alpm);
+
+    flush_log(1);
+    rb_raise(rb_eAlpm_Error, "%s", alpm_strerror(err));
     return Qnil;
   }
 
-  return Data_Wrap_Struct(rb_cAlpm_Package, NULL, free_loaded_pkg, p_pkg);
+  result = package_set_alpm(Data_Wrap_Struct(rb_cAlpm_Package, NULL, free_loaded_pkg, p_pkg), self);
+  flush_log(1);
+  return result;
+}
+
+/* State shared by load_packages() and its worker jobs. */
+struct load_packages_args {
+  alpm_handle_t* p_alpm;
+  VALUE self;
+  VALUE paths;
+  VALUE result;
+  alpm_siglevel_t level;
+  int full;
+  unsigned int nthreads;
+  size_t count;
+  char** p_paths;
+  alpm_pkg_t** p_pkgs;
+  alpm_errno_t* p_errors;
+  worker_pool_t pool;
+  int started;
+  int locked;
+};
+
+/* Worker job for load_packages(): loads the package at `index' and
+ * records why it failed, if it did. alpm_errno() is per handle, so
+ * of two files failing at the very same moment, one may get the
+ * other’s reason; both are still reported as failures. Each job
+ * only writes its own slots, and pool_wait() sees them only after
+ * the job finished. */
+static void load_packages_job(void* ptr, size_t index)
+{
+  struct load_packages_args* p_args = (struct load_packages_args*) ptr;
+
+  if (alpm_pkg_load(p_args->p_alpm, p_args->p_paths[index], p_args->full, p_args->level, &p_args->p_pkgs[index]) < 0) {
+    p_args->p_pkgs[index] = NULL;
+    p_args->p_errors[index] = alpm_errno(p_args->p_alpm);
+  }
+}
+
+/* Stores the result for the path at `index' and hands it to the
+ * block, if any: the loaded package, or an AlpmError for the error
+ * its job recorded. */
+static void load_packages_result(struct load_packages_args* p_args, size_t index)
+{
+  VALUE obj;
+
+  if (p_args->p_pkgs[index]) {
+    obj = package_set_alpm(Data_Wrap_Struct(rb_cAlpm_Package, NULL, free_loaded_pkg, p_args->p_pkgs[index]), p_args->self);
+    p_args->p_pkgs[index] = NULL; /* Now owned by the Ruby object */
+  }
+  else {
+    obj = rb_exc_new_str(rb_eAlpm_Error,
+                         rb_sprintf("%s: %s", p_args->p_paths[index], alpm_strerror(p_args->p_errors[index])));
+  }
+
+  rb_ary_store(p_args->result, index, obj);
+  if (rb_block_given_p())
+    rb_yield_values(2, rb_ary_entry(p_args->paths, index), obj);
+}
+
+/* rb_ensure() body for load_packages(). */
+static VALUE load_packages_body(VALUE ptr)
+{
+  struct load_packages_args* p_args = (struct load_packages_args*) ptr;
+  size_t seen = 0;
+  size_t i;
+
+  p_args->p_paths = ALLOC_N(char*, p_args->count);
+  MEMZERO(p_args->p_paths, char*, p_args->count);
+  p_args->p_pkgs = ALLOC_N(alpm_pkg_t*, p_args->count);
+  MEMZERO(p_args->p_pkgs, alpm_pkg_t*, p_args->count);
+  p_args->p_errors = ALLOC_N(alpm_errno_t, p_args->count);
+  MEMZERO(p_args->p_errors, alpm_errno_t, p_args->count);
+
+  for(i=0; i < p_args->count; i++) {
+    VALUE path = rb_ary_entry(p_args->paths, i);
+    p_args->p_paths[i] = ruby_strdup(StringValueCStr(path));
+  }
+
+  lock_handle(p_args->self);
+  p_args->locked = 1;
+
+  p_args->started = 1;
+  pool_start(&p_args->pool, p_args->nthreads, p_args->count, load_packages_job, p_args);
+
+  while (seen < p_args->count) {
+    size_t finished = pool_wait(&p_args->pool, seen);
+
+    for(; seen < finished; seen++)
+      load_packages_result(p_args, p_args->pool.p_order[seen]);
+  }
+
+  return p_args->result;
+}
+
+/* rb_ensure() ensure for load_packages(). Frees everything not
+ * handed over to Ruby. */
+static VALUE load_packages_ensure(VALUE ptr)
+{
+  struct load_packages_args* p_args = (struct load_packages_args*) ptr;
+  size_t i;
+
+  if (p_args->started)
+    pool_stop(&p_args->pool);
+  if (p_args->locked)
+    unlock_handle(p_args->self);
+
+  for(i=0; i < p_args->count; i++) {
+    if (p_args->p_paths && p_args->p_paths[i])
+      xfree(p_args->p_paths[i]);
+    if (p_args->p_pkgs && p_args->p_pkgs[i])
+      alpm_pkg_free(p_args->p_pkgs[i]);
+  }
+
+  xfree(p_args->p_paths);
+  xfree(p_args->p_pkgs);
+  xfree(p_args->p_errors);
+  return Qnil;
+}
+
+/**
+ * call-seq:
+ *   load_packages( paths , siglevel [, full: false ] [, threads: nil ] ) → an_array
+ *   load_packages( paths , siglevel [, full: false ] [, threads: nil ] ){|path, pkg_or_error| ...} → an_array
+ *
+ * Loads many packages from files at once. Like #load_package, but
+ * the files are read and decompressed by a pool of native threads
+ * without holding Ruby’s global VM lock.
+ *
+ * === Parameters
+ * [paths]
+ *   An array of paths to the files to load.
+ * [siglevel]
+ *   The PGP signature level for the packages. See #register_syncdb
+ *   for the possible values in this array. As the PGP library used
+ *   by libalpm isn’t thread-safe, the packages are loaded one after
+ *   another if this requires package signature checks.
+ * [full (false)]
+ *   If unset (the default), stop loading the packages after the
+ *   metadata.
+ * [threads (nil)]
+ *   Number of threads to use. Defaults to the number of CPUs.
+ * [path (Block)]
+ *   If a block is given, it is called as soon as a file has been
+ *   loaded or failed to load (in no particular order) with the
+ *   file’s path... Other files are still being loaded meanwhile, so
+ *   the block must not call methods that run libalpm without the
+ *   GVL themselves, like Database#update; they raise a ThreadError.
+ * [pkg_or_error (Block)]
+ *   ...and the resulting Package, or an Alpm::AlpmError
+ *   instance describing why the file couldn’t be loaded.
+ *
+ * === Return value
+ * An array in the same order as +paths+, containing a Package
+ * for each file that could be loaded and an Alpm::AlpmError
+ * instance for each one that couldn’t.
+ */
+static VALUE load_packages(int argc, VALUE argv[], VALUE self)
+{
+  struct load_packages_args args;
+  VALUE rpaths, rlevel, opts;
+  VALUE kwvals[2] = {Qundef, Qundef};
+  ID kwnames[2];
+  alpm_siglevel_t checklevel;
+
+  Data_Get_Struct(self, alpm_handle_t, args.p_alpm);
+  rb_scan_args(argc, argv, "2:", &rpaths, &rlevel, &opts);
+
+  kwnames[0] = rb_intern("full");
+  kwnames[1] = rb_intern("threads");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, kwnames, 0, 2, kwvals);
+
+  if (!RTEST(rpaths = rb_check_array_type(rpaths))) /* Single = intended */
+    rb_raise(rb_eTypeError, "Argument is not an array (#to_ary)");
+
+  args.self = self;
+  args.paths = rb_ary_dup(rpaths); /* Don’t let the caller modify it meanwhile */
+  args.count = RARRAY_LEN(args.paths);
+  args.result = rb_ary_new2(args.count);
+  args.level = siglevel_from_ruby(rlevel);
+  args.full = (kwvals[0] != Qundef && RTEST(kwvals[0])) ? 1 : 0;
+  args.nthreads = pool_threads_from_ruby(kwvals[1]);
+  args.p_paths = NULL;
+  args.p_pkgs = NULL;
+  args.p_errors = NULL;
+  args.started = 0;
+  args.locked = 0;
+
+  checklevel = args.level & ALPM_SIG_USE_DEFAULT ? alpm_option_get_default_siglevel(args.p_alpm) : args.level;
+  if (checklevel & ALPM_SIG_PACKAGE)
+    args.nthreads = 1;
+
+  if (args.count == 0)
+    return args.result;
+
+  return rb_ensure(RUBY_METHOD_FUNC(load_packages_body), (VALUE) &args, RUBY_METHOD_FUNC(load_packages_ensure), (VALUE) &args);
 }
 
 /**
@@ -586,6 +1448,264 @@ static VALUE rbstrerror(VALUE self, VALUE errcode)
   return rb_str_new2(alpm_strerror(NUM2INT(errcode)));
 }
 
+/**
+ * call-seq:
+ *   dependency_graph( [ dbs ] ) → a_dependency_graph
+ *
+ * Resolves the dependencies, optional dependencies, provisions and
+ * conflicts of all packages in the given databases once and returns
+ * them as an Alpm::DependencyGraph, which answers questions like
+ * “what needs this package, directly or indirectly” without calling
+ * into Ruby per package.
+ *
+ * === Parameters
+ * [dbs]
+ *   An array of Database instances. Defaults to the local database
+ *   followed by all sync databases.
+ *
+ * === Return value
+ * An Alpm::DependencyGraph.
+ */
+static VALUE dependency_graph(int argc, VALUE argv[], VALUE self)
+{
+  alpm_handle_t* p_alpm = NULL;
+  VALUE dbs;
+  VALUE result;
+
+  Data_Get_Struct(self, alpm_handle_t, p_alpm);
+  rb_scan_args(argc, argv, "01", &dbs);
+
+  if (NIL_P(dbs)) {
+    dbs = list_to_ary(alpm_get_syncdbs(p_alpm), list_conv_database, self);
+    rb_ary_unshift(dbs, wrap_database(self, alpm_get_localdb(p_alpm)));
+  }
+  else
+    dbs = rb_ary_dup(rb_convert_type(dbs, T_ARRAY, "Array", "to_ary"));
+
+  wait_for_handle(self);
+  result = depgraph_new(self, dbs);
+  flush_log(1);
+  return result;
+}
+
+/**
+ * call-seq:
+ *   outdated( [ ignore: [] ] ) → an_array
+ *
+ * Finds the installed packages that have a newer version or a
+ * replacement in the sync databases, like <tt>pacman -Qu</tt>.
+ * The +replaces+ of each sync database are hashed in a single
+ * pass, so this takes no more than a few milliseconds even on big
+ * installations.
+ *
+ * As in libalpm’s sysupgrade, the sync databases are probed in
+ * registration order for each installed package, and the first
+ * one that either replaces it or carries a package of the same
+ * name decides: its replacers win over its upgrade, and later
+ * databases aren’t looked at. A +replaces+ entry matches on the
+ * installed package’s name and version only, not on its
+ * provisions. Packages ignored by the handle’s
+ * IgnorePkg/IgnoreGroup settings are skipped.
+ *
+ * === Parameters
+ * [ignore ([])]
+ *   Names of packages to skip, local or sync. May contain
+ *   shell wildcards like IgnorePkg in pacman.conf.
+ *
+ * === Return value
+ * An array of <tt>[local_package, sync_package]</tt> pairs, in
+ * the order of the local database. An installed package with
+ * several replacers in the deciding database appears once for
+ * each of them.
+ */
+static VALUE outdated(int argc, VALUE argv[], VALUE self)
+{
+  VALUE opts;
+  VALUE kwval = Qundef;
+  ID kwname;
+  VALUE result;
+
+  rb_scan_args(argc, argv, "0:", &opts);
+
+  kwname = rb_intern("ignore");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, &kwname, 0, 1, &kwval);
+  if (kwval == Qundef || NIL_P(kwval))
+    kwval = rb_ary_new();
+
+  wait_for_handle(self);
+  result = find_outdated(self, kwval);
+  flush_log(1);
+  return result;
+}
+
+/**
+ * call-seq:
+ *   build_file_index( [ persist: false ] ) → self
+ *
+ * Builds the index answering #owner_of right away, rather than on
+ * its first call. It maps every path in the file lists of the
+ * installed packages to its owners. The index is thrown away when
+ * a transaction changes the local database and rebuilt on demand.
+ *
+ * === Parameters
+ * [persist (false)]
+ *   If true, the index is also written to the file
+ *   <tt>ruby-alpm-files.idx</tt> in the #dbpath, and if that
+ *   file already holds an index for the current state of the local
+ *   database (judged by the modification time of its directory), it
+ *   is read from there instead of reading the file lists of all
+ *   packages. A String gives a different file name to use. Raises
+ *   a SystemCallError if the file can’t be written.
+ */
+static VALUE build_file_index(int argc, VALUE argv[], VALUE self)
+{
+  alpm_handle_t* p_alpm = NULL;
+  VALUE opts;
+  VALUE kwval = Qundef;
+  ID kwname;
+  VALUE path = Qnil;
+
+  Data_Get_Struct(self, alpm_handle_t, p_alpm);
+  rb_scan_args(argc, argv, "0:", &opts);
+
+  kwname = rb_intern("persist");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, &kwname, 0, 1, &kwval);
+
+  if (kwval == Qtrue) {
+    const char* dbpath = alpm_option_get_dbpath(p_alpm);
+    size_t len = strlen(dbpath);
+    path = rb_sprintf("%s%sruby-alpm-files.idx", dbpath, (len && dbpath[len - 1] == '/') ? "" : "/");
+  }
+  else if (kwval != Qundef && RTEST(kwval))
+    path = rb_str_dup(StringValue(kwval));
+
+  file_index_of_db(wrap_database(self, alpm_get_localdb(p_alpm)), NIL_P(path) ? NULL : StringValueCStr(path));
+  flush_log(1);
+  return self;
+}
+
+/**
+ * call-seq:
+ *   owner_of( path [, prefix: false ] ) → an_array
+ *   owner_of( paths [, prefix: false ] ) → a_hash
+ *
+ * Finds the installed packages owning files, like
+ * <tt>pacman -Qo</tt>. Each lookup is a single hash table probe (or
+ * a binary search with +prefix+) in an index of all installed files,
+ * which is built on the first call, see #build_file_index.
+ *
+ * === Parameters
+ * [path]
+ *   An absolute path below the #root, or one relative to it.
+ *   Directories may be given with or without a trailing slash.
+ *   Symlinks are not resolved.
+ * [paths]
+ *   An array of such paths.
+ * [prefix (false)]
+ *   If true, treat the paths as directories and find the packages
+ *   owning anything below them instead.
+ *
+ * === Return value
+ * An array of the Package instances owning +path+, empty if it
+ * isn’t owned by any. For +paths+, a hash mapping each of them to
+ * such an array.
+ */
+static VALUE owner_of(int argc, VALUE argv[], VALUE self)
+{
+  alpm_handle_t* p_alpm = NULL;
+  VALUE paths, opts;
+  VALUE kwval = Qundef;
+  ID kwname;
+  VALUE index;
+  VALUE ary;
+  VALUE result;
+  const char* root;
+  int prefix;
+  long i;
+
+  Data_Get_Struct(self, alpm_handle_t, p_alpm);
+  rb_scan_args(argc, argv, "1:", &paths, &opts);
+
+  kwname = rb_intern("prefix");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, &kwname, 0, 1, &kwval);
+  prefix = kwval != Qundef && RTEST(kwval);
+
+  index = file_index_of_db(wrap_database(self, alpm_get_localdb(p_alpm)), NULL);
+  root = alpm_option_get_root(p_alpm);
+  flush_log(1);
+
+  if (RB_TYPE_P(paths, T_STRING))
+    return file_index_owners(index, self, root, StringValueCStr(paths), prefix);
+
+  ary = rb_convert_type(paths, T_ARRAY, "Array", "to_ary");
+  result = rb_hash_new();
+  for(i=0; i < RARRAY_LEN(ary); i++) {
+    VALUE path = rb_ary_entry(ary, i);
+    rb_hash_aset(result, path, file_index_owners(index, self, root, StringValueCStr(path), prefix));
+  }
+
+  return result;
+}
+
+/**
+ * call-seq:
+ *   write_snapshot( path ) → self
+ *
+ * Writes the names, versions, sizes, descriptions and dependency
+ * lists of the packages in the local and all sync databases to the
+ * file at +path+, to be opened with Alpm.open_snapshot later. The
+ * file is replaced atomically. Together with the data, the
+ * modification times of the databases’ files are recorded, so that
+ * an outdated snapshot is detected.
+ */
+static VALUE write_snapshot(VALUE self, VALUE path)
+{
+  wait_for_handle(self);
+  snapshot_write(self, StringValueCStr(path));
+  flush_log(1);
+  return self;
+}
+
+/**
+ * call-seq:
+ *   open_snapshot( path [, check: true ] ) → a_snapshot or nil
+ *
+ * Opens a snapshot written by #write_snapshot, without needing an
+ * Alpm instance or reading any database. The file is mapped into
+ * memory and used as is.
+ *
+ * === Parameters
+ * [path]
+ *   Path to the snapshot file.
+ * [check (true)]
+ *   Whether to compare the recorded modification times with those
+ *   of the databases’ files now. A database file that didn’t exist
+ *   when the snapshot was written and still doesn’t counts as
+ *   unchanged.
+ *
+ * === Return value
+ * An Alpm::Snapshot, or +nil+ if +check+ is set and any database
+ * changed since the snapshot was written. Raises an AlpmError if
+ * the file isn’t a snapshot of this version.
+ */
+static VALUE open_snapshot(int argc, VALUE argv[], VALUE klass)
+{
+  VALUE path, opts;
+  VALUE kwval = Qundef;
+  ID kwname;
+
+  rb_scan_args(argc, argv, "1:", &path, &opts);
+
+  kwname = rb_intern("check");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, &kwname, 0, 1, &kwval);
+
+  return snapshot_open(StringValueCStr(path), kwval == Qundef || RTEST(kwval));
+}
+
 /***************************************
  * Binding
  ***************************************/
@@ -627,19 +1747,42 @@ void Init_alpm()
   rb_define_method(rb_cAlpm, "inspect", RUBY_METHOD_FUNC(inspect), 0);
   rb_define_method(rb_cAlpm, "root", RUBY_METHOD_FUNC(root), 0);
   rb_define_method(rb_cAlpm, "dbpath", RUBY_METHOD_FUNC(dbpath), 0);
-  rb_define_method(rb_cAlpm, "log", RUBY_METHOD_FUNC(set_logcb), 0);
+  rb_define_method(rb_cAlpm, "log", RUBY_METHOD_FUNC(set_logcb), -1);
+  rb_define_method(rb_cAlpm, "flush_log", RUBY_METHOD_FUNC(rbflush_log), 0);
+  rb_define_method(rb_cAlpm, "download_progress", RUBY_METHOD_FUNC(set_dlcb), -1);
   rb_define_method(rb_cAlpm, "gpgdir", RUBY_METHOD_FUNC(get_gpgdir), 0);
   rb_define_method(rb_cAlpm, "gpgdir=", RUBY_METHOD_FUNC(set_gpgdir), 1);
+  rb_define_method(rb_cAlpm, "siglevel", RUBY_METHOD_FUNC(get_siglevel), 0);
   rb_define_method(rb_cAlpm, "arch", RUBY_METHOD_FUNC(get_arch), 0);
   rb_define_method(rb_cAlpm, "arch=", RUBY_METHOD_FUNC(set_arch), 1);
   rb_define_method(rb_cAlpm, "transaction", RUBY_METHOD_FUNC(transaction), -1);
   rb_define_method(rb_cAlpm, "local_db", RUBY_METHOD_FUNC(local_db), 0);
   rb_define_method(rb_cAlpm, "sync_dbs", RUBY_METHOD_FUNC(sync_dbs), 0);
+  rb_define_method(rb_cAlpm, "update_sync_dbs", RUBY_METHOD_FUNC(update_sync_dbs), -1);
+  rb_define_method(rb_cAlpm, "dependency_graph", RUBY_METHOD_FUNC(dependency_graph), -1);
+  rb_define_method(rb_cAlpm, "outdated", RUBY_METHOD_FUNC(outdated), -1);
+  rb_define_method(rb_cAlpm, "owner_of", RUBY_METHOD_FUNC(owner_of), -1);
+  rb_define_method(rb_cAlpm, "build_file_index", RUBY_METHOD_FUNC(build_file_index), -1);
+  rb_define_method(rb_cAlpm, "write_snapshot", RUBY_METHOD_FUNC(write_snapshot), 1);
+  rb_define_singleton_method(rb_cAlpm, "open_snapshot", RUBY_METHOD_FUNC(open_snapshot), -1);
+  rb_define_method(rb_cAlpm, "search_all", RUBY_METHOD_FUNC(search_all), -1);
   rb_define_method(rb_cAlpm, "register_syncdb", RUBY_METHOD_FUNC(register_syncdb), 2);
   rb_define_method(rb_cAlpm, "load_package", RUBY_METHOD_FUNC(load_package), -1);
+  rb_define_method(rb_cAlpm, "load_packages", RUBY_METHOD_FUNC(load_packages), -1);
   rb_define_method(rb_cAlpm, "errno", RUBY_METHOD_FUNC(rberrno), 0);
   rb_define_method(rb_cAlpm, "strerror", RUBY_METHOD_FUNC(rbstrerror), 1);
 
+  s_id_callback_error = rb_intern("__alpm_callback_error__");
+  s_id_handle_lock = rb_intern("handle_lock");
+  s_id_owned_p = rb_intern("owned?");
+  s_id_generation = rb_intern("generation");
+
+  Init_flags();
+  Init_log();
+  Init_download();
+  Init_version();
+  Init_depgraph();
+  Init_snapshot();
   Init_database();
   Init_transaction();
   Init_package();
@@ -1,6 +1,8 @@
 #ifndef RUBY_ALPM_MAIN_H
 #define RUBY_ALPM_MAIN_H
 #include <ruby.h>
+#include <ruby/thread.h>
+#include <ruby/encoding.h>
 #include <alpm.h>
 #include <alpm_list.h>
 
@@ -12,8 +14,30 @@
 extern VALUE rb_cAlpm;
 extern VALUE rb_eAlpm_Error;
 
+/* What the current thread may do with Ruby objects, see
+ * gvl_state(). */
+enum gvl_state {
+  GVL_HELD = 0, /* Ruby thread holding the GVL */
+  GVL_RELEASED, /* Ruby thread inside call_without_gvl() */
+  GVL_NEVER     /* Native worker thread, see pool.c */
+};
+
 VALUE raise_last_alpm_error(alpm_handle_t* p_handle);
 alpm_siglevel_t siglevel_from_ruby(VALUE ary);
+VALUE frozen_utf8_str(const char* str);
+double now(void);
+void* call_without_gvl(void* (*func)(void*), void* data, rb_unblock_function_t* ubf, void* ubf_data);
+void* call_with_gvl(void* (*func)(void*), void* data);
+enum gvl_state gvl_state(void);
+VALUE protect_callback(VALUE (*func)(VALUE), VALUE arg);
+void raise_callback_error(void);
+void raise_pending_errors(void);
+void lock_handle(VALUE rb_alpm);
+VALUE unlock_handle(VALUE rb_alpm);
+void wait_for_handle(VALUE rb_alpm);
+unsigned long handle_generation(VALUE rb_alpm);
+void handle_changed(VALUE rb_alpm);
+void mark_native_thread(void);
 void Init_alpm();
 
 #endif
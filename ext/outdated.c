@@ -0,0 +1,219 @@
+#include <fnmatch.h>
+#include <string.h>
+#include "outdated.h"
+#include "database.h"
+#include "package.h"
+#include "depgraph.h"
+
+/***************************************
+ * Data structures
+ ***************************************/
+
+/* A sync package replacing whatever satisfies `p_dep'. */
+typedef struct {
+  alpm_pkg_t* p_pkg;
+  alpm_depend_t* p_dep;
+  long next; /* Index of the next replacer of the same name, or -1 */
+} replacer_t;
+
+/* The sync side of the join, built once over all sync databases. */
+struct outdated_args {
+  VALUE rb_alpm;
+  VALUE ignore;
+  alpm_handle_t* p_alpm;
+  const char** p_patterns;
+  long npatterns;
+  alpm_db_t** p_dbs;     /* Sync databases in repository order */
+  st_table** p_replaces; /* Per database: replaced name → index of first replacer_t */
+  size_t ndbs;
+  replacer_t* p_replacers;
+  size_t nreplacers;
+  size_t capa;
+};
+
+/***************************************
+ * Helpers
+ ***************************************/
+
+/* Whether `p_pkg' is to be left alone, either by the +ignore+
+ * patterns or by the handle’s IgnorePkg/IgnoreGroup settings. */
+static int ignored(struct outdated_args* p_args, alpm_pkg_t* p_pkg)
+{
+  const char* name = alpm_pkg_get_name(p_pkg);
+  long i;
+
+  for(i=0; i < p_args->npatterns; i++) {
+    if (fnmatch(p_args->p_patterns[i], name, 0) == 0)
+      return 1;
+  }
+
+  return alpm_pkg_should_ignore(p_args->p_alpm, p_pkg);
+}
+
+/* Appends a replacer to the chain of `p_dep->name' in `p_table'. The
+ * chains are built back to front by add_replacers(), so that each
+ * one lists the replacers in the order of the package cache. */
+static void add_replacer(struct outdated_args* p_args, st_table* p_table, alpm_pkg_t* p_pkg, alpm_depend_t* p_dep)
+{
+  replacer_t* p_replacer;
+  st_data_t head;
+
+  if (p_args->nreplacers == p_args->capa) {
+    p_args->capa = p_args->capa ? p_args->capa * 2 : 64;
+    REALLOC_N(p_args->p_replacers, replacer_t, p_args->capa);
+  }
+
+  p_replacer = &p_args->p_replacers[p_args->nreplacers];
+  p_replacer->p_pkg = p_pkg;
+  p_replacer->p_dep = p_dep;
+  p_replacer->next = -1;
+  if (st_lookup(p_table, (st_data_t) p_dep->name, &head))
+    p_replacer->next = (long) head;
+
+  st_insert(p_table, (st_data_t) p_dep->name, (st_data_t) p_args->nreplacers);
+  p_args->nreplacers++;
+}
+
+/* Builds the replaces table of `p_db'. */
+static st_table* add_replacers(struct outdated_args* p_args, alpm_db_t* p_db)
+{
+  st_table* p_table = st_init_strtable();
+  alpm_list_t* p_pkgs = alpm_list_reverse(alpm_db_get_pkgcache(p_db));
+  alpm_list_t* item = NULL;
+  alpm_list_t* dep = NULL;
+
+  for(item = p_pkgs; item; item = alpm_list_next(item)) {
+    for(dep = alpm_pkg_get_replaces(item->data); dep; dep = alpm_list_next(dep))
+      add_replacer(p_args, p_table, item->data, (alpm_depend_t*) dep->data);
+  }
+
+  alpm_list_free(p_pkgs);
+  return p_table;
+}
+
+/* Appends a [local, replacer] pair to `result' for each package of
+ * the database at `index' whose +replaces+ matches `p_local' by
+ * name and version, like libalpm’s check_replacers(). Returns
+ * whether there was any. */
+static int push_replacers(struct outdated_args* p_args, size_t index, alpm_pkg_t* p_local, VALUE result)
+{
+  const char* name = alpm_pkg_get_name(p_local);
+  alpm_pkg_t* p_last = NULL;
+  st_data_t head;
+  long i;
+
+  if (!st_lookup(p_args->p_replaces[index], (st_data_t) name, &head))
+    return 0;
+
+  for(i = (long) head; i >= 0; i = p_args->p_replacers[i].next) {
+    replacer_t* p_replacer = &p_args->p_replacers[i];
+
+    /* Several matching +replaces+ of one package count once */
+    if (p_replacer->p_pkg == p_last)
+      continue;
+    if (strcmp(alpm_pkg_get_name(p_replacer->p_pkg), name) == 0)
+      continue;
+    if (!depend_satisfied_by(p_replacer->p_dep, alpm_pkg_get_version(p_local)))
+      continue;
+    if (ignored(p_args, p_replacer->p_pkg))
+      continue;
+
+    rb_ary_push(result, rb_assoc_new(wrap_package(p_args->rb_alpm, p_local), wrap_package(p_args->rb_alpm, p_replacer->p_pkg)));
+    p_last = p_replacer->p_pkg;
+  }
+
+  return p_last != NULL;
+}
+
+static VALUE outdated_body(VALUE ptr)
+{
+  struct outdated_args* p_args = (struct outdated_args*) ptr;
+  alpm_list_t* db = NULL;
+  alpm_list_t* item = NULL;
+  VALUE result = rb_ary_new();
+  size_t i;
+
+  p_args->npatterns = RARRAY_LEN(p_args->ignore);
+  p_args->p_patterns = ALLOC_N(const char*, p_args->npatterns ? p_args->npatterns : 1);
+  for(i=0; i < (size_t) p_args->npatterns; i++) {
+    VALUE pattern = rb_ary_entry(p_args->ignore, i);
+    p_args->p_patterns[i] = StringValueCStr(pattern);
+    rb_ary_store(p_args->ignore, i, pattern);
+  }
+
+  /* One pass over the sync databases for their replaces */
+  p_args->ndbs = alpm_list_count(alpm_get_syncdbs(p_args->p_alpm));
+  p_args->p_dbs = ALLOC_N(alpm_db_t*, p_args->ndbs ? p_args->ndbs : 1);
+  p_args->p_replaces = ALLOC_N(st_table*, p_args->ndbs ? p_args->ndbs : 1);
+  MEMZERO(p_args->p_replaces, st_table*, p_args->ndbs ? p_args->ndbs : 1);
+
+  for(db = alpm_get_syncdbs(p_args->p_alpm), i = 0; db && i < p_args->ndbs; db = alpm_list_next(db), i++) {
+    p_args->p_dbs[i] = (alpm_db_t*) db->data;
+    p_args->p_replaces[i] = add_replacers(p_args, p_args->p_dbs[i]);
+  }
+
+  /* And one over the local database, probing the databases in
+   * order like libalpm’s sysupgrade: the first one with either a
+   * replacement or a package of the same name decides. */
+  for(item = alpm_db_get_pkgcache(alpm_get_localdb(p_args->p_alpm)); item; item = alpm_list_next(item)) {
+    alpm_pkg_t* p_local = (alpm_pkg_t*) item->data;
+
+    if (ignored(p_args, p_local))
+      continue;
+
+    for(i=0; i < p_args->ndbs; i++) {
+      alpm_pkg_t* p_sync;
+
+      if (push_replacers(p_args, i, p_local, result))
+        break;
+
+      if (!(p_sync = alpm_db_get_pkg(p_args->p_dbs[i], alpm_pkg_get_name(p_local)))) /* Single = intended */
+        continue;
+
+      if (!ignored(p_args, p_sync) && alpm_pkg_vercmp(alpm_pkg_get_version(p_sync), alpm_pkg_get_version(p_local)) > 0)
+        rb_ary_push(result, rb_assoc_new(wrap_package(p_args->rb_alpm, p_local), wrap_package(p_args->rb_alpm, p_sync)));
+      break;
+    }
+  }
+
+  return result;
+}
+
+static VALUE outdated_ensure(VALUE ptr)
+{
+  struct outdated_args* p_args = (struct outdated_args*) ptr;
+  size_t i;
+
+  if (p_args->p_replaces) {
+    for(i=0; i < p_args->ndbs; i++) {
+      if (p_args->p_replaces[i])
+        st_free_table(p_args->p_replaces[i]);
+    }
+  }
+  xfree(p_args->p_replaces);
+  xfree(p_args->p_dbs);
+  xfree(p_args->p_replacers);
+  xfree(p_args->p_patterns);
+
+  return Qnil;
+}
+
+/***************************************
+ * Interface
+ ***************************************/
+
+/** Joins the local packages of `rb_alpm' against its sync databases
+ * by name and returns an array of [local, sync] Package pairs for
+ * those that have a newer version or a replacement. `ignore' is an
+ * array of fnmatch(3) patterns of package names to skip. */
+VALUE find_outdated(VALUE rb_alpm, VALUE ignore)
+{
+  struct outdated_args args;
+
+  memset(&args, 0, sizeof(struct outdated_args));
+  args.rb_alpm = rb_alpm;
+  args.ignore = rb_ary_dup(rb_convert_type(ignore, T_ARRAY, "Array", "to_ary"));
+  Data_Get_Struct(rb_alpm, alpm_handle_t, args.p_alpm);
+
+  return rb_ensure(outdated_body, (VALUE) &args, outdated_ensure, (VALUE) &args);
+}
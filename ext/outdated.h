@@ -0,0 +1,7 @@
+#ifndef RUBY_ALPM_OUTDATED_H
+#define RUBY_ALPM_OUTDATED_H
+#include "main.h"
+
+VALUE find_outdated(VALUE rb_alpm, VALUE ignore);
+
+#endif
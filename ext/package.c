@@ -1,10 +1,233 @@
+#include <stdlib.h>
 #include "package.h"
+#include "database.h"
+#include "list.h"
+#include "reverse_index.h"
+#include "version.h"
 
 /***************************************
  * Variables, etc
  ***************************************/
 
 VALUE rb_cAlpm_Package;
+static ID id_aref;
+static ID id_aset;
+static ID id_filename;
+static ID id_name;
+static ID id_version;
+static ID id_description;
+static ID id_url;
+static ID id_packager;
+static ID id_md5sum;
+static ID id_sha256sum;
+static ID id_alpm;
+static ID id_parsed_version;
+static VALUE field_syms[PKG_FIELD_COUNT];
+static VALUE sym_explicit;
+static VALUE sym_depend;
+
+/** Returns the Package instance for `p_pkg', obtained from the Alpm
+ * instance `rb_alpm'. As long as a Package instance for a package from
+ * a database is alive, this returns the very same object again, so
+ * repeated lookups neither allocate nor break #equal? or Hash keys.
+ * Packages not belonging to a database (i.e. loaded from a file) are
+ * wrapped anew each time. */
+VALUE wrap_package(VALUE rb_alpm, alpm_pkg_t* p_pkg)
+{
+  alpm_db_t* p_db = alpm_pkg_get_db(p_pkg);
+  VALUE cache;
+  VALUE key;
+  VALUE obj;
+
+  if (!p_db || NIL_P(rb_alpm))
+    return package_set_alpm(Data_Wrap_Struct(rb_cAlpm_Package, NULL, NULL, p_pkg), rb_alpm);
+
+  cache = package_cache_of_db(rb_alpm, p_db);
+  if (NIL_P(cache))
+    return package_set_alpm(Data_Wrap_Struct(rb_cAlpm_Package, NULL, NULL, p_pkg), rb_alpm);
+
+  key = ULONG2NUM((unsigned long) p_pkg);
+  if (!NIL_P(obj = rb_funcall(cache, id_aref, 1, key))) /* Single = intended */
+    return obj;
+
+  obj = package_set_alpm(Data_Wrap_Struct(rb_cAlpm_Package, NULL, NULL, p_pkg), rb_alpm);
+  rb_funcall(cache, id_aset, 2, key, obj);
+  return obj;
+}
+
+/** Remembers the Alpm instance `rb_alpm' (may be nil) the Package
+ * `pkg' was obtained from, for methods that need to look at other
+ * packages, like #required_by. Returns `pkg'. */
+VALUE package_set_alpm(VALUE pkg, VALUE rb_alpm)
+{
+  if (!NIL_P(rb_alpm))
+    rb_ivar_set(pkg, id_alpm, rb_alpm);
+
+  return pkg;
+}
+
+/* Returns the libalpm package wrapped by `self', once no other
+ * thread runs libalpm on its handle, see wait_for_handle(). */
+static alpm_pkg_t* get_pkg(VALUE self)
+{
+  alpm_pkg_t* p_pkg = NULL;
+
+  Data_Get_Struct(self, alpm_pkg_t, p_pkg);
+  wait_for_handle(rb_attr_get(self, id_alpm));
+  return p_pkg;
+}
+
+/* Returns the string `getter' returns for the package wrapped by `self'
+ * as a frozen UTF-8 string (see frozen_utf8_str()), and remembers it in
+ * the hidden instance variable `id', so that later calls neither call
+ * into libalpm nor allocate. */
+static VALUE cached_string(VALUE self, ID id, const char* (*getter)(alpm_pkg_t*))
+{
+  alpm_pkg_t* p_pkg = NULL;
+  VALUE str = rb_attr_get(self, id);
+
+  if (!NIL_P(str))
+    return str;
+
+  p_pkg = get_pkg(self);
+  str = frozen_utf8_str(getter(p_pkg));
+
+  if (!NIL_P(str) && !OBJ_FROZEN(self))
+    rb_ivar_set(self, id, str);
+
+  return str;
+}
+
+/** Converts the Symbols in `argv' into package_field values, which are
+ * stored in `p_fields' (which must have room for `argc' entries).
+ * If `argc' is 0, all fields are stored (and `p_fields' must have
+ * room for PKG_FIELD_COUNT entries). Raises for unknown field names.
+ * Returns the number of fields stored. */
+int package_fields_from_ruby(int argc, const VALUE argv[], enum package_field* p_fields)
+{
+  int i;
+  int j;
+
+  if (argc == 0) {
+    for(i=0; i < PKG_FIELD_COUNT; i++)
+      p_fields[i] = (enum package_field) i;
+
+    return PKG_FIELD_COUNT;
+  }
+
+  for(i=0; i < argc; i++) {
+    for(j=0; j < PKG_FIELD_COUNT; j++) {
+      if (field_syms[j] == argv[i])
+        break;
+    }
+
+    if (j == PKG_FIELD_COUNT) {
+      VALUE str = rb_inspect(argv[i]);
+      rb_raise(rb_eArgError, "Unknown package field: %s", StringValueCStr(str));
+    }
+
+    p_fields[i] = (enum package_field) j;
+  }
+
+  return argc;
+}
+
+/** The Symbol naming `field'. */
+VALUE package_field_name(enum package_field field)
+{
+  return field_syms[field];
+}
+
+/* Converts a libalpm timestamp into a Time, or +nil+ if unset. */
+static VALUE time_from_alpm(alpm_time_t time)
+{
+  return time ? rb_time_new(time, 0) : Qnil;
+}
+
+/** Reads the given field from `p_pkg' and converts it into the same
+ * Ruby object the corresponding accessor method would return. */
+VALUE package_field_value(alpm_pkg_t* p_pkg, enum package_field field)
+{
+  switch(field) {
+  case PKG_FIELD_NAME:
+    return frozen_utf8_str(alpm_pkg_get_name(p_pkg));
+  case PKG_FIELD_VERSION:
+    return frozen_utf8_str(alpm_pkg_get_version(p_pkg));
+  case PKG_FIELD_DESCRIPTION:
+    return frozen_utf8_str(alpm_pkg_get_desc(p_pkg));
+  case PKG_FIELD_URL:
+    return frozen_utf8_str(alpm_pkg_get_url(p_pkg));
+  case PKG_FIELD_PACKAGER:
+    return frozen_utf8_str(alpm_pkg_get_packager(p_pkg));
+  case PKG_FIELD_FILENAME:
+    return frozen_utf8_str(alpm_pkg_get_filename(p_pkg));
+  case PKG_FIELD_MD5SUM:
+    return frozen_utf8_str(alpm_pkg_get_md5sum(p_pkg));
+  case PKG_FIELD_SHA256SUM:
+    return frozen_utf8_str(alpm_pkg_get_sha256sum(p_pkg));
+  case PKG_FIELD_ARCH:
+    return frozen_utf8_str(alpm_pkg_get_arch(p_pkg));
+  case PKG_FIELD_SIZE:
+    return LONG2NUM(alpm_pkg_get_size(p_pkg));
+  case PKG_FIELD_ISIZE:
+    return LONG2NUM(alpm_pkg_get_isize(p_pkg));
+  case PKG_FIELD_BUILDDATE:
+    return time_from_alpm(alpm_pkg_get_builddate(p_pkg));
+  case PKG_FIELD_INSTALLDATE:
+    return time_from_alpm(alpm_pkg_get_installdate(p_pkg));
+  case PKG_FIELD_REASON:
+    return alpm_pkg_get_reason(p_pkg) == ALPM_PKG_REASON_DEPEND ? sym_depend : sym_explicit;
+  case PKG_FIELD_LICENSES:
+    return list_to_ary(alpm_pkg_get_licenses(p_pkg), list_conv_string, Qnil);
+  case PKG_FIELD_GROUPS:
+    return list_to_ary(alpm_pkg_get_groups(p_pkg), list_conv_string, Qnil);
+  case PKG_FIELD_DEPENDS:
+    return list_to_ary(alpm_pkg_get_depends(p_pkg), list_conv_depend, Qnil);
+  case PKG_FIELD_OPTDEPENDS:
+    return list_to_ary(alpm_pkg_get_optdepends(p_pkg), list_conv_depend, Qnil);
+  case PKG_FIELD_PROVIDES:
+    return list_to_ary(alpm_pkg_get_provides(p_pkg), list_conv_depend, Qnil);
+  case PKG_FIELD_CONFLICTS:
+    return list_to_ary(alpm_pkg_get_conflicts(p_pkg), list_conv_depend, Qnil);
+  case PKG_FIELD_REPLACES:
+    return list_to_ary(alpm_pkg_get_replaces(p_pkg), list_conv_depend, Qnil);
+  default:
+    return Qnil;
+  }
+}
+
+/** Whether `field' is an integer field, i.e. one of the sizes and
+ * dates. See package_field_int(). */
+int package_field_is_int(enum package_field field)
+{
+  switch(field) {
+  case PKG_FIELD_SIZE:
+  case PKG_FIELD_ISIZE:
+  case PKG_FIELD_BUILDDATE:
+  case PKG_FIELD_INSTALLDATE:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/** Reads the integer field `field' from `p_pkg' as a plain C integer,
+ * dates as seconds since the epoch. Returns 0 for non-integer fields. */
+int64_t package_field_int(alpm_pkg_t* p_pkg, enum package_field field)
+{
+  switch(field) {
+  case PKG_FIELD_SIZE:
+    return alpm_pkg_get_size(p_pkg);
+  case PKG_FIELD_ISIZE:
+    return alpm_pkg_get_isize(p_pkg);
+  case PKG_FIELD_BUILDDATE:
+    return alpm_pkg_get_builddate(p_pkg);
+  case PKG_FIELD_INSTALLDATE:
+    return alpm_pkg_get_installdate(p_pkg);
+  default:
+    return 0;
+  }
+}
 
 /***************************************
  * Methods
@@ -18,44 +241,59 @@ static VALUE initialize(VALUE self)
 
 /**
  * call-seq:
- *   filename() → a_string
+ *   filename() → a_frozen_string
  *
  * Filename of the package file.
  */
 static VALUE filename(VALUE self)
 {
-  alpm_pkg_t* p_pkg = NULL;
-  Data_Get_Struct(self, alpm_pkg_t, p_pkg);
-
-  return rb_str_new2(alpm_pkg_get_filename(p_pkg));
+  return cached_string(self, id_filename, alpm_pkg_get_filename);
 }
 
 /**
  * call-seq:
- *   name() → a_string
+ *   name() → a_frozen_string
  *
  * Name of the package.
  */
 static VALUE name(VALUE self)
 {
-  alpm_pkg_t* p_pkg = NULL;
-  Data_Get_Struct(self, alpm_pkg_t, p_pkg);
-
-  return rb_str_new2(alpm_pkg_get_name(p_pkg));
+  return cached_string(self, id_name, alpm_pkg_get_name);
 }
 
 /**
  * call-seq:
- *   version() → a_string
+ *   version() → a_frozen_string
  *
  * Version number of the package.
  */
 static VALUE version(VALUE self)
+{
+  return cached_string(self, id_version, alpm_pkg_get_version);
+}
+
+/**
+ * call-seq:
+ *   parsed_version() → a_version
+ *
+ * The package’s version as an Alpm::Version, parsed on the first
+ * call only.
+ */
+static VALUE parsed_version(VALUE self)
 {
   alpm_pkg_t* p_pkg = NULL;
-  Data_Get_Struct(self, alpm_pkg_t, p_pkg);
+  VALUE version = rb_attr_get(self, id_parsed_version);
+
+  if (!NIL_P(version))
+    return version;
 
-  return rb_str_new2(alpm_pkg_get_version(p_pkg));
+  p_pkg = get_pkg(self);
+  version = version_new(alpm_pkg_get_version(p_pkg));
+
+  if (!OBJ_FROZEN(self))
+    rb_ivar_set(self, id_parsed_version, version);
+
+  return version;
 }
 
 /**
@@ -69,7 +307,7 @@ static VALUE inspect(VALUE self)
   alpm_pkg_t* p_pkg = NULL;
   char buf[256];
   int len;
-  Data_Get_Struct(self, alpm_pkg_t, p_pkg);
+  p_pkg = get_pkg(self);
 
   len = sprintf(buf, "#<%s %s (%s)>",
                 rb_obj_classname(self),
@@ -81,73 +319,58 @@ static VALUE inspect(VALUE self)
 
 /**
  * call-seq:
- *   description() → a_string
- *   desc()        → a_string
+ *   description() → a_frozen_string
+ *   desc()        → a_frozen_string
  *
  * Returns the description for this package.
  */
 static VALUE description(VALUE self)
 {
-  alpm_pkg_t* p_pkg = NULL;
-  Data_Get_Struct(self, alpm_pkg_t, p_pkg);
-
-  return rb_str_new2(alpm_pkg_get_desc(p_pkg));
+  return cached_string(self, id_description, alpm_pkg_get_desc);
 }
 
 /**
  * call-seq:
- *   url() → a_string
+ *   url() → a_frozen_string
  *
  * Returns the homepage for this package.
  */
 static VALUE url(VALUE self)
 {
-  alpm_pkg_t* p_pkg = NULL;
-  Data_Get_Struct(self, alpm_pkg_t, p_pkg);
-
-  return rb_str_new2(alpm_pkg_get_url(p_pkg));
+  return cached_string(self, id_url, alpm_pkg_get_url);
 }
 
 /**
  * call-seq:
- *   packager() → a_string
+ *   packager() → a_frozen_string
  *
  * The packager’s name.
  */
 static VALUE packager(VALUE self)
 {
-  alpm_pkg_t* p_pkg = NULL;
-  Data_Get_Struct(self, alpm_pkg_t, p_pkg);
-
-  return rb_str_new2(alpm_pkg_get_packager(p_pkg));
+  return cached_string(self, id_packager, alpm_pkg_get_packager);
 }
 
 /**
  * call-seq:
- *   md5sum() → a_string
+ *   md5sum() → a_frozen_string
  *
  * The package’s MD5 checksum
  */
 static VALUE md5sum(VALUE self)
 {
-  alpm_pkg_t* p_pkg = NULL;
-  Data_Get_Struct(self, alpm_pkg_t, p_pkg);
-
-  return rb_str_new2(alpm_pkg_get_md5sum(p_pkg));
+  return cached_string(self, id_md5sum, alpm_pkg_get_md5sum);
 }
 
 /**
  * call-seq:
- *   sha256sum() → a_string
+ *   sha256sum() → a_frozen_string or nil
  *
- * The package’s SHA256 checksum
+ * The package’s SHA256 checksum, or +nil+ if it is unknown.
  */
 static VALUE sha256sum(VALUE self)
 {
-  alpm_pkg_t* p_pkg = NULL;
-  Data_Get_Struct(self, alpm_pkg_t, p_pkg);
-
-  return rb_str_new2(alpm_pkg_get_sha256sum(p_pkg));
+  return cached_string(self, id_sha256sum, alpm_pkg_get_sha256sum);
 }
 
 /**
@@ -161,7 +384,7 @@ static VALUE sha256sum(VALUE self)
 static VALUE size(VALUE self)
 {
   alpm_pkg_t* p_pkg = NULL;
-  Data_Get_Struct(self, alpm_pkg_t, p_pkg);
+  p_pkg = get_pkg(self);
 
   return LONG2NUM(alpm_pkg_get_size(p_pkg));
 }
@@ -176,11 +399,57 @@ static VALUE size(VALUE self)
 static VALUE installed_size(VALUE self)
 {
   alpm_pkg_t* p_pkg = NULL;
-  Data_Get_Struct(self, alpm_pkg_t, p_pkg);
+  p_pkg = get_pkg(self);
 
   return LONG2NUM(alpm_pkg_get_isize(p_pkg));
 }
 
+/**
+ * call-seq:
+ *   to_h( *fields ) → a_hash
+ *
+ * Extracts many attributes of the package at once, which is
+ * much faster than calling the individual accessor methods.
+ *
+ * === Parameters
+ * [*fields (splat)]
+ *   Symbols naming the attributes to extract. If none are
+ *   given, all of them are extracted. Possible values:
+ *   :name, :version, :description, :url, :packager, :filename,
+ *   :md5sum, :sha256sum, :arch, :size, :isize (installed size),
+ *   :builddate, :installdate (both Time instances or +nil+),
+ *   :reason (:explicit or :depend), :licenses, :groups (arrays
+ *   of strings), :depends, :optdepends, :provides, :conflicts,
+ *   and :replaces (arrays of strings like <tt>glibc>=2.17</tt>).
+ *
+ * === Return value
+ * A hash mapping the requested field names to their values.
+ */
+static VALUE to_h(int argc, VALUE argv[], VALUE self)
+{
+  alpm_pkg_t* p_pkg = NULL;
+  enum package_field fields[PKG_FIELD_COUNT];
+  enum package_field* p_fields;
+  VALUE tmp;
+  VALUE result;
+  int count;
+  int i;
+
+  p_pkg = get_pkg(self);
+
+  p_fields = argc > PKG_FIELD_COUNT ? ALLOCV_N(enum package_field, tmp, argc) : fields;
+  count = package_fields_from_ruby(argc, argv, p_fields);
+
+  result = rb_hash_new();
+  for(i=0; i < count; i++)
+    rb_hash_aset(result, package_field_name(p_fields[i]), package_field_value(p_pkg, p_fields[i]));
+
+  if (p_fields != fields)
+    ALLOCV_END(tmp);
+
+  return result;
+}
+
 /**
  * call-seq:
  *   self <=> other → nil, -1, 0, or 1
@@ -225,8 +494,8 @@ static VALUE compare(VALUE self, VALUE other)
   if (!RTEST(rb_obj_is_kind_of(other, rb_cAlpm_Package)))
     return Qnil;
 
-  Data_Get_Struct(self, alpm_pkg_t, p_pkg1);
-  Data_Get_Struct(other, alpm_pkg_t, p_pkg2);
+  p_pkg1 = get_pkg(self);
+  p_pkg2 = get_pkg(other);
 
   /* First compare names. If they’re different, sort alphabetically. */
   result = strcoll(alpm_pkg_get_name(p_pkg1), alpm_pkg_get_name(p_pkg2));
@@ -239,6 +508,109 @@ static VALUE compare(VALUE self, VALUE other)
     return INT2NUM(result);
 }
 
+/* Arguments for dependents_body() and dependents_ensure(). */
+struct dependents_args {
+  VALUE rb_alpm;
+  alpm_pkg_t* p_pkg;
+  int optional;
+  st_table* p_seen;
+};
+
+/* rb_ensure() body for compute_dependents(): collects from the same
+ * databases as libalpm looks at, the sync databases for sync
+ * packages and the local database for installed or loaded ones. */
+static VALUE dependents_body(VALUE ptr)
+{
+  struct dependents_args* p_args = (struct dependents_args*) ptr;
+  alpm_handle_t* p_alpm = NULL;
+  alpm_db_t* p_db = alpm_pkg_get_db(p_args->p_pkg);
+  alpm_list_t* item = NULL;
+  VALUE result = rb_ary_new();
+
+  Data_Get_Struct(p_args->rb_alpm, alpm_handle_t, p_alpm);
+  p_args->p_seen = st_init_strtable();
+
+  if (p_db && p_db != alpm_get_localdb(p_alpm)) {
+    for(item = alpm_get_syncdbs(p_alpm); item; item = alpm_list_next(item))
+      reverse_index_collect(reverse_index_of_db(wrap_database(p_args->rb_alpm, item->data)), p_args->p_pkg, p_args->optional, p_args->p_seen, result);
+  }
+  else
+    reverse_index_collect(reverse_index_of_db(wrap_database(p_args->rb_alpm, alpm_get_localdb(p_alpm))), p_args->p_pkg, p_args->optional, p_args->p_seen, result);
+
+  return result;
+}
+
+/* rb_ensure() ensure for compute_dependents(). */
+static VALUE dependents_ensure(VALUE ptr)
+{
+  struct dependents_args* p_args = (struct dependents_args*) ptr;
+
+  if (p_args->p_seen)
+    st_free_table(p_args->p_seen);
+
+  return Qnil;
+}
+
+/* Common part of #required_by and #optional_for. Like libalpm, lists
+ * each dependent package once, even if it depends on several of the
+ * names `self' goes by. */
+static VALUE compute_dependents(VALUE self, int optional)
+{
+  struct dependents_args args;
+  alpm_pkg_t* p_pkg = NULL;
+  alpm_list_t* p_names = NULL;
+  VALUE rb_alpm = rb_attr_get(self, id_alpm);
+  VALUE result;
+
+  p_pkg = get_pkg(self);
+
+  /* Unknown handle: let libalpm scan */
+  if (NIL_P(rb_alpm)) {
+    p_names = optional ? alpm_pkg_compute_optionalfor(p_pkg) : alpm_pkg_compute_requiredby(p_pkg);
+    result = list_to_ary(p_names, list_conv_string, Qnil);
+    alpm_list_free_inner(p_names, free);
+    alpm_list_free(p_names);
+    return result;
+  }
+
+  args.rb_alpm = rb_alpm;
+  args.p_pkg = p_pkg;
+  args.optional = optional;
+  args.p_seen = NULL;
+
+  return rb_ensure(RUBY_METHOD_FUNC(dependents_body), (VALUE) &args, RUBY_METHOD_FUNC(dependents_ensure), (VALUE) &args);
+}
+
+/**
+ * call-seq:
+ *   required_by() → an_array
+ *
+ * Names of the packages that depend on this package, by its name or
+ * one of its provisions. For installed packages (and packages loaded
+ * from files), these are installed packages; for packages from a
+ * sync database, packages from all sync databases.
+ *
+ * Answered from the databases’ reverse dependency indices (see
+ * Database#reverse_dependency_index), which are built on the first
+ * call.
+ */
+static VALUE required_by(VALUE self)
+{
+  return compute_dependents(self, 0);
+}
+
+/**
+ * call-seq:
+ *   optional_for() → an_array
+ *
+ * Like #required_by, but for packages listing this package as an
+ * optional dependency.
+ */
+static VALUE optional_for(VALUE self)
+{
+  return compute_dependents(self, 1);
+}
+
 /***************************************
  * Binding
  ***************************************/
@@ -247,11 +619,48 @@ void Init_package()
 {
   rb_cAlpm_Package = rb_define_class_under(rb_cAlpm, "Package", rb_cObject);
   rb_include_module(rb_cAlpm_Package, rb_mComparable);
+  id_aref = rb_intern("[]");
+  id_aset = rb_intern("[]=");
+  id_filename = rb_intern("filename");
+  id_name = rb_intern("name");
+  id_version = rb_intern("version");
+  id_description = rb_intern("description");
+  id_url = rb_intern("url");
+  id_packager = rb_intern("packager");
+  id_md5sum = rb_intern("md5sum");
+  id_sha256sum = rb_intern("sha256sum");
+  id_alpm = rb_intern("alpm");
+  id_parsed_version = rb_intern("parsed_version");
+
+  field_syms[PKG_FIELD_NAME] = STR2SYM("name");
+  field_syms[PKG_FIELD_VERSION] = STR2SYM("version");
+  field_syms[PKG_FIELD_DESCRIPTION] = STR2SYM("description");
+  field_syms[PKG_FIELD_URL] = STR2SYM("url");
+  field_syms[PKG_FIELD_PACKAGER] = STR2SYM("packager");
+  field_syms[PKG_FIELD_FILENAME] = STR2SYM("filename");
+  field_syms[PKG_FIELD_MD5SUM] = STR2SYM("md5sum");
+  field_syms[PKG_FIELD_SHA256SUM] = STR2SYM("sha256sum");
+  field_syms[PKG_FIELD_ARCH] = STR2SYM("arch");
+  field_syms[PKG_FIELD_SIZE] = STR2SYM("size");
+  field_syms[PKG_FIELD_ISIZE] = STR2SYM("isize");
+  field_syms[PKG_FIELD_BUILDDATE] = STR2SYM("builddate");
+  field_syms[PKG_FIELD_INSTALLDATE] = STR2SYM("installdate");
+  field_syms[PKG_FIELD_REASON] = STR2SYM("reason");
+  field_syms[PKG_FIELD_LICENSES] = STR2SYM("licenses");
+  field_syms[PKG_FIELD_GROUPS] = STR2SYM("groups");
+  field_syms[PKG_FIELD_DEPENDS] = STR2SYM("depends");
+  field_syms[PKG_FIELD_OPTDEPENDS] = STR2SYM("optdepends");
+  field_syms[PKG_FIELD_PROVIDES] = STR2SYM("provides");
+  field_syms[PKG_FIELD_CONFLICTS] = STR2SYM("conflicts");
+  field_syms[PKG_FIELD_REPLACES] = STR2SYM("replaces");
+  sym_explicit = STR2SYM("explicit");
+  sym_depend = STR2SYM("depend");
 
   rb_define_method(rb_cAlpm_Package, "initialize", RUBY_METHOD_FUNC(initialize), 0);
   rb_define_method(rb_cAlpm_Package, "filename", filename, 0);
   rb_define_method(rb_cAlpm_Package, "name", name, 0);
   rb_define_method(rb_cAlpm_Package, "version", version, 0);
+  rb_define_method(rb_cAlpm_Package, "parsed_version", RUBY_METHOD_FUNC(parsed_version), 0);
   rb_define_method(rb_cAlpm_Package, "inspect", RUBY_METHOD_FUNC(inspect), 0);
   rb_define_method(rb_cAlpm_Package, "description", RUBY_METHOD_FUNC(description), 0);
   rb_define_method(rb_cAlpm_Package, "url", RUBY_METHOD_FUNC(url), 0);
@@ -260,7 +669,10 @@ void Init_package()
   rb_define_method(rb_cAlpm_Package, "size", RUBY_METHOD_FUNC(size), 0);
   rb_define_method(rb_cAlpm_Package, "installed_size", RUBY_METHOD_FUNC(installed_size), 0);
   rb_define_method(rb_cAlpm_Package, "packager", RUBY_METHOD_FUNC(packager), 0);
+  rb_define_method(rb_cAlpm_Package, "to_h", RUBY_METHOD_FUNC(to_h), -1);
   rb_define_method(rb_cAlpm_Package, "<=>", RUBY_METHOD_FUNC(compare), 1);
+  rb_define_method(rb_cAlpm_Package, "required_by", RUBY_METHOD_FUNC(required_by), 0);
+  rb_define_method(rb_cAlpm_Package, "optional_for", RUBY_METHOD_FUNC(optional_for), 0);
 
   rb_define_alias(rb_cAlpm_Package, "desc", "description");
   rb_define_alias(rb_cAlpm_Package, "isize", "installed_size");
@@ -2,8 +2,41 @@
 #define RUBY_ALPM_PACKAGE_H
 #include "main.h"
 
-VALUE rb_cAlpm_Package;
+extern VALUE rb_cAlpm_Package;
 
+/* Attributes that can be extracted in bulk, see Package#to_h. */
+enum package_field {
+  PKG_FIELD_NAME = 0,
+  PKG_FIELD_VERSION,
+  PKG_FIELD_DESCRIPTION,
+  PKG_FIELD_URL,
+  PKG_FIELD_PACKAGER,
+  PKG_FIELD_FILENAME,
+  PKG_FIELD_MD5SUM,
+  PKG_FIELD_SHA256SUM,
+  PKG_FIELD_ARCH,
+  PKG_FIELD_SIZE,
+  PKG_FIELD_ISIZE,
+  PKG_FIELD_BUILDDATE,
+  PKG_FIELD_INSTALLDATE,
+  PKG_FIELD_REASON,
+  PKG_FIELD_LICENSES,
+  PKG_FIELD_GROUPS,
+  PKG_FIELD_DEPENDS,
+  PKG_FIELD_OPTDEPENDS,
+  PKG_FIELD_PROVIDES,
+  PKG_FIELD_CONFLICTS,
+  PKG_FIELD_REPLACES,
+  PKG_FIELD_COUNT
+};
+
+VALUE wrap_package(VALUE rb_alpm, alpm_pkg_t* p_pkg);
+VALUE package_set_alpm(VALUE pkg, VALUE rb_alpm);
+int package_fields_from_ruby(int argc, const VALUE argv[], enum package_field* p_fields);
+VALUE package_field_name(enum package_field field);
+VALUE package_field_value(alpm_pkg_t* p_pkg, enum package_field field);
+int package_field_is_int(enum package_field field);
+int64_t package_field_int(alpm_pkg_t* p_pkg, enum package_field field);
 void Init_package();
 
 #endif
@@ -0,0 +1,227 @@
+#include <unistd.h>
+#include "pool.h"
+
+/***************************************
+ * Worker threads
+ ***************************************/
+
+/* Main function of each worker thread. Takes jobs until there
+ * are none left or the pool got cancelled, and records the order
+ * in which they finished. */
+static void* worker_main(void* ptr)
+{
+  worker_pool_t* p_pool = (worker_pool_t*) ptr;
+  size_t index;
+
+  mark_native_thread();
+
+  for(;;) {
+    pthread_mutex_lock(&p_pool->lock);
+    if (p_pool->cancelled || p_pool->next >= p_pool->total) {
+      pthread_mutex_unlock(&p_pool->lock);
+      return NULL;
+    }
+    index = p_pool->next++;
+    pthread_mutex_unlock(&p_pool->lock);
+
+    p_pool->job(p_pool->data, index);
+
+    pthread_mutex_lock(&p_pool->lock);
+    p_pool->p_order[p_pool->finished++] = index;
+    pthread_cond_broadcast(&p_pool->cond);
+    pthread_mutex_unlock(&p_pool->lock);
+  }
+}
+
+/* Arguments for wait_without_gvl(). */
+struct wait_args {
+  worker_pool_t* p_pool;
+  size_t seen;
+};
+
+static void* wait_without_gvl(void* ptr)
+{
+  struct wait_args* p_args = (struct wait_args*) ptr;
+  worker_pool_t* p_pool = p_args->p_pool;
+
+  pthread_mutex_lock(&p_pool->lock);
+  while (p_pool->finished == p_args->seen && !p_pool->wakeup)
+    pthread_cond_wait(&p_pool->cond, &p_pool->lock);
+  p_pool->wakeup = 0;
+  pthread_mutex_unlock(&p_pool->lock);
+
+  return NULL;
+}
+
+/* Unblocking function for wait_without_gvl(). Only wakes up the
+ * waiting Ruby thread so it can handle the interrupt; the workers
+ * are stopped by pool_stop(), which the caller must ensure to call. */
+static void wait_ubf(void* ptr)
+{
+  worker_pool_t* p_pool = (worker_pool_t*) ptr;
+
+  pthread_mutex_lock(&p_pool->lock);
+  p_pool->wakeup = 1;
+  pthread_cond_broadcast(&p_pool->cond);
+  pthread_mutex_unlock(&p_pool->lock);
+}
+
+/***************************************
+ * Interface
+ ***************************************/
+
+/** The number of worker threads to use if the user didn’t say:
+ * one per online CPU. */
+unsigned int pool_default_threads(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (unsigned int) n : 1;
+}
+
+/** Converts the Ruby value of a +threads+ option to a number of
+ * worker threads. +nil+ (or an absent option, Qundef) means
+ * pool_default_threads(). */
+unsigned int pool_threads_from_ruby(VALUE threads)
+{
+  int n;
+
+  if (threads == Qundef || NIL_P(threads))
+    return pool_default_threads();
+
+  n = NUM2INT(threads);
+  if (n < 1)
+    rb_raise(rb_eArgError, "Number of threads must be positive, got %d.", n);
+
+  return (unsigned int) n;
+}
+
+/** Starts `nthreads' (at most `total') native threads that run
+ * `job' for each index from 0 to `total' - 1. Raises if not a
+ * single thread could be created. pool_stop() must be called once
+ * for each pool started, even if this method raised. */
+void pool_start(worker_pool_t* p_pool, unsigned int nthreads, size_t total, pool_job_t job, void* data)
+{
+  unsigned int i;
+
+  if (nthreads > total)
+    nthreads = total > 0 ? total : 1;
+
+  pthread_mutex_init(&p_pool->lock, NULL);
+  pthread_cond_init(&p_pool->cond, NULL);
+  p_pool->p_order = NULL;
+  p_pool->p_threads = NULL;
+  p_pool->job = job;
+  p_pool->data = data;
+  p_pool->total = total;
+  p_pool->next = 0;
+  p_pool->finished = 0;
+  p_pool->cancelled = 0;
+  p_pool->wakeup = 0;
+  p_pool->nthreads = 0;
+  p_pool->p_order = ALLOC_N(size_t, total);
+  p_pool->p_threads = ALLOC_N(pthread_t, nthreads);
+
+  for(i=0; i < nthreads; i++) {
+    if (pthread_create(&p_pool->p_threads[i], NULL, worker_main, p_pool) != 0)
+      break;
+    p_pool->nthreads++;
+  }
+
+  if (p_pool->nthreads == 0)
+    rb_raise(rb_eAlpm_Error, "Failed to create worker threads.");
+}
+
+/** Waits without holding the GVL until more than `seen' jobs have
+ * finished, and returns the number of finished jobs. The indices
+ * of the jobs in the order they finished are in p_pool->p_order.
+ * Raises if the Ruby thread is interrupted meanwhile, or if a log
+ * callback raised. */
+size_t pool_wait(worker_pool_t* p_pool, size_t seen)
+{
+  struct wait_args args;
+  size_t finished;
+
+  args.p_pool = p_pool;
+  args.seen = seen;
+  call_without_gvl(wait_without_gvl, &args, wait_ubf, p_pool);
+  raise_pending_errors();
+
+  pthread_mutex_lock(&p_pool->lock);
+  finished = p_pool->finished;
+  pthread_mutex_unlock(&p_pool->lock);
+
+  return finished;
+}
+
+/** Tells the workers not to start any more jobs, waits for the
+ * running ones to finish, and frees the pool’s resources. */
+void pool_stop(worker_pool_t* p_pool)
+{
+  unsigned int i;
+
+  pthread_mutex_lock(&p_pool->lock);
+  p_pool->cancelled = 1;
+  pthread_mutex_unlock(&p_pool->lock);
+
+  for(i=0; i < p_pool->nthreads; i++)
+    pthread_join(p_pool->p_threads[i], NULL);
+
+  xfree(p_pool->p_threads);
+  xfree(p_pool->p_order);
+  pthread_cond_destroy(&p_pool->cond);
+  pthread_mutex_destroy(&p_pool->lock);
+}
+
+/* Arguments for pool_run_body() and pool_run_ensure(). */
+struct run_args {
+  worker_pool_t pool;
+  unsigned int nthreads;
+  size_t total;
+  pool_job_t job;
+  void* data;
+  int started;
+};
+
+/* rb_ensure() body for pool_run(). */
+static VALUE pool_run_body(VALUE ptr)
+{
+  struct run_args* p_args = (struct run_args*) ptr;
+  size_t seen = 0;
+
+  p_args->started = 1;
+  pool_start(&p_args->pool, p_args->nthreads, p_args->total, p_args->job, p_args->data);
+
+  while (seen < p_args->total)
+    seen = pool_wait(&p_args->pool, seen);
+
+  return Qnil;
+}
+
+/* rb_ensure() ensure for pool_run(). */
+static VALUE pool_run_ensure(VALUE ptr)
+{
+  struct run_args* p_args = (struct run_args*) ptr;
+
+  if (p_args->started)
+    pool_stop(&p_args->pool);
+
+  return Qnil;
+}
+
+/** Runs `job' for each index from 0 to `total' - 1 on `nthreads'
+ * native threads and returns when all jobs are done. If the Ruby
+ * thread is interrupted meanwhile, the remaining jobs are skipped. */
+void pool_run(unsigned int nthreads, size_t total, pool_job_t job, void* data)
+{
+  struct run_args args;
+
+  if (total == 0)
+    return;
+
+  args.nthreads = nthreads;
+  args.total = total;
+  args.job = job;
+  args.data = data;
+  args.started = 0;
+  rb_ensure(RUBY_METHOD_FUNC(pool_run_body), (VALUE) &args, RUBY_METHOD_FUNC(pool_run_ensure), (VALUE) &args);
+}
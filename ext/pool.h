@@ -0,0 +1,34 @@
+#ifndef RUBY_ALPM_POOL_H
+#define RUBY_ALPM_POOL_H
+#include <pthread.h>
+#include "main.h"
+
+/* A job run by a worker thread. Gets the `data' pointer passed
+ * to pool_start() and the index of the job to run. Runs without
+ * the GVL on a native thread, so it must not touch Ruby objects. */
+typedef void (*pool_job_t)(void* data, size_t index);
+
+/* A set of native worker threads processing jobs 0...total. */
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t* p_threads;
+  unsigned int nthreads;
+  pool_job_t job;
+  void* data;
+  size_t total;
+  size_t next;
+  size_t finished;
+  size_t* p_order;
+  int cancelled;
+  int wakeup;
+} worker_pool_t;
+
+unsigned int pool_default_threads(void);
+unsigned int pool_threads_from_ruby(VALUE threads);
+void pool_start(worker_pool_t* p_pool, unsigned int nthreads, size_t total, pool_job_t job, void* data);
+size_t pool_wait(worker_pool_t* p_pool, size_t seen);
+void pool_stop(worker_pool_t* p_pool);
+void pool_run(unsigned int nthreads, size_t total, pool_job_t job, void* data);
+
+#endif
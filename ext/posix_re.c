@@ -0,0 +1,41 @@
+#include <regex.h>
+#include <stdlib.h>
+#include "posix_re.h"
+
+struct posix_re {
+  regex_t regex;
+};
+
+/** Compiles `pattern' as a case-insensitive POSIX extended regular
+ * expression, like alpm_db_search() does. On error, returns NULL
+ * and stores a description in `errbuf'. */
+posix_re_t* posix_re_compile(const char* pattern, char* errbuf, size_t errlen)
+{
+  posix_re_t* p_re = malloc(sizeof(posix_re_t));
+  int err;
+
+  if (!p_re)
+    return NULL;
+
+  err = regcomp(&p_re->regex, pattern, REG_EXTENDED | REG_ICASE | REG_NOSUB | REG_NEWLINE);
+  if (err != 0) {
+    regerror(err, &p_re->regex, errbuf, errlen);
+    free(p_re);
+    return NULL;
+  }
+
+  return p_re;
+}
+
+/** Whether `str' matches `p_re'. */
+int posix_re_match(const posix_re_t* p_re, const char* str)
+{
+  return regexec(&p_re->regex, str, 0, NULL, 0) == 0;
+}
+
+/** Frees a regular expression obtained from posix_re_compile(). */
+void posix_re_free(posix_re_t* p_re)
+{
+  regfree(&p_re->regex);
+  free(p_re);
+}
@@ -0,0 +1,14 @@
+#ifndef RUBY_ALPM_POSIX_RE_H
+#define RUBY_ALPM_POSIX_RE_H
+#include <stddef.h>
+
+/* POSIX regular expressions as used by libalpm’s own search. These
+ * live in their own translation unit, because Ruby’s headers define
+ * a conflicting regex_t (Onigmo). */
+typedef struct posix_re posix_re_t;
+
+posix_re_t* posix_re_compile(const char* pattern, char* errbuf, size_t errlen);
+int posix_re_match(const posix_re_t* p_re, const char* str);
+void posix_re_free(posix_re_t* p_re);
+
+#endif
@@ -0,0 +1,148 @@
+#include "reverse_index.h"
+#include "depgraph.h"
+
+/***************************************
+ * Data structures
+ ***************************************/
+
+/* A dependency of package `p_pkg' on something. */
+typedef struct {
+  alpm_pkg_t* p_pkg;
+  alpm_depend_t* p_dep;
+} rdep_edge_t;
+
+/* All dependencies on a specific name. */
+typedef struct {
+  rdep_edge_t* p_edges;
+  size_t len;
+  size_t capa;
+} rdep_list_t;
+
+/* The dependencies of all packages in a database, keyed by the
+ * name they depend on. The pointers belong to libalpm and stay
+ * valid until the database changes, which throws the index away. */
+typedef struct {
+  st_table* p_depends;    /* name → rdep_list_t* */
+  st_table* p_optdepends; /* name → rdep_list_t* */
+} reverse_index_t;
+
+static void add_edge(st_table* p_table, alpm_pkg_t* p_pkg, alpm_depend_t* p_dep)
+{
+  st_data_t value;
+  rdep_list_t* p_list;
+
+  if (st_lookup(p_table, (st_data_t) p_dep->name, &value))
+    p_list = (rdep_list_t*) value;
+  else {
+    p_list = ALLOC(rdep_list_t);
+    p_list->len = 0;
+    p_list->capa = 2;
+    p_list->p_edges = ALLOC_N(rdep_edge_t, p_list->capa);
+    st_insert(p_table, (st_data_t) p_dep->name, (st_data_t) p_list);
+  }
+
+  if (p_list->len == p_list->capa) {
+    p_list->capa *= 2;
+    REALLOC_N(p_list->p_edges, rdep_edge_t, p_list->capa);
+  }
+  p_list->p_edges[p_list->len].p_pkg = p_pkg;
+  p_list->p_edges[p_list->len].p_dep = p_dep;
+  p_list->len++;
+}
+
+static int free_list(st_data_t key, st_data_t value, st_data_t arg)
+{
+  rdep_list_t* p_list = (rdep_list_t*) value;
+
+  xfree(p_list->p_edges);
+  xfree(p_list);
+  return ST_CONTINUE;
+}
+
+static void free_reverse_index(void* ptr)
+{
+  reverse_index_t* p_index = (reverse_index_t*) ptr;
+
+  st_foreach(p_index->p_depends, free_list, 0);
+  st_free_table(p_index->p_depends);
+  st_foreach(p_index->p_optdepends, free_list, 0);
+  st_free_table(p_index->p_optdepends);
+  xfree(p_index);
+}
+
+/* Adds the names of the packages depending on `name' whose
+ * dependency is satisfied by `version' to `result', unless they are
+ * in `p_seen' already. */
+static void collect_list(st_table* p_table, const char* name, const char* version, alpm_pkg_t* p_self, st_table* p_seen, VALUE result)
+{
+  st_data_t value;
+  rdep_list_t* p_list;
+  const char* dependent;
+  size_t i;
+
+  if (!st_lookup(p_table, (st_data_t) name, &value))
+    return;
+
+  p_list = (rdep_list_t*) value;
+  for(i=0; i < p_list->len; i++) {
+    if (p_list->p_edges[i].p_pkg == p_self)
+      continue;
+    if (!depend_satisfied_by(p_list->p_edges[i].p_dep, version))
+      continue;
+
+    dependent = alpm_pkg_get_name(p_list->p_edges[i].p_pkg);
+    if (!st_insert(p_seen, (st_data_t) dependent, 0))
+      rb_ary_push(result, frozen_utf8_str(dependent));
+  }
+}
+
+/***************************************
+ * Interface
+ ***************************************/
+
+/** Builds the reverse dependency index of `p_db' in a single pass
+ * over its packages, wrapped in a hidden Ruby object. */
+VALUE reverse_index_new(alpm_db_t* p_db)
+{
+  reverse_index_t* p_index = ALLOC(reverse_index_t);
+  alpm_list_t* item = NULL;
+  alpm_list_t* dep = NULL;
+  VALUE obj;
+
+  p_index->p_depends = st_init_strtable();
+  p_index->p_optdepends = st_init_strtable();
+  obj = Data_Wrap_Struct(0, NULL, free_reverse_index, p_index);
+
+  for(item = alpm_db_get_pkgcache(p_db); item; item = alpm_list_next(item)) {
+    alpm_pkg_t* p_pkg = (alpm_pkg_t*) item->data;
+
+    for(dep = alpm_pkg_get_depends(p_pkg); dep; dep = alpm_list_next(dep))
+      add_edge(p_index->p_depends, p_pkg, (alpm_depend_t*) dep->data);
+    for(dep = alpm_pkg_get_optdepends(p_pkg); dep; dep = alpm_list_next(dep))
+      add_edge(p_index->p_optdepends, p_pkg, (alpm_depend_t*) dep->data);
+  }
+
+  return obj;
+}
+
+/** Appends the names of the packages in the index that (optionally,
+ * if `optional' is set) depend on `p_pkg', by its name or one of its
+ * provisions, to `result'. Only looks at the dependencies on these
+ * names, so this is O(number of such dependencies). Each name is
+ * added only once; `p_seen' is a strtable of the names added so far,
+ * which may be shared across calls for several databases. */
+void reverse_index_collect(VALUE index, alpm_pkg_t* p_pkg, int optional, st_table* p_seen, VALUE result)
+{
+  reverse_index_t* p_index = NULL;
+  st_table* p_table;
+  alpm_list_t* item = NULL;
+
+  Data_Get_Struct(index, reverse_index_t, p_index);
+  p_table = optional ? p_index->p_optdepends : p_index->p_depends;
+
+  collect_list(p_table, alpm_pkg_get_name(p_pkg), alpm_pkg_get_version(p_pkg), p_pkg, p_seen, result);
+  for(item = alpm_pkg_get_provides(p_pkg); item; item = alpm_list_next(item)) {
+    alpm_depend_t* p_prov = (alpm_depend_t*) item->data;
+    collect_list(p_table, p_prov->name, p_prov->version, p_pkg, p_seen, result);
+  }
+}
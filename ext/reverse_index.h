@@ -0,0 +1,8 @@
+#ifndef RUBY_ALPM_REVERSE_INDEX_H
+#define RUBY_ALPM_REVERSE_INDEX_H
+#include "main.h"
+
+VALUE reverse_index_new(alpm_db_t* p_db);
+void reverse_index_collect(VALUE index, alpm_pkg_t* p_pkg, int optional, st_table* p_seen, VALUE result);
+
+#endif
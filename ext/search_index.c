@@ -0,0 +1,421 @@
+#include <ctype.h>
+#include <string.h>
+#include "search_index.h"
+#include "posix_re.h"
+#include "package.h"
+
+/***************************************
+ * Data structures
+ ***************************************/
+
+/* Ascending list of the indices of all packages whose name or
+ * description contains a specific trigram. */
+typedef struct {
+  uint32_t* p_ids;
+  size_t len;
+  size_t capa;
+} posting_t;
+
+/* In-memory trigram index over the names and descriptions of
+ * all packages in a database. The alpm_pkg_t pointers stay valid
+ * until the database is updated, which throws the index away. */
+typedef struct {
+  alpm_pkg_t** p_pkgs;
+  size_t npkgs;
+  st_table* p_grams; /* trigram → posting_t* */
+} search_index_t;
+
+/* A single query term prepared for matching. */
+typedef struct {
+  const char* str;
+  size_t len;
+  posix_re_t* p_re;
+} term_t;
+
+/* Packs three bytes, lowercased, into a trigram key. */
+static st_data_t trigram(const char* str)
+{
+  return ((st_data_t) tolower((unsigned char) str[0]) << 16)
+    | ((st_data_t) tolower((unsigned char) str[1]) << 8)
+    | (st_data_t) tolower((unsigned char) str[2]);
+}
+
+/* Records that package `id' contains all trigrams of `str'. */
+static void index_text(search_index_t* p_index, const char* str, uint32_t id)
+{
+  size_t len;
+  size_t i;
+
+  if (!str)
+    return;
+
+  len = strlen(str);
+  for(i=0; i + 3 <= len; i++) {
+    st_data_t key = trigram(str + i);
+    st_data_t value;
+    posting_t* p_posting;
+
+    if (st_lookup(p_index->p_grams, key, &value))
+      p_posting = (posting_t*) value;
+    else {
+      p_posting = ALLOC(posting_t);
+      p_posting->len = 0;
+      p_posting->capa = 4;
+      p_posting->p_ids = ALLOC_N(uint32_t, p_posting->capa);
+      st_insert(p_index->p_grams, key, (st_data_t) p_posting);
+    }
+
+    /* Packages are indexed in order, so this keeps the list sorted */
+    if (p_posting->len > 0 && p_posting->p_ids[p_posting->len - 1] == id)
+      continue;
+
+    if (p_posting->len == p_posting->capa) {
+      p_posting->capa *= 2;
+      REALLOC_N(p_posting->p_ids, uint32_t, p_posting->capa);
+    }
+    p_posting->p_ids[p_posting->len++] = id;
+  }
+}
+
+static int free_posting(st_data_t key, st_data_t value, st_data_t arg)
+{
+  posting_t* p_posting = (posting_t*) value;
+
+  xfree(p_posting->p_ids);
+  xfree(p_posting);
+  return ST_CONTINUE;
+}
+
+static void free_search_index(void* ptr)
+{
+  search_index_t* p_index = (search_index_t*) ptr;
+
+  st_foreach(p_index->p_grams, free_posting, 0);
+  st_free_table(p_index->p_grams);
+  xfree(p_index->p_pkgs);
+  xfree(p_index);
+}
+
+/***************************************
+ * Querying
+ ***************************************/
+
+/* Case-insensitive substring search. */
+static int contains(const char* haystack, const char* needle, size_t len)
+{
+  size_t i;
+
+  if (!haystack)
+    return 0;
+
+  for(; *haystack; haystack++) {
+    for(i=0; i < len && haystack[i]; i++) {
+      if (tolower((unsigned char) haystack[i]) != tolower((unsigned char) needle[i]))
+        break;
+    }
+    if (i == len)
+      return 1;
+  }
+
+  return len == 0;
+}
+
+/* Whether package `p_pkg' satisfies a single query term. */
+static int term_matches(alpm_pkg_t* p_pkg, term_t* p_term, enum search_mode mode)
+{
+  const char* name = alpm_pkg_get_name(p_pkg);
+  const char* desc = alpm_pkg_get_desc(p_pkg);
+
+  switch(mode) {
+  case SEARCH_PREFIX:
+    return strncasecmp(name, p_term->str, p_term->len) == 0;
+  case SEARCH_REGEX:
+    return posix_re_match(p_term->p_re, name) || (desc && posix_re_match(p_term->p_re, desc));
+  default:
+    return contains(name, p_term->str, p_term->len) || contains(desc, p_term->str, p_term->len);
+  }
+}
+
+/* Intersects the ascending lists `p_a' (length *p_alen, modified in
+ * place) and `p_b'. */
+static void intersect(uint32_t* p_a, size_t* p_alen, const uint32_t* p_b, size_t blen)
+{
+  size_t i = 0, j = 0, k = 0;
+
+  while (i < *p_alen && j < blen) {
+    if (p_a[i] < p_b[j])
+      i++;
+    else if (p_a[i] > p_b[j])
+      j++;
+    else {
+      p_a[k++] = p_a[i];
+      i++;
+      j++;
+    }
+  }
+
+  *p_alen = k;
+}
+
+/* Narrows the candidate list with all trigrams of the `len' bytes
+ * at `str'. `*p_cands' is NULL as long as there is no restriction.
+ * Returns 0 if a trigram doesn’t occur at all. */
+static int restrict_candidates(search_index_t* p_index, const char* str, size_t len, uint32_t** p_cands, size_t* p_ncands)
+{
+  size_t i;
+
+  for(i=0; i + 3 <= len; i++) {
+    st_data_t value;
+    posting_t* p_posting;
+
+    if (!st_lookup(p_index->p_grams, trigram(str + i), &value))
+      return 0;
+
+    p_posting = (posting_t*) value;
+    if (!*p_cands) {
+      *p_cands = ALLOC_N(uint32_t, p_posting->len);
+      MEMCPY(*p_cands, p_posting->p_ids, uint32_t, p_posting->len);
+      *p_ncands = p_posting->len;
+    }
+    else
+      intersect(*p_cands, p_ncands, p_posting->p_ids, p_posting->len);
+
+    if (*p_ncands == 0)
+      return 0;
+  }
+
+  return 1;
+}
+
+/* Whether the `len' bytes at `str' are all ASCII. */
+static int is_ascii(const char* str, size_t len)
+{
+  size_t i;
+
+  for(i=0; i < len; i++) {
+    if ((unsigned char) str[i] >= 0x80)
+      return 0;
+  }
+
+  return 1;
+}
+
+/* Narrows the candidate list with the literal runs every match of
+ * the POSIX extended regular expression `str' must contain. Only
+ * runs of plain characters outside of groups and bracket expressions
+ * are used, and anything with alternatives is not narrowed at all.
+ * Neither are runs with non-ASCII characters, as REG_ICASE folds
+ * those by locale while the trigrams are folded bytewise. */
+static int restrict_candidates_regex(search_index_t* p_index, const char* str, uint32_t** p_cands, size_t* p_ncands)
+{
+  const char* run = str;
+  size_t len = 0;
+  const char* p;
+
+  if (strchr(str, '|'))
+    return 1; /* Alternatives don’t share literals */
+
+  for(p = str; ; p++) {
+    switch(*p) {
+    case '?': case '*': case '{':
+      /* The preceding character is optional, all of its UTF-8 bytes */
+      while (len > 0 && ((unsigned char) run[--len] & 0xC0) == 0x80)
+        ;
+      break;
+    case '\\': case '\0': case '.': case '[': case '(': case ')':
+    case '^': case '$': case '+': case ']': case '}':
+      break;
+    default:
+      len++;
+      continue;
+    }
+
+    /* End of a literal run */
+    if (is_ascii(run, len) && !restrict_candidates(p_index, run, len, p_cands, p_ncands))
+      return 0;
+
+    switch(*p) {
+    case '\0':
+    case '(': /* Groups may be optional; stop here */
+      return 1;
+    case '\\':
+      if (p[1])
+        p++;
+      break;
+    case '{':
+      if (!(p = strchr(p, '}'))) /* Single = intended */
+        return 1;
+      break;
+    case '[':
+      p++;
+      if (*p == '^')
+        p++;
+      if (*p == ']')
+        p++;
+      if (!(p = strchr(p, ']'))) /* Single = intended */
+        return 1;
+      break;
+    }
+
+    run = p + 1;
+    len = 0;
+  }
+}
+
+/* Arguments for and state of search_index_query_body() and
+ * search_index_query_ensure(). */
+struct query_args {
+  search_index_t* p_index;
+  VALUE rb_alpm;
+  int argc;
+  VALUE* argv;
+  enum search_mode mode;
+  VALUE terms; /* Keeps the strings p_terms point into alive */
+  term_t* p_terms;
+  int nterms;
+  uint32_t* p_cands;
+};
+
+static VALUE search_index_query_body(VALUE ptr)
+{
+  struct query_args* p_args = (struct query_args*) ptr;
+  search_index_t* p_index = p_args->p_index;
+  size_t ncands = 0;
+  size_t nmatches = 0;
+  size_t i;
+  VALUE result;
+  int j;
+
+  /* Prepare the terms */
+  for(j=0; j < p_args->argc; j++) {
+    VALUE term = rb_check_string_type(p_args->argv[j]);
+    term_t* p_term = &p_args->p_terms[j];
+
+    if (!RTEST(term))
+      rb_raise(rb_eTypeError, "Argument is not a string (#to_str)");
+
+    /* #to_str may have made a temporary, and later terms’ #to_str
+     * could modify an earlier one, so keep a frozen copy */
+    term = rb_str_new_frozen(term);
+    rb_ary_push(p_args->terms, term);
+
+    p_term->str = StringValueCStr(term);
+    p_term->len = RSTRING_LEN(term);
+    p_term->p_re = NULL;
+    p_args->nterms++;
+
+    if (p_args->mode == SEARCH_REGEX) {
+      char buf[256] = "out of memory";
+
+      if (!(p_term->p_re = posix_re_compile(p_term->str, buf, sizeof(buf)))) /* Single = intended */
+        rb_raise(rb_eArgError, "Invalid regular expression %s: %s", p_term->str, buf);
+    }
+  }
+
+  /* Narrow down with the trigrams. From here on, no Ruby
+   * methods are called that could invalidate the term strings. */
+  for(j=0; j < p_args->nterms; j++) {
+    term_t* p_term = &p_args->p_terms[j];
+    int possible;
+
+    if (p_args->mode == SEARCH_REGEX)
+      possible = restrict_candidates_regex(p_index, p_term->str, &p_args->p_cands, &ncands);
+    else
+      possible = restrict_candidates(p_index, p_term->str, p_term->len, &p_args->p_cands, &ncands);
+
+    if (!possible)
+      return rb_ary_new();
+  }
+
+  if (!p_args->p_cands) { /* No usable trigrams, check everything */
+    ncands = p_index->npkgs;
+    p_args->p_cands = ALLOC_N(uint32_t, ncands);
+    for(i=0; i < ncands; i++)
+      p_args->p_cands[i] = i;
+  }
+
+  /* Verify the candidates */
+  for(i=0; i < ncands; i++) {
+    alpm_pkg_t* p_pkg = p_index->p_pkgs[p_args->p_cands[i]];
+
+    for(j=0; j < p_args->nterms; j++) {
+      if (!term_matches(p_pkg, &p_args->p_terms[j], p_args->mode))
+        break;
+    }
+
+    if (j == p_args->nterms)
+      p_args->p_cands[nmatches++] = p_args->p_cands[i];
+  }
+
+  result = rb_ary_new2(nmatches);
+  for(i=0; i < nmatches; i++)
+    rb_ary_push(result, wrap_package(p_args->rb_alpm, p_index->p_pkgs[p_args->p_cands[i]]));
+
+  RB_GC_GUARD(p_args->terms);
+  return result;
+}
+
+static VALUE search_index_query_ensure(VALUE ptr)
+{
+  struct query_args* p_args = (struct query_args*) ptr;
+  int j;
+
+  for(j=0; j < p_args->nterms; j++) {
+    if (p_args->p_terms[j].p_re)
+      posix_re_free(p_args->p_terms[j].p_re);
+  }
+
+  xfree(p_args->p_terms);
+  xfree(p_args->p_cands);
+  return Qnil;
+}
+
+/***************************************
+ * Interface
+ ***************************************/
+
+/** Builds a trigram index over the names and descriptions of all
+ * packages in `p_db' and returns it wrapped into a hidden Ruby
+ * object, suitable for storing in an instance variable. */
+VALUE search_index_new(alpm_db_t* p_db)
+{
+  search_index_t* p_index = ALLOC(search_index_t);
+  alpm_list_t* p_pkgs = alpm_db_get_pkgcache(p_db);
+  alpm_list_t* item = NULL;
+  VALUE obj;
+  size_t i;
+
+  p_index->npkgs = alpm_list_count(p_pkgs);
+  p_index->p_pkgs = ALLOC_N(alpm_pkg_t*, p_index->npkgs);
+  p_index->p_grams = st_init_numtable();
+  obj = Data_Wrap_Struct(0, NULL, free_search_index, p_index);
+
+  for(item = p_pkgs, i = 0; item && i < p_index->npkgs; item = alpm_list_next(item), i++) {
+    p_index->p_pkgs[i] = item->data;
+    index_text(p_index, alpm_pkg_get_name(item->data), i);
+    index_text(p_index, alpm_pkg_get_desc(item->data), i);
+  }
+  p_index->npkgs = i;
+
+  return obj;
+}
+
+/** Runs a query against the index `index' (see search_index_new())
+ * and returns an array of the Package instances, obtained from
+ * `rb_alpm', that match all terms in `argv'. */
+VALUE search_index_query(VALUE index, VALUE rb_alpm, int argc, VALUE argv[], enum search_mode mode)
+{
+  struct query_args args;
+
+  Data_Get_Struct(index, search_index_t, args.p_index);
+  args.rb_alpm = rb_alpm;
+  args.argc = argc;
+  args.argv = argv;
+  args.mode = mode;
+  args.terms = rb_ary_new2(argc);
+  args.nterms = 0;
+  args.p_cands = NULL;
+  args.p_terms = ALLOC_N(term_t, argc > 0 ? argc : 1);
+
+  return rb_ensure(RUBY_METHOD_FUNC(search_index_query_body), (VALUE) &args, RUBY_METHOD_FUNC(search_index_query_ensure), (VALUE) &args);
+}
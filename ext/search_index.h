@@ -0,0 +1,16 @@
+#ifndef RUBY_ALPM_SEARCH_INDEX_H
+#define RUBY_ALPM_SEARCH_INDEX_H
+#include "main.h"
+
+/* How the terms of a query are interpreted, see
+ * Database#indexed_search. */
+enum search_mode {
+  SEARCH_LITERAL = 0,
+  SEARCH_PREFIX,
+  SEARCH_REGEX
+};
+
+VALUE search_index_new(alpm_db_t* p_db);
+VALUE search_index_query(VALUE index, VALUE rb_alpm, int argc, VALUE argv[], enum search_mode mode);
+
+#endif
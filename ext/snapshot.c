@@ -0,0 +1,1031 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ruby/util.h>
+#include "snapshot.h"
+#include "posix_re.h"
+
+/***************************************
+ * File format
+ ***************************************/
+
+/* A snapshot file consists of the header followed by the sections
+ * it points to, each aligned to 8 bytes and in native byte order:
+ * the databases, the packages, the string offsets making up the
+ * packages’ dependency lists, a hash table of the package names for
+ * #get and finally the NUL-terminated strings. Strings are
+ * referenced by their offset into the string section. Nothing needs
+ * to be parsed to use it; it’s mapped into memory as is. */
+
+#define SNAPSHOT_MAGIC "RALPMSN"
+#define SNAPSHOT_VERSION 1
+#define NO_STRING UINT32_MAX
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t ndbs;
+  uint32_t npkgs;
+  uint32_t nslots;       /* Of the hash table, a power of two */
+  uint64_t nlist;
+  uint64_t dbs_off;
+  uint64_t pkgs_off;
+  uint64_t lists_off;
+  uint64_t hash_off;
+  uint64_t strings_off;
+  uint64_t strings_size;
+} snapshot_header_t;
+
+typedef struct {
+  uint32_t name;
+  uint32_t source;       /* The file or directory the db was read from */
+  int64_t mtime_sec;     /* Its modification time, -1 if missing */
+  int64_t mtime_nsec;
+  uint32_t first_pkg;
+  uint32_t npkgs;
+} snapshot_db_t;
+
+enum snapshot_list {
+  SNAPSHOT_DEPENDS = 0,
+  SNAPSHOT_OPTDEPENDS,
+  SNAPSHOT_PROVIDES,
+  SNAPSHOT_CONFLICTS,
+  SNAPSHOT_LIST_COUNT
+};
+
+typedef struct {
+  uint32_t name;
+  uint32_t version;
+  uint32_t desc;         /* NO_STRING if there is none */
+  uint32_t db;
+  uint64_t size;
+  uint64_t isize;
+  uint32_t lists[SNAPSHOT_LIST_COUNT][2]; /* First and count */
+} snapshot_pkg_t;
+
+/***************************************
+ * Variables
+ ***************************************/
+
+VALUE rb_cAlpm_Snapshot;
+VALUE rb_cAlpm_Snapshot_Package;
+
+/* An opened snapshot, pointing into the mapped file. */
+typedef struct {
+  void* p_map;
+  size_t size;
+  const snapshot_header_t* p_header;
+  const snapshot_db_t* p_dbs;
+  const snapshot_pkg_t* p_pkgs;
+  const uint32_t* p_lists;
+  const uint32_t* p_slots;
+  const char* strings;
+} snapshot_t;
+
+/* An Alpm::Snapshot::Package instance. */
+typedef struct {
+  VALUE snapshot;
+  uint32_t index;
+} snapshot_package_t;
+
+/***************************************
+ * Helpers
+ ***************************************/
+
+/* FNV-1a, for the name hash table. */
+static uint32_t hash_name(const char* name)
+{
+  uint32_t hash = 2166136261u;
+
+  for(; *name; name++) {
+    hash ^= (unsigned char) *name;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+/* Where libalpm reads `p_db' from: the local database directory or
+ * a sync database file below the dbpath. */
+static VALUE db_source(alpm_handle_t* p_alpm, alpm_db_t* p_db)
+{
+  const char* dbpath = alpm_option_get_dbpath(p_alpm);
+  size_t len = strlen(dbpath);
+  const char* sep = (len && dbpath[len - 1] == '/') ? "" : "/";
+
+  if (p_db == alpm_get_localdb(p_alpm))
+    return rb_sprintf("%s%slocal", dbpath, sep);
+  else
+    return rb_sprintf("%s%ssync/%s.db", dbpath, sep, alpm_db_get_name(p_db));
+}
+
+static void source_mtime(const char* path, int64_t* p_sec, int64_t* p_nsec)
+{
+  struct stat st;
+
+  if (stat(path, &st) < 0) {
+    *p_sec = -1;
+    *p_nsec = -1;
+  }
+  else {
+    *p_sec = (int64_t) st.st_mtim.tv_sec;
+    *p_nsec = (int64_t) st.st_mtim.tv_nsec;
+  }
+}
+
+/***************************************
+ * Writing
+ ***************************************/
+
+/* A growable byte buffer. */
+typedef struct {
+  char* p_data;
+  size_t len;
+  size_t capa;
+} buffer_t;
+
+static void buffer_append(buffer_t* p_buf, const void* data, size_t len)
+{
+  if (p_buf->len + len > p_buf->capa) {
+    p_buf->capa = p_buf->capa ? p_buf->capa * 2 : 4096;
+    if (p_buf->capa < p_buf->len + len)
+      p_buf->capa = p_buf->len + len;
+    REALLOC_N(p_buf->p_data, char, p_buf->capa);
+  }
+
+  memcpy(p_buf->p_data + p_buf->len, data, len);
+  p_buf->len += len;
+}
+
+/* Arguments for and state of write_body() and write_ensure(). */
+struct write_args {
+  alpm_handle_t* p_alpm;
+  alpm_db_t** p_dbs;    /* The local database, then the sync ones */
+  uint32_t ndbs;
+  const char* path;
+  VALUE tmppath;
+  buffer_t strings;
+  buffer_t dbrecs;
+  buffer_t pkgrecs;
+  buffer_t lists;
+  uint32_t* p_slots;
+  st_table* p_interned; /* string → offset, keys owned */
+  char* dep;            /* From alpm_dep_compute_string() */
+  FILE* p_file;
+};
+
+/* Offset of `str' in the string section, adding it if necessary. */
+static uint32_t intern(struct write_args* p_args, const char* str)
+{
+  st_data_t offset;
+  size_t len;
+
+  if (!str)
+    return NO_STRING;
+  if (st_lookup(p_args->p_interned, (st_data_t) str, &offset))
+    return (uint32_t) offset;
+
+  len = strlen(str) + 1;
+  if (p_args->strings.len + len >= NO_STRING)
+    rb_raise(rb_eAlpm_Error, "Too much data for a snapshot.");
+
+  offset = p_args->strings.len;
+  buffer_append(&p_args->strings, str, len);
+  st_insert(p_args->p_interned, (st_data_t) ruby_strdup(str), offset);
+
+  return (uint32_t) offset;
+}
+
+static void add_list(struct write_args* p_args, alpm_list_t* deps, uint32_t list[2])
+{
+  alpm_list_t* item = NULL;
+
+  list[0] = (uint32_t) (p_args->lists.len / sizeof(uint32_t));
+  list[1] = 0;
+
+  for(item = deps; item; item = alpm_list_next(item)) {
+    uint32_t offset;
+
+    p_args->dep = alpm_dep_compute_string((alpm_depend_t*) item->data);
+    offset = intern(p_args, p_args->dep ? p_args->dep : "");
+    free(p_args->dep);
+    p_args->dep = NULL;
+
+    buffer_append(&p_args->lists, &offset, sizeof(uint32_t));
+    list[1]++;
+  }
+}
+
+static void add_db(struct write_args* p_args, alpm_db_t* p_db, uint32_t index)
+{
+  snapshot_db_t rec;
+  alpm_list_t* item = NULL;
+  VALUE source = db_source(p_args->p_alpm, p_db);
+
+  memset(&rec, 0, sizeof(rec));
+  rec.name = intern(p_args, alpm_db_get_name(p_db));
+  rec.source = intern(p_args, StringValueCStr(source));
+  source_mtime(RSTRING_PTR(source), &rec.mtime_sec, &rec.mtime_nsec);
+  rec.first_pkg = (uint32_t) (p_args->pkgrecs.len / sizeof(snapshot_pkg_t));
+
+  for(item = alpm_db_get_pkgcache(p_db); item; item = alpm_list_next(item)) {
+    alpm_pkg_t* p_pkg = (alpm_pkg_t*) item->data;
+    snapshot_pkg_t pkg;
+
+    memset(&pkg, 0, sizeof(pkg));
+    pkg.name = intern(p_args, alpm_pkg_get_name(p_pkg));
+    pkg.version = intern(p_args, alpm_pkg_get_version(p_pkg));
+    pkg.desc = intern(p_args, alpm_pkg_get_desc(p_pkg));
+    pkg.db = index;
+    pkg.size = (uint64_t) alpm_pkg_get_size(p_pkg);
+    pkg.isize = (uint64_t) alpm_pkg_get_isize(p_pkg);
+    add_list(p_args, alpm_pkg_get_depends(p_pkg), pkg.lists[SNAPSHOT_DEPENDS]);
+    add_list(p_args, alpm_pkg_get_optdepends(p_pkg), pkg.lists[SNAPSHOT_OPTDEPENDS]);
+    add_list(p_args, alpm_pkg_get_provides(p_pkg), pkg.lists[SNAPSHOT_PROVIDES]);
+    add_list(p_args, alpm_pkg_get_conflicts(p_pkg), pkg.lists[SNAPSHOT_CONFLICTS]);
+
+    buffer_append(&p_args->pkgrecs, &pkg, sizeof(pkg));
+    rec.npkgs++;
+  }
+
+  buffer_append(&p_args->dbrecs, &rec, sizeof(rec));
+}
+
+/* Writes `len' bytes and pads to 8 bytes, updating `*p_off'. */
+static int write_section(FILE* p_file, const void* data, size_t len, uint64_t* p_off)
+{
+  static const char zeros[8] = {0};
+  size_t pad = (8 - len % 8) % 8;
+
+  if (len && fwrite(data, 1, len, p_file) != len)
+    return 0;
+  if (pad && fwrite(zeros, 1, pad, p_file) != pad)
+    return 0;
+
+  *p_off += len + pad;
+  return 1;
+}
+
+static VALUE write_body(VALUE ptr)
+{
+  struct write_args* p_args = (struct write_args*) ptr;
+  snapshot_header_t header;
+  const snapshot_pkg_t* p_pkgs = NULL;
+  uint64_t off;
+  uint32_t npkgs, nslots, i;
+  int ok;
+
+  p_args->p_interned = st_init_strtable();
+  intern(p_args, ""); /* Offset 0, so the section is never empty */
+
+  for(i=0; i < p_args->ndbs; i++)
+    add_db(p_args, p_args->p_dbs[i], i);
+
+  /* Hash table of the names, twice as large as needed. Equal names
+   * are probed in database order. */
+  npkgs = (uint32_t) (p_args->pkgrecs.len / sizeof(snapshot_pkg_t));
+  for(nslots = 1; nslots < 2 * (uint64_t) npkgs; nslots *= 2)
+    ;
+  p_args->p_slots = ZALLOC_N(uint32_t, nslots);
+  p_pkgs = (const snapshot_pkg_t*) p_args->pkgrecs.p_data;
+
+  for(i=0; i < npkgs; i++) {
+    uint32_t slot = hash_name(p_args->strings.p_data + p_pkgs[i].name) & (nslots - 1);
+
+    while (p_args->p_slots[slot])
+      slot = (slot + 1) & (nslots - 1);
+    p_args->p_slots[slot] = i + 1;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  header.version = SNAPSHOT_VERSION;
+  header.ndbs = p_args->ndbs;
+  header.npkgs = npkgs;
+  header.nslots = nslots;
+  header.nlist = p_args->lists.len / sizeof(uint32_t);
+
+  off = sizeof(header);
+  header.dbs_off = off;
+  off += (p_args->dbrecs.len + 7) / 8 * 8;
+  header.pkgs_off = off;
+  off += (p_args->pkgrecs.len + 7) / 8 * 8;
+  header.lists_off = off;
+  off += (p_args->lists.len + 7) / 8 * 8;
+  header.hash_off = off;
+  off += ((size_t) nslots * sizeof(uint32_t) + 7) / 8 * 8;
+  header.strings_off = off;
+  header.strings_size = p_args->strings.len;
+
+  p_args->tmppath = rb_sprintf("%s.%d.tmp", p_args->path, (int) getpid());
+  p_args->p_file = fopen(StringValueCStr(p_args->tmppath), "wb");
+  if (!p_args->p_file)
+    rb_sys_fail(RSTRING_PTR(p_args->tmppath));
+
+  off = 0;
+  ok = write_section(p_args->p_file, &header, sizeof(header), &off)
+    && write_section(p_args->p_file, p_args->dbrecs.p_data, p_args->dbrecs.len, &off)
+    && write_section(p_args->p_file, p_args->pkgrecs.p_data, p_args->pkgrecs.len, &off)
+    && write_section(p_args->p_file, p_args->lists.p_data, p_args->lists.len, &off)
+    && write_section(p_args->p_file, p_args->p_slots, (size_t) nslots * sizeof(uint32_t), &off)
+    && write_section(p_args->p_file, p_args->strings.p_data, p_args->strings.len, &off);
+
+  if (fclose(p_args->p_file) != 0)
+    ok = 0;
+  p_args->p_file = NULL;
+
+  if (!ok || rename(RSTRING_PTR(p_args->tmppath), p_args->path) < 0) {
+    int err = errno;
+    unlink(RSTRING_PTR(p_args->tmppath));
+    errno = err;
+    rb_sys_fail(p_args->path);
+  }
+
+  return Qnil;
+}
+
+static int free_interned(st_data_t key, st_data_t value, st_data_t arg)
+{
+  xfree((char*) key);
+  return ST_CONTINUE;
+}
+
+static VALUE write_ensure(VALUE ptr)
+{
+  struct write_args* p_args = (struct write_args*) ptr;
+
+  if (p_args->p_file) {
+    fclose(p_args->p_file);
+    unlink(RSTRING_PTR(p_args->tmppath));
+  }
+  if (p_args->p_interned) {
+    st_foreach(p_args->p_interned, free_interned, 0);
+    st_free_table(p_args->p_interned);
+  }
+  free(p_args->dep);
+  xfree(p_args->strings.p_data);
+  xfree(p_args->dbrecs.p_data);
+  xfree(p_args->pkgrecs.p_data);
+  xfree(p_args->lists.p_data);
+  xfree(p_args->p_slots);
+  xfree(p_args->p_dbs);
+
+  return Qnil;
+}
+
+/***************************************
+ * Reading
+ ***************************************/
+
+static void free_snapshot(void* ptr)
+{
+  snapshot_t* p_snap = (snapshot_t*) ptr;
+
+  if (p_snap->p_map)
+    munmap(p_snap->p_map, p_snap->size);
+  xfree(p_snap);
+}
+
+static int section_ok(const snapshot_header_t* p_header, size_t size, uint64_t off, uint64_t len)
+{
+  return off % 8 == 0 && off >= sizeof(snapshot_header_t) && off <= size && len <= size - off;
+}
+
+static int string_ok(const snapshot_header_t* p_header, uint32_t offset)
+{
+  return offset < p_header->strings_size;
+}
+
+/* Checks that every offset in the mapped file stays within it, so
+ * that corrupt files can’t make us read out of bounds later. */
+static int validate(snapshot_t* p_snap)
+{
+  const snapshot_header_t* p_header = p_snap->p_header;
+  uint64_t i;
+  int k;
+
+  if (p_snap->size < sizeof(snapshot_header_t)
+      || memcmp(p_header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0
+      || p_header->version != SNAPSHOT_VERSION
+      || p_header->nslots == 0 || (p_header->nslots & (p_header->nslots - 1)) != 0
+      || p_header->nlist > UINT32_MAX)
+    return 0;
+
+  if (!section_ok(p_header, p_snap->size, p_header->dbs_off, (uint64_t) p_header->ndbs * sizeof(snapshot_db_t))
+      || !section_ok(p_header, p_snap->size, p_header->pkgs_off, (uint64_t) p_header->npkgs * sizeof(snapshot_pkg_t))
+      || !section_ok(p_header, p_snap->size, p_header->lists_off, p_header->nlist * sizeof(uint32_t))
+      || !section_ok(p_header, p_snap->size, p_header->hash_off, (uint64_t) p_header->nslots * sizeof(uint32_t))
+      || !section_ok(p_header, p_snap->size, p_header->strings_off, p_header->strings_size)
+      || p_header->strings_size == 0)
+    return 0;
+
+  p_snap->p_dbs = (const snapshot_db_t*) ((const char*) p_snap->p_map + p_header->dbs_off);
+  p_snap->p_pkgs = (const snapshot_pkg_t*) ((const char*) p_snap->p_map + p_header->pkgs_off);
+  p_snap->p_lists = (const uint32_t*) ((const char*) p_snap->p_map + p_header->lists_off);
+  p_snap->p_slots = (const uint32_t*) ((const char*) p_snap->p_map + p_header->hash_off);
+  p_snap->strings = (const char*) p_snap->p_map + p_header->strings_off;
+
+  if (p_snap->strings[p_header->strings_size - 1] != '\0')
+    return 0;
+
+  for(i=0; i < p_header->ndbs; i++) {
+    const snapshot_db_t* p_db = &p_snap->p_dbs[i];
+
+    if (!string_ok(p_header, p_db->name) || !string_ok(p_header, p_db->source)
+        || p_db->first_pkg > p_header->npkgs || p_db->npkgs > p_header->npkgs - p_db->first_pkg)
+      return 0;
+  }
+
+  for(i=0; i < p_header->npkgs; i++) {
+    const snapshot_pkg_t* p_pkg = &p_snap->p_pkgs[i];
+
+    if (!string_ok(p_header, p_pkg->name) || !string_ok(p_header, p_pkg->version)
+        || (p_pkg->desc != NO_STRING && !string_ok(p_header, p_pkg->desc))
+        || p_pkg->db >= p_header->ndbs)
+      return 0;
+
+    for(k=0; k < SNAPSHOT_LIST_COUNT; k++) {
+      if (p_pkg->lists[k][0] > p_header->nlist || p_pkg->lists[k][1] > p_header->nlist - p_pkg->lists[k][0])
+        return 0;
+    }
+  }
+
+  for(i=0; i < p_header->nlist; i++) {
+    if (!string_ok(p_header, p_snap->p_lists[i]))
+      return 0;
+  }
+
+  for(i=0; i < p_header->nslots; i++) {
+    if (p_snap->p_slots[i] > p_header->npkgs)
+      return 0;
+  }
+
+  return 1;
+}
+
+/* Whether the databases changed since the snapshot was written. */
+static int stale(snapshot_t* p_snap)
+{
+  uint32_t i;
+
+  for(i=0; i < p_snap->p_header->ndbs; i++) {
+    const snapshot_db_t* p_db = &p_snap->p_dbs[i];
+    int64_t sec, nsec;
+
+    /* A file that was missing then and still is, like that of a
+     * never synced database, is unchanged (both -1). */
+    source_mtime(p_snap->strings + p_db->source, &sec, &nsec);
+    if (sec != p_db->mtime_sec || nsec != p_db->mtime_nsec)
+      return 1;
+  }
+
+  return 0;
+}
+
+static snapshot_t* get_snapshot(VALUE self)
+{
+  snapshot_t* p_snap = NULL;
+  Data_Get_Struct(self, snapshot_t, p_snap);
+  return p_snap;
+}
+
+static void mark_package(void* ptr)
+{
+  snapshot_package_t* p_package = (snapshot_package_t*) ptr;
+  rb_gc_mark(p_package->snapshot);
+}
+
+static VALUE wrap_snapshot_package(VALUE snapshot, uint32_t index)
+{
+  snapshot_package_t* p_package = NULL;
+  VALUE obj = Data_Make_Struct(rb_cAlpm_Snapshot_Package, snapshot_package_t, mark_package, RUBY_DEFAULT_FREE, p_package);
+
+  p_package->snapshot = snapshot;
+  p_package->index = index;
+  return obj;
+}
+
+static const snapshot_pkg_t* get_package(VALUE self, snapshot_t** pp_snap)
+{
+  snapshot_package_t* p_package = NULL;
+
+  Data_Get_Struct(self, snapshot_package_t, p_package);
+  *pp_snap = get_snapshot(p_package->snapshot);
+  return &(*pp_snap)->p_pkgs[p_package->index];
+}
+
+static VALUE snapshot_str(snapshot_t* p_snap, uint32_t offset)
+{
+  if (offset == NO_STRING)
+    return Qnil;
+  return frozen_utf8_str(p_snap->strings + offset);
+}
+
+/* Index of the database called `name', or -1 for nil. */
+static long db_from_ruby(snapshot_t* p_snap, VALUE name)
+{
+  uint32_t i;
+
+  if (NIL_P(name))
+    return -1;
+
+  for(i=0; i < p_snap->p_header->ndbs; i++) {
+    if (strcmp(p_snap->strings + p_snap->p_dbs[i].name, StringValueCStr(name)) == 0)
+      return i;
+  }
+
+  rb_raise(rb_eArgError, "No database %s in the snapshot", StringValueCStr(name));
+  return -1;
+}
+
+static VALUE db_from_opts(VALUE opts)
+{
+  VALUE kwval = Qundef;
+  ID kwname = rb_intern("db");
+
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, &kwname, 0, 1, &kwval);
+
+  return kwval == Qundef ? Qnil : kwval;
+}
+
+/***************************************
+ * Interface
+ ***************************************/
+
+/** Writes the packages of the local and all sync databases of
+ * `rb_alpm' to a snapshot file at `path', replacing it
+ * atomically. */
+void snapshot_write(VALUE rb_alpm, const char* path)
+{
+  struct write_args args;
+  alpm_list_t* item = NULL;
+  alpm_list_t* syncdbs = NULL;
+
+  memset(&args, 0, sizeof(struct write_args));
+  Data_Get_Struct(rb_alpm, alpm_handle_t, args.p_alpm);
+  args.path = path;
+  args.tmppath = Qnil;
+
+  syncdbs = alpm_get_syncdbs(args.p_alpm);
+  args.p_dbs = ALLOC_N(alpm_db_t*, alpm_list_count(syncdbs) + 1);
+  args.p_dbs[args.ndbs++] = alpm_get_localdb(args.p_alpm);
+  for(item = syncdbs; item; item = alpm_list_next(item))
+    args.p_dbs[args.ndbs++] = (alpm_db_t*) item->data;
+
+  rb_ensure(write_body, (VALUE) &args, write_ensure, (VALUE) &args);
+}
+
+/** Maps the snapshot file at `path' into memory. Returns Qnil if
+ * `check' is set and its databases changed since it was written;
+ * raises if it can’t be read or isn’t a valid snapshot. */
+VALUE snapshot_open(const char* path, int check)
+{
+  snapshot_t* p_snap = ZALLOC(snapshot_t);
+  VALUE obj = Data_Wrap_Struct(rb_cAlpm_Snapshot, NULL, free_snapshot, p_snap);
+  struct stat st;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+    rb_sys_fail(path);
+  if (fstat(fd, &st) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    rb_sys_fail(path);
+  }
+
+  if (st.st_size > 0) {
+    p_snap->p_map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p_snap->p_map == MAP_FAILED) {
+      int err = errno;
+      p_snap->p_map = NULL;
+      close(fd);
+      errno = err;
+      rb_sys_fail(path);
+    }
+    p_snap->size = (size_t) st.st_size;
+    p_snap->p_header = (const snapshot_header_t*) p_snap->p_map;
+  }
+  close(fd);
+
+  if (!p_snap->p_map || !validate(p_snap))
+    rb_raise(rb_eAlpm_Error, "Not a valid snapshot: %s", path);
+  if (check && stale(p_snap))
+    return Qnil;
+
+  return obj;
+}
+
+/***************************************
+ * Snapshot methods
+ ***************************************/
+
+/**
+ * call-seq:
+ *   databases() → an_array
+ *
+ * Names of the databases in the snapshot, the local one first.
+ */
+static VALUE databases(VALUE self)
+{
+  snapshot_t* p_snap = get_snapshot(self);
+  VALUE result = rb_ary_new_capa(p_snap->p_header->ndbs);
+  uint32_t i;
+
+  for(i=0; i < p_snap->p_header->ndbs; i++)
+    rb_ary_push(result, snapshot_str(p_snap, p_snap->p_dbs[i].name));
+
+  return result;
+}
+
+/**
+ * call-seq:
+ *   size() → an_integer
+ *
+ * Number of packages in all databases of the snapshot.
+ */
+static VALUE size(VALUE self)
+{
+  return UINT2NUM(get_snapshot(self)->p_header->npkgs);
+}
+
+/**
+ * call-seq:
+ *   get( name [, db: nil ] ) → a_package or nil
+ *
+ * Looks up a package by name with a single hash table probe.
+ *
+ * === Parameters
+ * [name]
+ *   The package name.
+ * [db (nil)]
+ *   The name of the database to look in. By default, the package
+ *   from the first database that has it is returned.
+ *
+ * === Return value
+ * A Snapshot::Package, or +nil+ if there is none of that name.
+ */
+static VALUE get(int argc, VALUE argv[], VALUE self)
+{
+  snapshot_t* p_snap = get_snapshot(self);
+  uint32_t mask = p_snap->p_header->nslots - 1;
+  VALUE name, opts;
+  const char* cname;
+  uint32_t slot, probes;
+  long db;
+
+  rb_scan_args(argc, argv, "1:", &name, &opts);
+  db = db_from_ruby(p_snap, db_from_opts(opts));
+  cname = StringValueCStr(name);
+
+  slot = hash_name(cname) & mask;
+  for(probes=0; probes <= mask && p_snap->p_slots[slot]; probes++, slot = (slot + 1) & mask) {
+    uint32_t index = p_snap->p_slots[slot] - 1;
+    const snapshot_pkg_t* p_pkg = &p_snap->p_pkgs[index];
+
+    if (strcmp(p_snap->strings + p_pkg->name, cname) == 0 && (db < 0 || p_pkg->db == (uint32_t) db))
+      return wrap_snapshot_package(self, index);
+  }
+
+  return Qnil;
+}
+
+/* Range of package indices to look at for the db: option. */
+static void package_range(snapshot_t* p_snap, long db, uint32_t* p_first, uint32_t* p_end)
+{
+  if (db < 0) {
+    *p_first = 0;
+    *p_end = p_snap->p_header->npkgs;
+  }
+  else {
+    *p_first = p_snap->p_dbs[db].first_pkg;
+    *p_end = p_snap->p_dbs[db].first_pkg + p_snap->p_dbs[db].npkgs;
+  }
+}
+
+/**
+ * call-seq:
+ *   each_package( [ db: nil ] ){|pkg| ...}
+ *   each_package( [ db: nil ] ) → an_enumerator
+ *
+ * Iterates over the Snapshot::Package instances of all databases,
+ * or only of the database named +db+.
+ */
+static VALUE each_package(int argc, VALUE argv[], VALUE self)
+{
+  snapshot_t* p_snap = get_snapshot(self);
+  VALUE opts;
+  uint32_t first, end, i;
+
+  RETURN_ENUMERATOR(self, argc, argv);
+  rb_scan_args(argc, argv, "0:", &opts);
+  package_range(p_snap, db_from_ruby(p_snap, db_from_opts(opts)), &first, &end);
+
+  for(i=first; i < end; i++)
+    rb_yield(wrap_snapshot_package(self, i));
+
+  return self;
+}
+
+/* Arguments for and state of search_body() and search_ensure(). */
+struct search_args {
+  VALUE self;
+  VALUE terms;
+  long db;
+  posix_re_t** p_res;
+  long nres;
+};
+
+static VALUE search_body(VALUE ptr)
+{
+  struct search_args* p_args = (struct search_args*) ptr;
+  snapshot_t* p_snap = get_snapshot(p_args->self);
+  VALUE result = rb_ary_new();
+  uint32_t first, end, i;
+  long j;
+
+  for(j=0; j < RARRAY_LEN(p_args->terms); j++) {
+    VALUE term = rb_ary_entry(p_args->terms, j);
+    char buf[256] = "out of memory";
+
+    if (!(p_args->p_res[j] = posix_re_compile(StringValueCStr(term), buf, sizeof(buf)))) /* Single = intended */
+      rb_raise(rb_eArgError, "Invalid regular expression %s: %s", StringValueCStr(term), buf);
+    p_args->nres++;
+  }
+
+  package_range(p_snap, p_args->db, &first, &end);
+  for(i=first; i < end; i++) {
+    const snapshot_pkg_t* p_pkg = &p_snap->p_pkgs[i];
+    const char* name = p_snap->strings + p_pkg->name;
+    const char* desc = p_pkg->desc == NO_STRING ? NULL : p_snap->strings + p_pkg->desc;
+
+    for(j=0; j < p_args->nres; j++) {
+      if (!posix_re_match(p_args->p_res[j], name) && !(desc && posix_re_match(p_args->p_res[j], desc)))
+        break;
+    }
+
+    if (j == p_args->nres)
+      rb_ary_push(result, wrap_snapshot_package(p_args->self, i));
+  }
+
+  return result;
+}
+
+static VALUE search_ensure(VALUE ptr)
+{
+  struct search_args* p_args = (struct search_args*) ptr;
+  long j;
+
+  for(j=0; j < p_args->nres; j++)
+    posix_re_free(p_args->p_res[j]);
+  xfree(p_args->p_res);
+
+  return Qnil;
+}
+
+/**
+ * call-seq:
+ *   search( *terms [, db: nil ] ) → an_array
+ *
+ * Like Database#search: finds the packages whose name or
+ * description matches all +terms+, case-insensitive POSIX extended
+ * regular expressions. Unlike Database#search, provisions aren’t
+ * taken into account.
+ *
+ * === Return value
+ * An array of Snapshot::Package instances.
+ */
+static VALUE search(int argc, VALUE argv[], VALUE self)
+{
+  struct search_args args;
+  VALUE opts;
+
+  rb_scan_args(argc, argv, "*:", &args.terms, &opts);
+  args.self = self;
+  args.db = db_from_ruby(get_snapshot(self), db_from_opts(opts));
+  args.p_res = ALLOC_N(posix_re_t*, RARRAY_LEN(args.terms) ? RARRAY_LEN(args.terms) : 1);
+  args.nres = 0;
+
+  return rb_ensure(search_body, (VALUE) &args, search_ensure, (VALUE) &args);
+}
+
+/**
+ * call-seq:
+ *   inspect() → a_string
+ *
+ * Human-readable description.
+ */
+static VALUE inspect(VALUE self)
+{
+  snapshot_t* p_snap = get_snapshot(self);
+  return rb_sprintf("#<%s %u databases, %u packages>", rb_obj_classname(self), p_snap->p_header->ndbs, p_snap->p_header->npkgs);
+}
+
+/***************************************
+ * Snapshot::Package methods
+ ***************************************/
+
+/**
+ * call-seq:
+ *   name() → a_frozen_string
+ *
+ * Name of the package.
+ */
+static VALUE pkg_name(VALUE self)
+{
+  snapshot_t* p_snap = NULL;
+  const snapshot_pkg_t* p_pkg = get_package(self, &p_snap);
+  return snapshot_str(p_snap, p_pkg->name);
+}
+
+/**
+ * call-seq:
+ *   version() → a_frozen_string
+ *
+ * Version number of the package.
+ */
+static VALUE pkg_version(VALUE self)
+{
+  snapshot_t* p_snap = NULL;
+  const snapshot_pkg_t* p_pkg = get_package(self, &p_snap);
+  return snapshot_str(p_snap, p_pkg->version);
+}
+
+/**
+ * call-seq:
+ *   description() → a_frozen_string or nil
+ *
+ * Description of the package.
+ */
+static VALUE pkg_description(VALUE self)
+{
+  snapshot_t* p_snap = NULL;
+  const snapshot_pkg_t* p_pkg = get_package(self, &p_snap);
+  return snapshot_str(p_snap, p_pkg->desc);
+}
+
+/**
+ * call-seq:
+ *   db() → a_frozen_string
+ *
+ * Name of the database the package is from.
+ */
+static VALUE pkg_db(VALUE self)
+{
+  snapshot_t* p_snap = NULL;
+  const snapshot_pkg_t* p_pkg = get_package(self, &p_snap);
+  return snapshot_str(p_snap, p_snap->p_dbs[p_pkg->db].name);
+}
+
+/**
+ * call-seq:
+ *   size() → an_integer
+ *
+ * Size of the package file in bytes.
+ */
+static VALUE pkg_size(VALUE self)
+{
+  snapshot_t* p_snap = NULL;
+  return ULL2NUM(get_package(self, &p_snap)->size);
+}
+
+/**
+ * call-seq:
+ *   installed_size() → an_integer
+ *
+ * Size of the installed package in bytes.
+ */
+static VALUE pkg_installed_size(VALUE self)
+{
+  snapshot_t* p_snap = NULL;
+  return ULL2NUM(get_package(self, &p_snap)->isize);
+}
+
+static VALUE pkg_list(VALUE self, enum snapshot_list list)
+{
+  snapshot_t* p_snap = NULL;
+  const snapshot_pkg_t* p_pkg = get_package(self, &p_snap);
+  VALUE result = rb_ary_new_capa(p_pkg->lists[list][1]);
+  uint32_t i;
+
+  for(i=0; i < p_pkg->lists[list][1]; i++)
+    rb_ary_push(result, snapshot_str(p_snap, p_snap->p_lists[p_pkg->lists[list][0] + i]));
+
+  return result;
+}
+
+/**
+ * call-seq:
+ *   depends() → an_array
+ *
+ * Dependencies of the package, as strings like <tt>"glibc>=2.17"</tt>.
+ */
+static VALUE pkg_depends(VALUE self)
+{
+  return pkg_list(self, SNAPSHOT_DEPENDS);
+}
+
+/**
+ * call-seq:
+ *   optdepends() → an_array
+ *
+ * Optional dependencies of the package, as strings.
+ */
+static VALUE pkg_optdepends(VALUE self)
+{
+  return pkg_list(self, SNAPSHOT_OPTDEPENDS);
+}
+
+/**
+ * call-seq:
+ *   provides() → an_array
+ *
+ * Provisions of the package, as strings.
+ */
+static VALUE pkg_provides(VALUE self)
+{
+  return pkg_list(self, SNAPSHOT_PROVIDES);
+}
+
+/**
+ * call-seq:
+ *   conflicts() → an_array
+ *
+ * Conflicts of the package, as strings.
+ */
+static VALUE pkg_conflicts(VALUE self)
+{
+  return pkg_list(self, SNAPSHOT_CONFLICTS);
+}
+
+/**
+ * call-seq:
+ *   inspect() → a_string
+ *
+ * Human-readable description.
+ */
+static VALUE pkg_inspect(VALUE self)
+{
+  snapshot_t* p_snap = NULL;
+  const snapshot_pkg_t* p_pkg = get_package(self, &p_snap);
+
+  return rb_sprintf("#<%s %s-%s (%s)>", rb_obj_classname(self),
+                    p_snap->strings + p_pkg->name, p_snap->strings + p_pkg->version,
+                    p_snap->strings + p_snap->p_dbs[p_pkg->db].name);
+}
+
+/***************************************
+ * Binding
+ ***************************************/
+
+/**
+ * Document-class: Alpm::Snapshot
+ *
+ * A read-only copy of the package metadata of all databases, as
+ * written by Alpm#write_snapshot and opened with Alpm.open_snapshot.
+ * The file is mapped into memory as is, so opening it and looking up
+ * packages needs neither libalpm nor any parsing, which makes it
+ * suitable for short-lived processes that only query metadata.
+ */
+
+/**
+ * Document-class: Alpm::Snapshot::Package
+ *
+ * A package in an Alpm::Snapshot. It offers a subset of the
+ * attributes of Alpm::Package, read straight from the snapshot.
+ */
+void Init_snapshot()
+{
+  rb_cAlpm_Snapshot = rb_define_class_under(rb_cAlpm, "Snapshot", rb_cObject);
+  rb_undef_alloc_func(rb_cAlpm_Snapshot);
+  rb_cAlpm_Snapshot_Package = rb_define_class_under(rb_cAlpm_Snapshot, "Package", rb_cObject);
+  rb_undef_alloc_func(rb_cAlpm_Snapshot_Package);
+
+  rb_define_method(rb_cAlpm_Snapshot, "databases", RUBY_METHOD_FUNC(databases), 0);
+  rb_define_method(rb_cAlpm_Snapshot, "size", RUBY_METHOD_FUNC(size), 0);
+  rb_define_method(rb_cAlpm_Snapshot, "get", RUBY_METHOD_FUNC(get), -1);
+  rb_define_method(rb_cAlpm_Snapshot, "each_package", RUBY_METHOD_FUNC(each_package), -1);
+  rb_define_method(rb_cAlpm_Snapshot, "search", RUBY_METHOD_FUNC(search), -1);
+  rb_define_method(rb_cAlpm_Snapshot, "inspect", RUBY_METHOD_FUNC(inspect), 0);
+
+  rb_define_method(rb_cAlpm_Snapshot_Package, "name", RUBY_METHOD_FUNC(pkg_name), 0);
+  rb_define_method(rb_cAlpm_Snapshot_Package, "version", RUBY_METHOD_FUNC(pkg_version), 0);
+  rb_define_method(rb_cAlpm_Snapshot_Package, "description", RUBY_METHOD_FUNC(pkg_description), 0);
+  rb_define_method(rb_cAlpm_Snapshot_Package, "db", RUBY_METHOD_FUNC(pkg_db), 0);
+  rb_define_method(rb_cAlpm_Snapshot_Package, "size", RUBY_METHOD_FUNC(pkg_size), 0);
+  rb_define_method(rb_cAlpm_Snapshot_Package, "installed_size", RUBY_METHOD_FUNC(pkg_installed_size), 0);
+  rb_define_method(rb_cAlpm_Snapshot_Package, "depends", RUBY_METHOD_FUNC(pkg_depends), 0);
+  rb_define_method(rb_cAlpm_Snapshot_Package, "optdepends", RUBY_METHOD_FUNC(pkg_optdepends), 0);
+  rb_define_method(rb_cAlpm_Snapshot_Package, "provides", RUBY_METHOD_FUNC(pkg_provides), 0);
+  rb_define_method(rb_cAlpm_Snapshot_Package, "conflicts", RUBY_METHOD_FUNC(pkg_conflicts), 0);
+  rb_define_method(rb_cAlpm_Snapshot_Package, "inspect", RUBY_METHOD_FUNC(pkg_inspect), 0);
+
+  rb_define_alias(rb_cAlpm_Snapshot_Package, "desc", "description");
+  rb_define_alias(rb_cAlpm_Snapshot_Package, "isize", "installed_size");
+}
@@ -0,0 +1,12 @@
+#ifndef RUBY_ALPM_SNAPSHOT_H
+#define RUBY_ALPM_SNAPSHOT_H
+#include "main.h"
+
+extern VALUE rb_cAlpm_Snapshot;
+extern VALUE rb_cAlpm_Snapshot_Package;
+
+void snapshot_write(VALUE rb_alpm, const char* path);
+VALUE snapshot_open(const char* path, int check);
+void Init_snapshot();
+
+#endif
@@ -1,10 +1,50 @@
+#include <stdlib.h>
 #include "transaction.h"
+#include "database.h"
+#include "list.h"
+#include "flags.h"
+#include "log.h"
 
 /***************************************
  * Variables, etc
  ***************************************/
 
 VALUE rb_cAlpm_Transaction;
+VALUE rb_cAlpm_Transaction_Event;
+VALUE rb_eAlpm_TransactionError;
+
+static VALUE rb_cMissingDependency;
+static VALUE rb_cConflict;
+static VALUE rb_cFileConflict;
+
+/* Hidden instance variable of an Alpm instance holding the receiver
+ * of its transaction’s events, see #events. libalpm’s event and
+ * progress callbacks have no context pointer, but they only run from
+ * #prepare and #commit on the calling thread, so that one keeps the
+ * Alpm instance in a Ruby thread-local for them to find it. */
+static ID s_id_event_receiver;
+static ID s_id_events_alpm;
+
+/* Event type symbols, indexed by alpm_event_t and alpm_progress_t. */
+#define EVENT_TYPE_COUNT (ALPM_EVENT_KEY_DOWNLOAD_DONE + 1)
+#define PROGRESS_TYPE_COUNT (ALPM_PROGRESS_KEYRING_START + 1)
+static VALUE event_types[EVENT_TYPE_COUNT];
+static VALUE progress_types[PROGRESS_TYPE_COUNT];
+
+/* An event or progress report as received from libalpm, converted
+ * to an Event once the GVL is held. Pointers are only valid during
+ * the callback. */
+struct trans_event {
+  VALUE type;
+  const char* package;
+  const char* detail;
+  alpm_depend_t* p_depend;
+  int percent;
+  size_t current;
+  size_t total;
+  int is_progress;
+  double time;
+};
 
 /** Retrieves the associated Ruby Alpm instance from the given Package
  * instance, reads the C alpm_handle_t pointer from it and returns that
@@ -18,6 +58,307 @@ static alpm_handle_t* get_alpm_from_trans(VALUE trans)
   return p_handle;
 }
 
+/***************************************
+ * Callbacks
+ ***************************************/
+
+static VALUE deliver_event(VALUE ptr)
+{
+  struct trans_event* p_event = (struct trans_event*) ptr;
+  VALUE rb_alpm = rb_thread_local_aref(rb_thread_current(), s_id_events_alpm);
+  VALUE receiver = Qnil;
+  VALUE detail = Qnil;
+  VALUE event;
+  char* str;
+
+  if (!NIL_P(rb_alpm))
+    receiver = rb_attr_get(rb_alpm, s_id_event_receiver);
+  if (NIL_P(receiver))
+    return Qnil;
+
+  if (p_event->p_depend) {
+    str = alpm_dep_compute_string(p_event->p_depend);
+    detail = rb_str_new2(str);
+    free(str);
+  }
+  else if (p_event->detail)
+    detail = rb_str_new2(p_event->detail);
+
+  event = rb_struct_new(rb_cAlpm_Transaction_Event,
+                        p_event->type,
+                        p_event->package ? rb_str_new2(p_event->package) : Qnil,
+                        p_event->is_progress ? INT2NUM(p_event->percent) : Qnil,
+                        p_event->is_progress ? SIZET2NUM(p_event->current) : Qnil,
+                        p_event->is_progress ? SIZET2NUM(p_event->total) : Qnil,
+                        detail,
+                        rb_float_new(p_event->time));
+
+  if (rb_obj_is_proc(receiver))
+    return rb_funcall(receiver, rb_intern("call"), 1, event);
+  else
+    return rb_funcall(receiver, rb_intern("push"), 1, event);
+}
+
+static void* deliver_event_with_gvl(void* ptr)
+{
+  protect_callback(deliver_event, (VALUE) ptr);
+  return NULL;
+}
+
+/* Event callback handed to libalpm. What `data1' and `data2' point
+ * to depends on the event. */
+static void event_callback(alpm_event_t type, void* data1, void* data2)
+{
+  struct trans_event event = {Qnil, NULL, NULL, NULL, 0, 0, 0, 0, 0.0};
+
+  if (type < 0 || type >= EVENT_TYPE_COUNT)
+    return;
+
+  event.type = event_types[type];
+  event.time = now();
+
+  switch(type) {
+  case ALPM_EVENT_ADD_START:
+  case ALPM_EVENT_ADD_DONE:
+  case ALPM_EVENT_REMOVE_START:
+  case ALPM_EVENT_REMOVE_DONE:
+  case ALPM_EVENT_UPGRADE_START:
+  case ALPM_EVENT_UPGRADE_DONE:
+  case ALPM_EVENT_DOWNGRADE_START:
+  case ALPM_EVENT_DOWNGRADE_DONE:
+  case ALPM_EVENT_REINSTALL_START:
+  case ALPM_EVENT_REINSTALL_DONE:
+    /* data1 is the (new) package */
+    event.package = alpm_pkg_get_name((alpm_pkg_t*) data1);
+    break;
+  case ALPM_EVENT_OPTDEP_REQUIRED:
+    event.package = alpm_pkg_get_name((alpm_pkg_t*) data1);
+    event.p_depend = (alpm_depend_t*) data2;
+    break;
+  case ALPM_EVENT_DELTA_PATCH_START:
+    event.package = (const char*) data1;
+    event.detail = (const char*) data2;
+    break;
+  case ALPM_EVENT_SCRIPTLET_INFO:
+  case ALPM_EVENT_DATABASE_MISSING:
+  case ALPM_EVENT_RETRIEVE_START:
+    event.detail = (const char*) data1;
+    break;
+  default:
+    break;
+  }
+
+  call_with_gvl(deliver_event_with_gvl, &event);
+}
+
+/* Progress callback handed to libalpm. */
+static void progress_callback(alpm_progress_t type, const char* pkgname, int percent, size_t howmany, size_t current)
+{
+  struct trans_event event = {Qnil, NULL, NULL, NULL, 0, 0, 0, 1, 0.0};
+
+  if (type < 0 || type >= PROGRESS_TYPE_COUNT)
+    return;
+
+  event.type = progress_types[type];
+  event.time = now();
+  event.package = pkgname && *pkgname ? pkgname : NULL;
+  event.percent = percent;
+  event.current = current;
+  event.total = howmany;
+
+  call_with_gvl(deliver_event_with_gvl, &event);
+}
+
+/** Stops delivering the events of `rb_alpm'’s transaction. Called
+ * when the transaction ends. */
+void transaction_events_reset(VALUE rb_alpm)
+{
+  alpm_handle_t* p_alpm = NULL;
+
+  Data_Get_Struct(rb_alpm, alpm_handle_t, p_alpm);
+  alpm_option_set_eventcb(p_alpm, NULL);
+  alpm_option_set_progresscb(p_alpm, NULL);
+  rb_ivar_set(rb_alpm, s_id_event_receiver, Qnil);
+}
+
+/***************************************
+ * Problems
+ ***************************************/
+
+/* The list libalpm hands back from a failed prepare or commit,
+ * whose item type depends on the error. */
+struct problem_list {
+  alpm_errno_t err;
+  alpm_list_t* p_data;
+};
+
+static VALUE dep_to_str(alpm_depend_t* p_dep)
+{
+  char* str;
+  VALUE result;
+
+  if (!p_dep)
+    return Qnil;
+
+  str = alpm_dep_compute_string(p_dep);
+  result = rb_str_new2(str);
+  free(str);
+  return result;
+}
+
+static VALUE problems_to_ary(VALUE ptr)
+{
+  struct problem_list* p_problems = (struct problem_list*) ptr;
+  alpm_list_t* item = NULL;
+  VALUE result = rb_ary_new();
+  VALUE problem;
+
+  for(item = p_problems->p_data; item; item = alpm_list_next(item)) {
+    switch(p_problems->err) {
+    case ALPM_ERR_UNSATISFIED_DEPS: {
+      alpm_depmissing_t* p_miss = (alpm_depmissing_t*) item->data;
+      problem = rb_struct_new(rb_cMissingDependency,
+                              frozen_utf8_str(p_miss->target),
+                              dep_to_str(p_miss->depend),
+                              frozen_utf8_str(p_miss->causingpkg));
+      break;
+    }
+    case ALPM_ERR_CONFLICTING_DEPS: {
+      alpm_conflict_t* p_conflict = (alpm_conflict_t*) item->data;
+      problem = rb_struct_new(rb_cConflict,
+                              frozen_utf8_str(p_conflict->package1),
+                              frozen_utf8_str(p_conflict->package2),
+                              dep_to_str(p_conflict->reason));
+      break;
+    }
+    case ALPM_ERR_FILE_CONFLICTS: {
+      alpm_fileconflict_t* p_conflict = (alpm_fileconflict_t*) item->data;
+      problem = rb_struct_new(rb_cFileConflict,
+                              frozen_utf8_str(p_conflict->target),
+                              p_conflict->type == ALPM_FILECONFLICT_TARGET ? STR2SYM("target") : STR2SYM("filesystem"),
+                              rb_str_new2(p_conflict->file),
+                              p_conflict->ctarget && *p_conflict->ctarget ? frozen_utf8_str(p_conflict->ctarget) : Qnil);
+      break;
+    }
+    default:
+      /* Names of offending packages or files */
+      problem = rb_str_new2((char*) item->data);
+      break;
+    }
+
+    rb_ary_push(result, problem);
+  }
+
+  return result;
+}
+
+static VALUE free_problems(VALUE ptr)
+{
+  struct problem_list* p_problems = (struct problem_list*) ptr;
+
+  switch(p_problems->err) {
+  case ALPM_ERR_UNSATISFIED_DEPS:
+    alpm_list_free_inner(p_problems->p_data, (alpm_list_fn_free) alpm_depmissing_free);
+    break;
+  case ALPM_ERR_CONFLICTING_DEPS:
+    alpm_list_free_inner(p_problems->p_data, (alpm_list_fn_free) alpm_conflict_free);
+    break;
+  case ALPM_ERR_FILE_CONFLICTS:
+    alpm_list_free_inner(p_problems->p_data, (alpm_list_fn_free) alpm_fileconflict_free);
+    break;
+  default:
+    alpm_list_free_inner(p_problems->p_data, free);
+    break;
+  }
+  alpm_list_free(p_problems->p_data);
+
+  return Qnil;
+}
+
+/* Arguments for and results of prepare_without_gvl() and
+ * commit_without_gvl(). */
+struct trans_args {
+  alpm_handle_t* p_alpm;
+  alpm_list_t* p_data;
+  alpm_errno_t err;
+  int result;
+};
+
+static void* prepare_without_gvl(void* ptr)
+{
+  struct trans_args* p_args = (struct trans_args*) ptr;
+
+  p_args->result = alpm_trans_prepare(p_args->p_alpm, &p_args->p_data);
+  if (p_args->result < 0)
+    p_args->err = alpm_errno(p_args->p_alpm);
+
+  return NULL;
+}
+
+static void* commit_without_gvl(void* ptr)
+{
+  struct trans_args* p_args = (struct trans_args*) ptr;
+
+  p_args->result = alpm_trans_commit(p_args->p_alpm, &p_args->p_data);
+  if (p_args->result < 0)
+    p_args->err = alpm_errno(p_args->p_alpm);
+
+  return NULL;
+}
+
+/* Unblocking function for both. libalpm checks for the interruption
+ * between packages while committing and ignores it otherwise. Ruby
+ * doesn’t tell why it interrupts the thread, so this also happens for
+ * a signal whose trap handler is to run on it, see #commit. */
+static void trans_ubf(void* ptr)
+{
+  struct trans_args* p_args = (struct trans_args*) ptr;
+  alpm_trans_interrupt(p_args->p_alpm);
+}
+
+/* Runs `func' without the GVL and raises a TransactionError with the
+ * problems libalpm reported if it failed. */
+static void run_without_gvl(VALUE self, void* (*func)(void*))
+{
+  struct trans_args args;
+  struct problem_list problems;
+  VALUE thread = rb_thread_current();
+  VALUE events_alpm;
+  VALUE ary;
+  VALUE error;
+
+  args.p_alpm = get_alpm_from_trans(self);
+  args.p_data = NULL;
+  args.err = 0;
+  args.result = 0;
+
+  /* call_without_gvl() doesn’t raise, so no rb_ensure() needed */
+  events_alpm = rb_thread_local_aref(thread, s_id_events_alpm);
+  rb_thread_local_aset(thread, s_id_events_alpm, rb_iv_get(self, "@alpm"));
+  lock_handle(rb_iv_get(self, "@alpm"));
+  call_without_gvl(func, &args, trans_ubf, &args);
+  unlock_handle(rb_iv_get(self, "@alpm"));
+  rb_thread_local_aset(thread, s_id_events_alpm, events_alpm);
+
+  /* Even a failed or interrupted commit may have changed some
+   * packages. This runs no Ruby code, so it happens even if an
+   * interrupt is pending. */
+  if (func == commit_without_gvl)
+    database_changed(rb_iv_get(self, "@alpm"), alpm_get_localdb(args.p_alpm));
+
+  /* Frees the problem list even if converting it gets interrupted */
+  problems.err = args.err;
+  problems.p_data = args.p_data;
+  ary = rb_ensure(problems_to_ary, (VALUE) &problems, free_problems, (VALUE) &problems);
+
+  raise_pending_errors();
+  if (args.result < 0) {
+    error = rb_exc_new2(rb_eAlpm_TransactionError, alpm_strerror(args.err));
+    rb_iv_set(error, "@problems", ary);
+    rb_exc_raise(error);
+  }
+}
+
 /***************************************
  * Methods
  ***************************************/
@@ -48,6 +389,7 @@ static VALUE add_package(VALUE self, VALUE package)
   p_alpm = get_alpm_from_trans(self);
 
   alpm_add_pkg(p_alpm, p_pkg);
+  flush_log(1);
 
   return package;
 }
@@ -64,6 +406,12 @@ static VALUE add_package2(VALUE self, VALUE package)
   return self;
 }
 
+/* Size function for the enumerator returned by #each_added_package. */
+static VALUE each_added_package_size(VALUE self, VALUE args, VALUE eobj)
+{
+  return list_size(alpm_trans_get_add(get_alpm_from_trans(self)));
+}
+
 /**
  * call-seq:
  *   each_added_package{|pkg| ...}
@@ -82,20 +430,18 @@ static VALUE add_package2(VALUE self, VALUE package)
  */
 static VALUE each_added_package(VALUE self)
 {
-  alpm_list_t* p_pkgs = NULL;
-  unsigned int i;
-
-  p_pkgs = alpm_trans_get_add(get_alpm_from_trans(self));
-
-  RETURN_ENUMERATOR(self, 0, NULL);
-  for(i=0; i < alpm_list_count(p_pkgs); i++){
-    alpm_pkg_t* p_pkg = (alpm_pkg_t*) alpm_list_nth(p_pkgs, i);
-    rb_yield(Data_Wrap_Struct(rb_cAlpm_Package, NULL, NULL, p_pkg));
-  }
+  RETURN_SIZED_ENUMERATOR(self, 0, NULL, each_added_package_size);
 
+  list_each(alpm_trans_get_add(get_alpm_from_trans(self)), list_conv_package, rb_iv_get(self, "@alpm"));
   return Qnil;
 }
 
+/* Size function for the enumerator returned by #each_removed_package. */
+static VALUE each_removed_package_size(VALUE self, VALUE args, VALUE eobj)
+{
+  return list_size(alpm_trans_get_remove(get_alpm_from_trans(self)));
+}
+
 /**
  * call-seq:
  *   each_removed_package{|pkg| ...}
@@ -114,18 +460,119 @@ static VALUE each_added_package(VALUE self)
  */
 static VALUE each_removed_package(VALUE self)
 {
-  alpm_list_t* p_pkgs = NULL;
-  unsigned int i;
+  RETURN_SIZED_ENUMERATOR(self, 0, NULL, each_removed_package_size);
 
-  p_pkgs = alpm_trans_get_remove(get_alpm_from_trans(self));
+  list_each(alpm_trans_get_remove(get_alpm_from_trans(self)), list_conv_package, rb_iv_get(self, "@alpm"));
+  return Qnil;
+}
 
-  RETURN_ENUMERATOR(self, 0, NULL);
-  for(i=0; i < alpm_list_count(p_pkgs); i++){
-    alpm_pkg_t* p_pkg = (alpm_pkg_t*) alpm_list_nth(p_pkgs, i);
-    rb_yield(Data_Wrap_Struct(rb_cAlpm_Package, NULL, NULL, p_pkg));
-  }
+/**
+ * call-seq:
+ *   flags() → an_array
+ *
+ * The flags this transaction was started with, as an array of the
+ * Symbols set to true in the hash passed to Alpm#transaction.
+ */
+static VALUE flags(VALUE self)
+{
+  return flags_to_ary(&transaction_flags, alpm_trans_get_flags(get_alpm_from_trans(self)));
+}
 
-  return Qnil;
+/**
+ * call-seq:
+ *   prepare() → self
+ *
+ * Has libalpm check the transaction, e.g. resolve and check its
+ * dependencies and look for conflicts between the packages. Ruby’s
+ * global VM lock is released meanwhile, so other threads keep
+ * running; it is only reacquired for callbacks like #events.
+ *
+ * === Return value
+ * +self+. Raises an Alpm::TransactionError if the transaction can’t
+ * be committed, whose +problems+ are Transaction::MissingDependency
+ * or Transaction::Conflict instances, or the names of packages built
+ * for the wrong architecture.
+ */
+static VALUE prepare(VALUE self)
+{
+  run_without_gvl(self, prepare_without_gvl);
+  return self;
+}
+
+/**
+ * call-seq:
+ *   commit() → self
+ *
+ * Has libalpm carry out the prepared transaction: download, check
+ * and install the packages to add, and remove those to remove. As
+ * with #prepare, Ruby’s global VM lock is released meanwhile. If
+ * the thread is interrupted, libalpm stops after the package it is
+ * working on, the exception is raised, and the local database
+ * reflects the packages that were done. Note that this includes
+ * signals handled with Signal.trap: their handlers run on the main
+ * thread, so a commit on the main thread is cut short by any trapped
+ * signal. Commit from another thread to keep e.g. USR1 handlers from
+ * aborting it.
+ *
+ * === Return value
+ * +self+. Raises an Alpm::TransactionError on failure, whose
+ * +problems+ are Transaction::FileConflict instances, or the names
+ * of packages or files that are invalid or failed verification.
+ */
+static VALUE commit(VALUE self)
+{
+  run_without_gvl(self, commit_without_gvl);
+  return self;
+}
+
+/**
+ * call-seq:
+ *   events(){|event| ...}
+ *   events( queue: a_queue )
+ *
+ * Reports the steps of this transaction while it is prepared and
+ * committed: dependency and conflict checks, integrity checks, file
+ * conflict scans, and the progress of adding and removing each
+ * package. Each report is an Alpm::Transaction::Event.
+ *
+ * The block is called right when libalpm reports the step, so a slow
+ * block slows down the transaction. Pass a Thread::Queue instead to
+ * have the events pushed onto it and consume them from another
+ * thread. Either way, the reports end with the transaction.
+ *
+ * === Parameters
+ * [queue]
+ *   A Thread::Queue (or anything responding to #push) that receives
+ *   the events instead of the block.
+ * [event (Block)]
+ *   The Event.
+ */
+static VALUE events(int argc, VALUE argv[], VALUE self)
+{
+  alpm_handle_t* p_alpm = get_alpm_from_trans(self);
+  VALUE opts;
+  VALUE kwval = Qundef;
+  ID kwname;
+  VALUE receiver = Qnil;
+
+  rb_scan_args(argc, argv, "0:", &opts);
+
+  kwname = rb_intern("queue");
+  if (!NIL_P(opts))
+    rb_get_kwargs(opts, &kwname, 0, 1, &kwval);
+
+  if (kwval != Qundef && !NIL_P(kwval))
+    receiver = kwval;
+  else if (rb_block_given_p())
+    receiver = rb_block_proc();
+  else
+    rb_raise(rb_eArgError, "Neither a block nor a queue given.");
+
+  rb_ivar_set(rb_iv_get(self, "@alpm"), s_id_event_receiver, receiver);
+  alpm_option_set_eventcb(p_alpm, event_callback);
+  alpm_option_set_progresscb(p_alpm, progress_callback);
+
+  return self;
 }
 
 /***************************************
@@ -160,4 +607,131 @@ void Init_transaction()
   rb_define_method(rb_cAlpm_Transaction, "<<", RUBY_METHOD_FUNC(add_package2), 1);
   rb_define_method(rb_cAlpm_Transaction, "each_added_package", RUBY_METHOD_FUNC(each_added_package), 0);
   rb_define_method(rb_cAlpm_Transaction, "each_removed_package", RUBY_METHOD_FUNC(each_removed_package), 0);
+  rb_define_method(rb_cAlpm_Transaction, "flags", RUBY_METHOD_FUNC(flags), 0);
+  rb_define_method(rb_cAlpm_Transaction, "prepare", RUBY_METHOD_FUNC(prepare), 0);
+  rb_define_method(rb_cAlpm_Transaction, "commit", RUBY_METHOD_FUNC(commit), 0);
+  rb_define_method(rb_cAlpm_Transaction, "events", RUBY_METHOD_FUNC(events), -1);
+
+  /*
+   * Document-class: Alpm::TransactionError
+   *
+   * Raised by Transaction#prepare and Transaction#commit. Its
+   * +problems+ tell what exactly is wrong with the transaction.
+   */
+  rb_eAlpm_TransactionError = rb_define_class_under(rb_cAlpm, "TransactionError", rb_eAlpm_Error);
+  rb_define_attr(rb_eAlpm_TransactionError, "problems", 1, 0);
+
+  /*
+   * Document-class: Alpm::Transaction::MissingDependency
+   *
+   * A dependency of package +target+ that can’t be satisfied, as
+   * a string like "foo>=1.0". +causing_package+ is the name of the
+   * package whose removal breaks it, if any.
+   */
+  rb_cMissingDependency = rb_struct_define_under(rb_cAlpm_Transaction, "MissingDependency",
+                                                 "target", "dependency", "causing_package", NULL);
+
+  /*
+   * Document-class: Alpm::Transaction::Conflict
+   *
+   * Two packages of the transaction that conflict with each other
+   * because of +reason+, a dependency string.
+   */
+  rb_cConflict = rb_struct_define_under(rb_cAlpm_Transaction, "Conflict",
+                                        "package1", "package2", "reason", NULL);
+
+  /*
+   * Document-class: Alpm::Transaction::FileConflict
+   *
+   * A +file+ of package +target+ that is already owned by package
+   * +conflicting_target+ (if +type+ is +:target+) or exists on the
+   * file system (+:filesystem+).
+   */
+  rb_cFileConflict = rb_struct_define_under(rb_cAlpm_Transaction, "FileConflict",
+                                            "target", "type", "file", "conflicting_target", NULL);
+
+  /*
+   * Document-class: Alpm::Transaction::Event
+   *
+   * A step of a transaction, see Transaction#events. Members:
+   *
+   * [type]
+   *   What happened, as a symbol. Events reported once per step are
+   *   named after libalpm’s events, e.g. +:checkdeps_start+,
+   *   +:fileconflicts_done+, +:add_start+, +:scriptlet_info+. Progress
+   *   reports are named +:add_progress+, +:remove_progress+,
+   *   +:conflicts_progress+, +:integrity_progress+ and so on.
+   * [package]
+   *   Name of the package concerned, or +nil+.
+   * [percent]
+   *   Progress of the current package in percent (progress reports
+   *   only).
+   * [current]
+   *   Number of the current package (progress reports only).
+   * [total]
+   *   Number of packages in this step (progress reports only).
+   * [detail]
+   *   Additional text for some events, e.g. the scriptlet output for
+   *   +:scriptlet_info+ or the dependency for +:optdep_required+.
+   * [time]
+   *   When libalpm reported the step, in seconds on a monotonic clock
+   *   (compare with Process.clock_gettime(Process::CLOCK_MONOTONIC)).
+   */
+  rb_cAlpm_Transaction_Event = rb_struct_define_under(rb_cAlpm_Transaction, "Event",
+                                                      "type", "package", "percent", "current",
+                                                      "total", "detail", "time", NULL);
+
+  event_types[ALPM_EVENT_CHECKDEPS_START] = STR2SYM("checkdeps_start");
+  event_types[ALPM_EVENT_CHECKDEPS_DONE] = STR2SYM("checkdeps_done");
+  event_types[ALPM_EVENT_FILECONFLICTS_START] = STR2SYM("fileconflicts_start");
+  event_types[ALPM_EVENT_FILECONFLICTS_DONE] = STR2SYM("fileconflicts_done");
+  event_types[ALPM_EVENT_RESOLVEDEPS_START] = STR2SYM("resolvedeps_start");
+  event_types[ALPM_EVENT_RESOLVEDEPS_DONE] = STR2SYM("resolvedeps_done");
+  event_types[ALPM_EVENT_INTERCONFLICTS_START] = STR2SYM("interconflicts_start");
+  event_types[ALPM_EVENT_INTERCONFLICTS_DONE] = STR2SYM("interconflicts_done");
+  event_types[ALPM_EVENT_ADD_START] = STR2SYM("add_start");
+  event_types[ALPM_EVENT_ADD_DONE] = STR2SYM("add_done");
+  event_types[ALPM_EVENT_REMOVE_START] = STR2SYM("remove_start");
+  event_types[ALPM_EVENT_REMOVE_DONE] = STR2SYM("remove_done");
+  event_types[ALPM_EVENT_UPGRADE_START] = STR2SYM("upgrade_start");
+  event_types[ALPM_EVENT_UPGRADE_DONE] = STR2SYM("upgrade_done");
+  event_types[ALPM_EVENT_DOWNGRADE_START] = STR2SYM("downgrade_start");
+  event_types[ALPM_EVENT_DOWNGRADE_DONE] = STR2SYM("downgrade_done");
+  event_types[ALPM_EVENT_REINSTALL_START] = STR2SYM("reinstall_start");
+  event_types[ALPM_EVENT_REINSTALL_DONE] = STR2SYM("reinstall_done");
+  event_types[ALPM_EVENT_INTEGRITY_START] = STR2SYM("integrity_start");
+  event_types[ALPM_EVENT_INTEGRITY_DONE] = STR2SYM("integrity_done");
+  event_types[ALPM_EVENT_LOAD_START] = STR2SYM("load_start");
+  event_types[ALPM_EVENT_LOAD_DONE] = STR2SYM("load_done");
+  event_types[ALPM_EVENT_DELTA_INTEGRITY_START] = STR2SYM("delta_integrity_start");
+  event_types[ALPM_EVENT_DELTA_INTEGRITY_DONE] = STR2SYM("delta_integrity_done");
+  event_types[ALPM_EVENT_DELTA_PATCHES_START] = STR2SYM("delta_patches_start");
+  event_types[ALPM_EVENT_DELTA_PATCHES_DONE] = STR2SYM("delta_patches_done");
+  event_types[ALPM_EVENT_DELTA_PATCH_START] = STR2SYM("delta_patch_start");
+  event_types[ALPM_EVENT_DELTA_PATCH_DONE] = STR2SYM("delta_patch_done");
+  event_types[ALPM_EVENT_DELTA_PATCH_FAILED] = STR2SYM("delta_patch_failed");
+  event_types[ALPM_EVENT_SCRIPTLET_INFO] = STR2SYM("scriptlet_info");
+  event_types[ALPM_EVENT_RETRIEVE_START] = STR2SYM("retrieve_start");
+  event_types[ALPM_EVENT_DISKSPACE_START] = STR2SYM("diskspace_start");
+  event_types[ALPM_EVENT_DISKSPACE_DONE] = STR2SYM("diskspace_done");
+  event_types[ALPM_EVENT_OPTDEP_REQUIRED] = STR2SYM("optdep_required");
+  event_types[ALPM_EVENT_DATABASE_MISSING] = STR2SYM("database_missing");
+  event_types[ALPM_EVENT_KEYRING_START] = STR2SYM("keyring_start");
+  event_types[ALPM_EVENT_KEYRING_DONE] = STR2SYM("keyring_done");
+  event_types[ALPM_EVENT_KEY_DOWNLOAD_START] = STR2SYM("key_download_start");
+  event_types[ALPM_EVENT_KEY_DOWNLOAD_DONE] = STR2SYM("key_download_done");
+
+  progress_types[ALPM_PROGRESS_ADD_START] = STR2SYM("add_progress");
+  progress_types[ALPM_PROGRESS_UPGRADE_START] = STR2SYM("upgrade_progress");
+  progress_types[ALPM_PROGRESS_DOWNGRADE_START] = STR2SYM("downgrade_progress");
+  progress_types[ALPM_PROGRESS_REINSTALL_START] = STR2SYM("reinstall_progress");
+  progress_types[ALPM_PROGRESS_REMOVE_START] = STR2SYM("remove_progress");
+  progress_types[ALPM_PROGRESS_CONFLICTS_START] = STR2SYM("conflicts_progress");
+  progress_types[ALPM_PROGRESS_DISKSPACE_START] = STR2SYM("diskspace_progress");
+  progress_types[ALPM_PROGRESS_INTEGRITY_START] = STR2SYM("integrity_progress");
+  progress_types[ALPM_PROGRESS_LOAD_START] = STR2SYM("load_progress");
+  progress_types[ALPM_PROGRESS_KEYRING_START] = STR2SYM("keyring_progress");
+
+  s_id_event_receiver = rb_intern("event_receiver");
+  s_id_events_alpm = rb_intern("__alpm_events_alpm__");
 }
@@ -4,7 +4,10 @@
 #include "package.h"
 
 extern VALUE rb_cAlpm_Transaction;
+extern VALUE rb_cAlpm_Transaction_Event;
+extern VALUE rb_eAlpm_TransactionError;
 
+void transaction_events_reset(VALUE rb_alpm);
 void Init_transaction();
 
 #endif
@@ -0,0 +1,528 @@
+#include <ctype.h>
+#include <string.h>
+#include <ruby/util.h>
+#include "version.h"
+
+/***************************************
+ * Variables
+ ***************************************/
+
+VALUE rb_cAlpm_Version;
+
+/* An Alpm::Version instance: its own copy of the version string
+ * and the segments pointing into it. */
+typedef struct {
+  char* p_str;
+  version_token_t* p_tokens;
+  version_t version;
+} rb_version_t;
+
+/* One string to sort, see Version.sort. */
+typedef struct {
+  version_t version;
+  long index;
+} sort_entry_t;
+
+/***************************************
+ * Helpers
+ ***************************************/
+
+/* Splits `str' into its epoch, pkgver and pkgrel just like libalpm’s
+ * parseEVR() does. A missing or empty epoch is "0"; a missing pkgrel
+ * is reported as a NULL `*pp_rel'. */
+static void split_evr(const char* str,
+                      const char** pp_epoch, size_t* p_epoch_len,
+                      const char** pp_ver, size_t* p_ver_len,
+                      const char** pp_rel, size_t* p_rel_len)
+{
+  const char* s = str;
+  const char* se = NULL;
+
+  while (*s && isdigit((unsigned char) *s))
+    s++;
+  se = strrchr(s, '-');
+
+  if (*s == ':' && s != str) {
+    *pp_epoch = str;
+    *p_epoch_len = s - str;
+    *pp_ver = s + 1;
+  }
+  else {
+    *pp_epoch = "0";
+    *p_epoch_len = 1;
+    *pp_ver = *s == ':' ? s + 1 : str;
+  }
+
+  if (se) {
+    *p_ver_len = se - *pp_ver;
+    *pp_rel = se + 1;
+    *p_rel_len = strlen(se + 1);
+  }
+  else {
+    *p_ver_len = strlen(*pp_ver);
+    *pp_rel = NULL;
+    *p_rel_len = 0;
+  }
+}
+
+/* Splits the `len' bytes at `str' into alphabetic and numeric
+ * segments, appending them to `p_version->p_tokens' as `part'. */
+static void tokenize(const char* str, size_t len, version_t* p_version, enum version_part part, uint32_t* p_ntokens)
+{
+  const char* p = str;
+  const char* end = str + len;
+  const char* q = NULL;
+  size_t sep;
+
+  p_version->start[part] = *p_ntokens;
+  p_version->count[part] = 0;
+  p_version->trailing[part] = 0;
+
+  while (p < end) {
+    version_token_t* p_token = NULL;
+
+    for(sep=0; p < end && !isalnum((unsigned char) *p); sep++)
+      p++;
+    if (sep > UINT16_MAX)
+      sep = UINT16_MAX;
+
+    if (p == end) {
+      p_version->trailing[part] = sep;
+      break;
+    }
+
+    p_token = &p_version->p_tokens[(*p_ntokens)++];
+    p_token->sep = sep;
+    p_token->is_num = isdigit((unsigned char) *p) ? 1 : 0;
+
+    q = p;
+    if (p_token->is_num) {
+      while (q < end && isdigit((unsigned char) *q))
+        q++;
+      /* Leading zeros don’t count */
+      while (p < q && *p == '0')
+        p++;
+    }
+    else {
+      while (q < end && isalpha((unsigned char) *q))
+        q++;
+    }
+
+    p_token->str = p;
+    p_token->len = q - p;
+    p_version->count[part]++;
+    p = q;
+  }
+}
+
+/* Compares two segments of the same kind like rpmvercmp(): numbers
+ * by their number of digits first, everything else with strcmp(). */
+static int compare_token(const version_token_t* p_a, const version_token_t* p_b)
+{
+  uint32_t len = p_a->len < p_b->len ? p_a->len : p_b->len;
+  int result;
+
+  if (p_a->is_num && p_a->len != p_b->len)
+    return p_a->len < p_b->len ? -1 : 1;
+
+  /* Single = intended */
+  if ((result = memcmp(p_a->str, p_b->str, len)))
+    return result < 0 ? -1 : 1;
+  if (p_a->len != p_b->len)
+    return p_a->len < p_b->len ? -1 : 1;
+
+  return 0;
+}
+
+/* Compares one part of two versions, reproducing rpmvercmp()
+ * segment by segment, including its handling of separators and of
+ * one version running out of segments before the other. */
+static int compare_part(const version_t* p_a, const version_t* p_b, enum version_part part)
+{
+  const version_token_t* a = p_a->p_tokens + p_a->start[part];
+  const version_token_t* b = p_b->p_tokens + p_b->start[part];
+  uint32_t n = p_a->count[part];
+  uint32_t m = p_b->count[part];
+  uint32_t i;
+  int result;
+
+  for(i=0; ; i++) {
+    int a_has = i < n;
+    int b_has = i < m;
+    int a_rest = a_has || p_a->trailing[part] > 0;
+    int b_rest = b_has || p_b->trailing[part] > 0;
+
+    /* One string is used up before its leading separators are
+     * skipped: a remaining alphabetic segment never beats it. */
+    if (!a_rest && !b_rest)
+      return 0;
+    if (!a_rest)
+      return (b_has && b[i].sep == 0 && !b[i].is_num) ? 1 : -1;
+    if (!b_rest)
+      return (a_has && a[i].sep == 0 && !a[i].is_num) ? -1 : 1;
+
+    /* Both had something left, but after the separators only one
+     * (or none) has another segment. */
+    if (!a_has && !b_has)
+      return 0;
+    if (!a_has)
+      return b[i].is_num ? -1 : 1;
+    if (!b_has)
+      return a[i].is_num ? 1 : -1;
+
+    if (a[i].sep != b[i].sep)
+      return a[i].sep < b[i].sep ? -1 : 1;
+    /* Numeric segments are always newer than alphabetic ones */
+    if (a[i].is_num != b[i].is_num)
+      return a[i].is_num ? 1 : -1;
+
+    /* Single = intended */
+    if ((result = compare_token(&a[i], &b[i])))
+      return result;
+  }
+}
+
+static void free_version(void* ptr)
+{
+  rb_version_t* p_version = (rb_version_t*) ptr;
+
+  xfree(p_version->p_str);
+  xfree(p_version->p_tokens);
+  xfree(p_version);
+}
+
+static VALUE allocate(VALUE klass)
+{
+  rb_version_t* p_version = NULL;
+  return Data_Make_Struct(klass, rb_version_t, NULL, free_version, p_version);
+}
+
+static rb_version_t* get_version(VALUE self)
+{
+  rb_version_t* p_version = NULL;
+
+  Data_Get_Struct(self, rb_version_t, p_version);
+  if (!p_version->p_str)
+    rb_raise(rb_eAlpm_Error, "Uninitialized version");
+
+  return p_version;
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+  const sort_entry_t* p_a = (const sort_entry_t*) a;
+  const sort_entry_t* p_b = (const sort_entry_t*) b;
+  int result = version_compare(&p_a->version, &p_b->version);
+
+  /* Keep equal versions in their original order */
+  if (result == 0)
+    return p_a->index < p_b->index ? -1 : (p_a->index > p_b->index);
+
+  return result;
+}
+
+/***************************************
+ * Interface
+ ***************************************/
+
+/** Upper bound of the number of segments of `str', i.e. how many
+ * tokens version_parse() needs room for. */
+size_t version_max_tokens(const char* str)
+{
+  /* Every segment has at least one character; the default epoch
+   * adds one. */
+  return strlen(str) + 1;
+}
+
+/** Splits `str' into `p_version' using the `version_max_tokens(str)'
+ * tokens at `p_tokens'. The tokens point into `str', which must stay
+ * valid and unchanged for as long as `p_version' is used. */
+void version_parse(const char* str, version_t* p_version, version_token_t* p_tokens)
+{
+  const char* epoch = NULL;
+  const char* ver = NULL;
+  const char* rel = NULL;
+  size_t epoch_len, ver_len, rel_len;
+  uint32_t ntokens = 0;
+
+  split_evr(str, &epoch, &epoch_len, &ver, &ver_len, &rel, &rel_len);
+
+  p_version->p_tokens = p_tokens;
+  tokenize(epoch, epoch_len, p_version, VERSION_EPOCH, &ntokens);
+  tokenize(ver, ver_len, p_version, VERSION_PKGVER, &ntokens);
+  tokenize(rel ? rel : "", rel_len, p_version, VERSION_PKGREL, &ntokens);
+  p_version->has_pkgrel = rel != NULL;
+}
+
+/** Compares two parsed versions, returning the same as
+ * alpm_pkg_vercmp() would for the original strings: epochs first,
+ * then pkgvers, then pkgrels if both versions have one. */
+int version_compare(const version_t* p_a, const version_t* p_b)
+{
+  int result;
+
+  /* Single = intended */
+  if ((result = compare_part(p_a, p_b, VERSION_EPOCH)))
+    return result;
+  if ((result = compare_part(p_a, p_b, VERSION_PKGVER)))
+    return result;
+  if (p_a->has_pkgrel && p_b->has_pkgrel)
+    return compare_part(p_a, p_b, VERSION_PKGREL);
+
+  return 0;
+}
+
+/** Creates a new Alpm::Version for `str'. */
+VALUE version_new(const char* str)
+{
+  VALUE rbstr = rb_str_new_cstr(str);
+  return rb_class_new_instance(1, &rbstr, rb_cAlpm_Version);
+}
+
+/***************************************
+ * Methods
+ ***************************************/
+
+/**
+ * call-seq:
+ *   new( str ) → a_version
+ *
+ * Parses the version string +str+, of the form
+ * <tt>[epoch:]pkgver[-pkgrel]</tt>. Any string is accepted, just
+ * like libalpm does.
+ */
+static VALUE initialize(VALUE self, VALUE str)
+{
+  rb_version_t* p_version = NULL;
+  const char* cstr = StringValueCStr(str);
+
+  Data_Get_Struct(self, rb_version_t, p_version);
+  xfree(p_version->p_str);
+  xfree(p_version->p_tokens);
+  p_version->p_str = NULL;
+  p_version->p_tokens = NULL;
+
+  p_version->p_tokens = ALLOC_N(version_token_t, version_max_tokens(cstr));
+  p_version->p_str = ruby_strdup(cstr);
+  version_parse(p_version->p_str, &p_version->version, p_version->p_tokens);
+
+  return self;
+}
+
+/**
+ * call-seq:
+ *   self <=> other → -1, 0, 1, or nil
+ *
+ * Compares two versions like libalpm’s alpm_pkg_vercmp() does, but
+ * without parsing them again. +other+ may also be a String.
+ */
+static VALUE compare(VALUE self, VALUE other)
+{
+  rb_version_t* p_version = get_version(self);
+  version_t other_version;
+  version_token_t* p_tokens = NULL;
+  VALUE tmp;
+  int result;
+
+  if (RTEST(rb_obj_is_kind_of(other, rb_cAlpm_Version)))
+    return INT2FIX(version_compare(&p_version->version, &get_version(other)->version));
+  if (!RB_TYPE_P(other, T_STRING))
+    return Qnil;
+
+  p_tokens = ALLOCV_N(version_token_t, tmp, version_max_tokens(StringValueCStr(other)));
+  version_parse(RSTRING_PTR(other), &other_version, p_tokens);
+  result = version_compare(&p_version->version, &other_version);
+  ALLOCV_END(tmp);
+
+  return INT2FIX(result);
+}
+
+/**
+ * call-seq:
+ *   epoch() → an_integer
+ *
+ * The epoch, 0 if there is none.
+ */
+static VALUE epoch(VALUE self)
+{
+  rb_version_t* p_version = get_version(self);
+  const char *epoch, *ver, *rel;
+  size_t epoch_len, ver_len, rel_len;
+
+  split_evr(p_version->p_str, &epoch, &epoch_len, &ver, &ver_len, &rel, &rel_len);
+  return rb_str_to_inum(rb_str_new(epoch, epoch_len), 10, 0);
+}
+
+/**
+ * call-seq:
+ *   pkgver() → a_string
+ *
+ * The upstream version.
+ */
+static VALUE pkgver(VALUE self)
+{
+  rb_version_t* p_version = get_version(self);
+  const char *epoch, *ver, *rel;
+  size_t epoch_len, ver_len, rel_len;
+
+  split_evr(p_version->p_str, &epoch, &epoch_len, &ver, &ver_len, &rel, &rel_len);
+  return rb_enc_str_new(ver, ver_len, rb_utf8_encoding());
+}
+
+/**
+ * call-seq:
+ *   pkgrel() → a_string or nil
+ *
+ * The package release, or +nil+ if there is none.
+ */
+static VALUE pkgrel(VALUE self)
+{
+  rb_version_t* p_version = get_version(self);
+  const char *epoch, *ver, *rel;
+  size_t epoch_len, ver_len, rel_len;
+
+  split_evr(p_version->p_str, &epoch, &epoch_len, &ver, &ver_len, &rel, &rel_len);
+  if (!rel)
+    return Qnil;
+
+  return rb_enc_str_new(rel, rel_len, rb_utf8_encoding());
+}
+
+/**
+ * call-seq:
+ *   to_s() → a_string
+ *
+ * The version string this was created from.
+ */
+static VALUE to_s(VALUE self)
+{
+  return rb_enc_str_new_cstr(get_version(self)->p_str, rb_utf8_encoding());
+}
+
+/**
+ * call-seq:
+ *   inspect() → a_string
+ *
+ * Human-readable description.
+ */
+static VALUE inspect(VALUE self)
+{
+  return rb_sprintf("#<%s %s>", rb_obj_classname(self), get_version(self)->p_str);
+}
+
+/**
+ * call-seq:
+ *   eql?( other ) → true or false
+ *
+ * True if +other+ is a Version with the same string. Note that
+ * versions can compare equal with #== without being #eql?, e.g.
+ * <tt>1.01</tt> and <tt>1.1</tt>.
+ */
+static VALUE eql(VALUE self, VALUE other)
+{
+  if (!RTEST(rb_obj_is_kind_of(other, rb_cAlpm_Version)))
+    return Qfalse;
+
+  return strcmp(get_version(self)->p_str, get_version(other)->p_str) == 0 ? Qtrue : Qfalse;
+}
+
+/**
+ * call-seq:
+ *   hash() → an_integer
+ *
+ * Hash value consistent with #eql?.
+ */
+static VALUE hash(VALUE self)
+{
+  return rb_hash(rb_str_new_cstr(get_version(self)->p_str));
+}
+
+/**
+ * call-seq:
+ *   sort( strings ) → an_array
+ *
+ * Sorts the version strings in +strings+ from oldest to newest
+ * entirely in C: each string is parsed once, and no Version objects
+ * are created nor Ruby methods called for the comparisons.
+ *
+ * === Parameters
+ * [strings]
+ *   An array of version strings.
+ *
+ * === Return value
+ * A new array with the same strings, sorted. Equal versions keep
+ * their order.
+ */
+static VALUE sort(VALUE klass, VALUE strings)
+{
+  VALUE ary = rb_ary_dup(rb_convert_type(strings, T_ARRAY, "Array", "to_ary"));
+  VALUE tmp_entries, tmp_tokens;
+  sort_entry_t* p_entries = NULL;
+  version_token_t* p_tokens = NULL;
+  size_t ntokens = 0;
+  VALUE result;
+  long len = RARRAY_LEN(ary);
+  long i;
+
+  /* Validate everything before pointing into the strings */
+  for(i=0; i < len; i++) {
+    VALUE str = rb_ary_entry(ary, i);
+    ntokens += version_max_tokens(StringValueCStr(str));
+    rb_ary_store(ary, i, str);
+  }
+
+  p_entries = ALLOCV_N(sort_entry_t, tmp_entries, len);
+  p_tokens = ALLOCV_N(version_token_t, tmp_tokens, ntokens);
+
+  ntokens = 0;
+  for(i=0; i < len; i++) {
+    const char* str = RSTRING_PTR(rb_ary_entry(ary, i));
+
+    version_parse(str, &p_entries[i].version, p_tokens + ntokens);
+    p_entries[i].index = i;
+    ntokens += version_max_tokens(str);
+  }
+
+  qsort(p_entries, len, sizeof(sort_entry_t), compare_entries);
+
+  result = rb_ary_new_capa(len);
+  for(i=0; i < len; i++)
+    rb_ary_push(result, rb_ary_entry(ary, p_entries[i].index));
+
+  ALLOCV_END(tmp_tokens);
+  ALLOCV_END(tmp_entries);
+  return result;
+}
+
+/***************************************
+ * Binding
+ ***************************************/
+
+/**
+ * Document-class: Alpm::Version
+ *
+ * A package version string of the form
+ * <tt>[epoch:]pkgver[-pkgrel]</tt>, split into its segments once so
+ * that comparisons are cheap. Versions compare exactly like
+ * libalpm’s alpm_pkg_vercmp() compares the strings; in particular the pkgrel is only
+ * taken into account if both versions have one. See also
+ * Package#parsed_version.
+ */
+void Init_version()
+{
+  rb_cAlpm_Version = rb_define_class_under(rb_cAlpm, "Version", rb_cObject);
+  rb_include_module(rb_cAlpm_Version, rb_mComparable);
+  rb_define_alloc_func(rb_cAlpm_Version, allocate);
+
+  rb_define_singleton_method(rb_cAlpm_Version, "sort", RUBY_METHOD_FUNC(sort), 1);
+
+  rb_define_method(rb_cAlpm_Version, "initialize", RUBY_METHOD_FUNC(initialize), 1);
+  rb_define_method(rb_cAlpm_Version, "<=>", RUBY_METHOD_FUNC(compare), 1);
+  rb_define_method(rb_cAlpm_Version, "epoch", RUBY_METHOD_FUNC(epoch), 0);
+  rb_define_method(rb_cAlpm_Version, "pkgver", RUBY_METHOD_FUNC(pkgver), 0);
+  rb_define_method(rb_cAlpm_Version, "pkgrel", RUBY_METHOD_FUNC(pkgrel), 0);
+  rb_define_method(rb_cAlpm_Version, "to_s", RUBY_METHOD_FUNC(to_s), 0);
+  rb_define_method(rb_cAlpm_Version, "inspect", RUBY_METHOD_FUNC(inspect), 0);
+  rb_define_method(rb_cAlpm_Version, "eql?", RUBY_METHOD_FUNC(eql), 1);
+  rb_define_method(rb_cAlpm_Version, "hash", RUBY_METHOD_FUNC(hash), 0);
+}
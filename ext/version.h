@@ -0,0 +1,43 @@
+#ifndef RUBY_ALPM_VERSION_H
+#define RUBY_ALPM_VERSION_H
+#include <stdint.h>
+#include "main.h"
+
+/* Parts of a version string [epoch:]pkgver[-pkgrel]. */
+enum version_part {
+  VERSION_EPOCH = 0,
+  VERSION_PKGVER,
+  VERSION_PKGREL,
+  VERSION_PART_COUNT
+};
+
+/* An alphabetic or numeric segment of a version part, as libalpm’s
+ * rpmvercmp() splits them. Numeric segments are stored without
+ * leading zeros. */
+typedef struct {
+  const char* str; /* Not NUL-terminated, points into the version string */
+  uint32_t len;
+  uint16_t sep;    /* Number of separator characters before it */
+  uint8_t is_num;
+} version_token_t;
+
+/* A version string split up once so that comparing it is a plain
+ * walk over its segments, yielding the same result as
+ * alpm_pkg_vercmp(). */
+typedef struct {
+  version_token_t* p_tokens;
+  uint32_t start[VERSION_PART_COUNT];
+  uint32_t count[VERSION_PART_COUNT];
+  uint16_t trailing[VERSION_PART_COUNT]; /* Separators after the last segment */
+  int has_pkgrel;
+} version_t;
+
+extern VALUE rb_cAlpm_Version;
+
+size_t version_max_tokens(const char* str);
+void version_parse(const char* str, version_t* p_version, version_token_t* p_tokens);
+int version_compare(const version_t* p_a, const version_t* p_b);
+VALUE version_new(const char* str);
+void Init_version();
+
+#endif